@@ -1,4 +1,6 @@
+#include "samal_lib/Bytes.hpp"
 #include "samal_lib/ExternalVMValue.hpp"
+#include "samal_lib/NativeCallFrame.hpp"
 #include "samal_lib/Pipeline.hpp"
 #include <iostream>
 #include <netinet/in.h>
@@ -22,6 +24,7 @@ int main(int argc, char** argv) {
     pl.addFile("samal_code/lib/Net.samal");
     pl.addFile("samal_code/lib/Gfx.samal");
     pl.addFile("samal_code/lib/Math.samal");
+    pl.addFile("samal_code/lib/Bytes.samal");
     pl.addFile("samal_code/examples/Templ.samal");
     pl.addFile("samal_code/examples/Lists.samal");
     pl.addFile("samal_code/examples/Structs.samal");
@@ -104,6 +107,22 @@ int main(int argc, char** argv) {
             buffer << file.rdbuf();
             return ExternalVMValue::wrapEnum(vm, maybeStringType, "Some", {ExternalVMValue::wrapString(vm, buffer.str())});
         }});
+    auto maybeBytesType = pl.type("Core.Maybe<bytes>");
+    pl.addNativeFunction(NativeFunction{
+        "IO.readFileAsBytes",
+        pl.type("fn([char]) -> Core.Maybe<bytes>"),
+        [maybeBytesType](VM& vm, const std::vector<ExternalVMValue>& params) -> ExternalVMValue {
+            auto path = params.at(0).toCPPString();
+            if(!std::filesystem::is_regular_file(path)) {
+                return ExternalVMValue::wrapEnum(vm, maybeBytesType, "None", {});
+            }
+            std::ifstream file(path, std::ios::binary);
+            if(!file) {
+                return ExternalVMValue::wrapEnum(vm, maybeBytesType, "None", {});
+            }
+            std::vector<uint8_t> buffer{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+            return ExternalVMValue::wrapEnum(vm, maybeBytesType, "Some", {ExternalVMValue::wrapBytes(vm, buffer.data(), buffer.size())});
+        }});
 
     // Server functions
     pl.addNativeFunction(NativeFunction{
@@ -180,14 +199,14 @@ int main(int argc, char** argv) {
     pl.addNativeFunction(NativeFunction{
         "Net.recvChar",
         pl.type("fn(i32) -> char"),
-        [](VM& vm, const std::vector<ExternalVMValue>& params) -> ExternalVMValue {
-            auto sock = params.at(0).as<int32_t>();
+        {},
+        [](VM&, int64_t sock, int64_t, int64_t, int64_t, int64_t) -> int64_t {
             char buf = -1;
             // TODO read whole utf-8 codepoint
-            if(read(sock, &buf, 1) <= 0) {
-                return ExternalVMValue::wrapChar(vm, 0);
+            if(read(static_cast<int32_t>(sock), &buf, 1) <= 0) {
+                return 0;
             }
-            return ExternalVMValue::wrapChar(vm, buf);
+            return buf;
         }});
     pl.addNativeFunction(NativeFunction{
         "Core.toBytes",
@@ -207,36 +226,62 @@ int main(int argc, char** argv) {
     pl.addNativeFunction(NativeFunction{
         "Net.sendBytes",
         pl.type("fn(i32, [byte]) -> ()"),
-        [](VM& vm, const std::vector<ExternalVMValue>& params) -> ExternalVMValue {
-            auto sock = params.at(0).as<int32_t>();
-            auto string = params.at(1).toByteBuffer();
-            write(sock, string.data(), string.size());
-            return ExternalVMValue::wrapEmptyTuple(vm);
+        {},
+        nullptr,
+        [](NativeCallFrame& frame) {
+            auto sock = frame.arg<int32_t>(0);
+            uint8_t buffer[4096];
+            size_t bufferSize = 0;
+            for(auto* element : frame.argList(1)) {
+                buffer[bufferSize++] = *element;
+                if(bufferSize == sizeof(buffer)) {
+                    write(sock, buffer, bufferSize);
+                    bufferSize = 0;
+                }
+            }
+            write(sock, buffer, bufferSize);
+        }});
+    pl.addNativeFunction(NativeFunction{
+        "Net.sendBuffer",
+        pl.type("fn(i32, bytes) -> ()"),
+        {},
+        nullptr,
+        [](NativeCallFrame& frame) {
+            auto buffer = frame.arg<BytesValue>(1);
+            if(buffer.length > 0) {
+                write(frame.arg<int32_t>(0), buffer.data(), buffer.length);
+            }
         }});
     pl.addNativeFunction(NativeFunction{
         "Net.closeSocket",
         pl.type("fn(i32) -> ()"),
-        [](VM& vm, const std::vector<ExternalVMValue>& params) -> ExternalVMValue {
-            auto sock = params.at(0).as<int32_t>();
-            close(sock);
-            return ExternalVMValue::wrapEmptyTuple(vm);
+        {},
+        nullptr,
+        [](NativeCallFrame& frame) {
+            close(frame.arg<int32_t>(0));
         }});
     pl.addNativeFunction(NativeFunction{
         "Math.randomInt",
         pl.type("fn(i32, i32) -> i32"),
-        [](VM& vm, const std::vector<ExternalVMValue>& params) -> ExternalVMValue {
+        {},
+        nullptr,
+        [](NativeCallFrame& frame) {
             std::random_device r;
             std::default_random_engine e1(r());
-            std::uniform_int_distribution<int32_t> uniform_dist(params.at(0).as<int32_t>(), params.at(1).as<int32_t>());
-            return ExternalVMValue::wrapInt32(vm, uniform_dist(e1));
+            std::uniform_int_distribution<int32_t> uniform_dist(frame.arg<int32_t>(0), frame.arg<int32_t>(1));
+            frame.setReturn(uniform_dist(e1));
         }});
     pl.addNativeFunction(NativeFunction{
         "Math.sqrt",
         pl.type("fn(i32) -> i32"),
-        [](VM& vm, const std::vector<ExternalVMValue>& params) -> ExternalVMValue {
-            auto result = static_cast<int32_t>(sqrt(params.at(0).as<int32_t>()));
-            return ExternalVMValue::wrapInt32(vm, result);
+        {},
+        nullptr,
+        [](NativeCallFrame& frame) {
+            frame.setReturn(static_cast<int32_t>(sqrt(frame.arg<int32_t>(0))));
         }});
+    for(auto& function : createBytesNativeFunctions()) {
+        pl.addNativeFunction(std::move(function));
+    }
     signal(SIGPIPE, [](int) {});
 #ifdef SAMAL_ENABLE_GFX_CAIRO
     pl.addNativeFunction(NativeFunction{
@@ -131,6 +131,9 @@ private:
 class LiteralNode : public ExpressionNode {
 public:
     explicit LiteralNode(SourceCodeRef source);
+    [[nodiscard]] virtual Datatype getDatatype() const = 0;
+    // the value as it's laid out on the stack, used to put lists of literals into the constant area of the program
+    [[nodiscard]] virtual std::vector<uint8_t> toStackValue() const = 0;
     [[nodiscard]] inline const char* getClassName() const override { return "LiteralNode"; }
 
 private:
@@ -139,6 +142,8 @@ private:
 class LiteralInt32Node : public LiteralNode {
 public:
     explicit LiteralInt32Node(SourceCodeRef source, int32_t val);
+    [[nodiscard]] Datatype getDatatype() const override;
+    [[nodiscard]] std::vector<uint8_t> toStackValue() const override;
     Datatype compile(Compiler& comp) const override;
     void findUsedVariables(VariableSearcher&) const override;
     [[nodiscard]] std::string dump(unsigned indent) const override;
@@ -151,6 +156,8 @@ private:
 class LiteralInt64Node : public LiteralNode {
 public:
     explicit LiteralInt64Node(SourceCodeRef source, int64_t val);
+    [[nodiscard]] Datatype getDatatype() const override;
+    [[nodiscard]] std::vector<uint8_t> toStackValue() const override;
     Datatype compile(Compiler& comp) const override;
     void findUsedVariables(VariableSearcher&) const override;
     [[nodiscard]] std::string dump(unsigned indent) const override;
@@ -163,6 +170,8 @@ private:
 class LiteralBoolNode : public LiteralNode {
 public:
     explicit LiteralBoolNode(SourceCodeRef source, bool val);
+    [[nodiscard]] Datatype getDatatype() const override;
+    [[nodiscard]] std::vector<uint8_t> toStackValue() const override;
     Datatype compile(Compiler& comp) const override;
     void findUsedVariables(VariableSearcher&) const override;
     [[nodiscard]] std::string dump(unsigned indent) const override;
@@ -175,6 +184,8 @@ private:
 class LiteralCharNode : public LiteralNode {
 public:
     explicit LiteralCharNode(SourceCodeRef source, int32_t val);
+    [[nodiscard]] Datatype getDatatype() const override;
+    [[nodiscard]] std::vector<uint8_t> toStackValue() const override;
     Datatype compile(Compiler& comp) const override;
     void findUsedVariables(VariableSearcher&) const override;
     [[nodiscard]] std::string dump(unsigned indent) const override;
@@ -187,6 +198,8 @@ private:
 class LiteralByteNode : public LiteralNode {
 public:
     explicit LiteralByteNode(SourceCodeRef source, uint8_t val);
+    [[nodiscard]] Datatype getDatatype() const override;
+    [[nodiscard]] std::vector<uint8_t> toStackValue() const override;
     Datatype compile(Compiler& comp) const override;
     void findUsedVariables(VariableSearcher&) const override;
     [[nodiscard]] std::string dump(unsigned indent) const override;
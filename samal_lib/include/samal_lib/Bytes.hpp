@@ -0,0 +1,36 @@
+#pragma once
+#include "Forward.hpp"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace samal {
+
+// A value of type bytes is a view on a contiguous buffer on the heap, so slicing it doesn't copy anything.
+// The buffer starts with its capacity (8 bytes) followed by the data; empty values don't have a buffer.
+// The value takes 16 bytes on the stack in every mode, so it isn't split into two slots in x86_64_BIT_MODE.
+struct BytesValue {
+    uint8_t* buffer{ nullptr };
+    int32_t offset{ 0 };
+    int32_t length{ 0 };
+
+    [[nodiscard]] inline const uint8_t* data() const {
+        return buffer ? buffer + 8 + offset : nullptr;
+    }
+};
+static_assert(sizeof(BytesValue) == 16);
+
+// size of the buffer including its header, which is what the GC copies
+static inline size_t getBytesBufferSize(const uint8_t* buffer) {
+    int64_t capacity;
+    memcpy(&capacity, buffer, 8);
+    return 8 + capacity;
+}
+
+// Copies len bytes into a new buffer on the heap of the VM
+BytesValue createBytes(VM& vm, const uint8_t* data, size_t len);
+
+// The native functions declared in samal_code/lib/Bytes.samal
+std::vector<NativeFunction> createBytesNativeFunctions();
+
+}
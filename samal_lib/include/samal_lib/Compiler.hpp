@@ -4,6 +4,7 @@
 #include "Instruction.hpp"
 #include "Program.hpp"
 #include "StackInformationTree.hpp"
+#include <map>
 #include <queue>
 #include <stack>
 #include <unordered_map>
@@ -63,8 +64,15 @@ public:
 
 private:
     Program compileInternal();
+    // Peephole pass that replaces common instruction pairs with superinstructions; runs after all labels have been inserted.
+    void fuseInstructions();
+    // Appends the stack maps of all safepoints of the function to the program, see StackMap
+    void createStackMaps(Program::Function& function);
+    // Emits LOAD_CONSTANT_LIST if the list only contains literals; returns the type of the list in this case
+    std::optional<Datatype> tryCompileConstantList(const ListCreationNode& node, const std::optional<Datatype>& elementType);
 
     Program mProgram;
+    PointerMapBuilder mPointerMapBuilder{ mProgram.pointerMaps };
     std::vector<up<ModuleRootNode>>& mRoots;
 
     void pushStackFrame();
@@ -147,6 +155,13 @@ private:
     };
     std::vector<FunctionIdInCodeToInsert> mLabelsToInsertFunctionIds;
 
+    // CALLs whose function id is pushed by a single PUSH_8, resolved in compileInternal() once all ids are patched
+    struct StaticCall {
+        int32_t functionIdLabel{ -1 };
+        int32_t callIp{ -1 };
+    };
+    std::vector<StaticCall> mStaticCalls;
+
     struct LambdaIdInCodeToInsert {
         int32_t label{ -1 };
         const LambdaCreationNode* lambda{ nullptr };
@@ -162,6 +177,8 @@ private:
     up<StackInformationTree> mCurrentStackInfoTree;
     StackInformationTree* mCurrentStackInfoTreeNode{ nullptr };
     std::unordered_map<int32_t, int32_t> mIpToStackSize;
+    // maps the element size and elements of each constant list to its index in Program::constantLists
+    std::map<std::pair<int32_t, std::vector<uint8_t>>, int32_t> mConstantListIds;
 
     Program::Function& compileLambda(const LambdaToCompile&);
 };
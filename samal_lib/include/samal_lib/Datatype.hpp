@@ -24,7 +24,8 @@ enum class DatatypeCategory {
     function,
     list,
     pointer,
-    byte
+    byte,
+    bytes
 };
 
 enum class CheckTypeRecursively {
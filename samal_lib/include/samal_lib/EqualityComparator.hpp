@@ -0,0 +1,55 @@
+#pragma once
+#include "Datatype.hpp"
+#include "Util.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace samal {
+
+// Compares two values of one datatype for structural equality. The datatype is translated once into
+// a list of steps (e.g. a memcmp over adjacent scalar fields), so COMPARE_COMPLEX_EQUALITY doesn't need
+// to walk the Datatype on every execution. Steps behind lists and pointers are only created once they are
+// needed for the first time, as those types may contain themselves.
+class EqualityComparator final {
+public:
+    explicit EqualityComparator(const Datatype& type);
+    EqualityComparator(const EqualityComparator&) = delete;
+    EqualityComparator& operator=(const EqualityComparator&) = delete;
+
+    [[nodiscard]] bool equals(const uint8_t* lhs, const uint8_t* rhs) const;
+    [[nodiscard]] inline int32_t getSizeOnStack() const {
+        return mSizeOnStack;
+    }
+
+private:
+    EqualityComparator() = default;
+    enum class StepType {
+        // memcmp of [offset, offset + size)
+        Bytes,
+        F64,
+        List,
+        Pointer,
+        Enum,
+        // contents of a bytes value, see BytesValue
+        BytesValue
+    };
+    struct Step {
+        StepType type;
+        int32_t offset{ 0 };
+        int32_t size{ 0 };
+        // contained type of a list or base type of a pointer
+        Datatype nestedType;
+        mutable up<EqualityComparator> nested;
+        // comparator for the parameters of each enum field, offsets are relative to the start of the enum
+        std::vector<up<EqualityComparator>> enumFields;
+    };
+    void addSteps(const Datatype& type, int32_t offset);
+    void addBytes(int32_t offset, int32_t size);
+    [[nodiscard]] const EqualityComparator& getNested(const Step& step) const;
+    [[nodiscard]] bool listEquals(const Step& step, const uint8_t* lhs, const uint8_t* rhs) const;
+
+    std::vector<Step> mSteps;
+    int32_t mSizeOnStack{ 0 };
+};
+
+}
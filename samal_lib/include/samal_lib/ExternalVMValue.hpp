@@ -1,4 +1,5 @@
 #pragma once
+#include "Bytes.hpp"
 #include "Datatype.hpp"
 #include "Forward.hpp"
 
@@ -14,6 +15,7 @@ public:
     static ExternalVMValue wrapString(VM& vm, const std::string& string);
     static ExternalVMValue wrapStringAsByteArray(VM& vm, const std::string& string);
     static ExternalVMValue wrapByteArray(VM& vm, const uint8_t* data, size_t len);
+    static ExternalVMValue wrapBytes(VM& vm, const uint8_t* data, size_t len);
     static ExternalVMValue wrapEnum(VM& vm, const Datatype& enumType, const std::string& fieldName, std::vector<ExternalVMValue>&& elements);
     static ExternalVMValue wrapStackedValue(Datatype type, VM& vm, size_t stackOffset);
     static ExternalVMValue wrapFromPtr(Datatype type, VM& vm, const uint8_t* ptr);
@@ -23,6 +25,7 @@ public:
 
     [[nodiscard]] bool isWrappingString() const;
     [[nodiscard]] std::string toCPPString() const;
+    // works for [byte] and bytes
     [[nodiscard]] std::vector<uint8_t> toByteBuffer() const;
     [[nodiscard]] std::vector<ExternalVMValue> toVector() const;
 
@@ -54,7 +57,7 @@ private:
         int32_t selectedFieldIndex;
         std::vector<ExternalVMValue> elements;
     };
-    std::variant<std::monostate, int32_t, int64_t, std::vector<ExternalVMValue>, StructValue, EnumValue, const uint8_t*, uint8_t, bool> mValue;
+    std::variant<std::monostate, int32_t, int64_t, std::vector<ExternalVMValue>, StructValue, EnumValue, const uint8_t*, uint8_t, bool, BytesValue> mValue;
 
     explicit ExternalVMValue(VM& vm, Datatype type, decltype(mValue) val);
 };
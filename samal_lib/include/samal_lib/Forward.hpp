@@ -41,6 +41,8 @@ struct EnumField;
 class Compiler;
 class Datatype;
 class ExternalVMValue;
+class NativeCallFrame;
+struct NativeFunction;
 class VM;
 class Stack;
 struct Program;
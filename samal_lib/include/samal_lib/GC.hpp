@@ -1,15 +1,65 @@
 #pragma once
+#include "PointerMap.hpp"
 #include "Forward.hpp"
 #include "Util.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
 #include <set>
+#include <thread>
 #include <unordered_map>
 #include <vector>
+#include <algorithm>
 #include <array>
 #include <sys/mman.h>
 
 namespace samal {
 
+struct GCStatistics {
+    // Describes one pause of the VM for collecting
+    struct Collection {
+        enum class Type {
+            // only the nursery was collected (in incremental mode, this also includes a step of the incremental collection)
+            Minor,
+            // the whole heap was copied
+            Major,
+            // a step of an incremental collection between two collections of the nursery
+            IncrementalStep
+        };
+        Type type;
+        std::chrono::nanoseconds pauseDuration;
+        // allocated by the program since the previous collection
+        size_t bytesAllocated;
+        // copied by this collection
+        size_t bytesSurvived;
+        // size of the memory reserved for the heap after the collection
+        size_t heapSize;
+    };
+    // Only the most recent collections are kept, oldest first; all of them count towards the totals below
+    static constexpr size_t MAX_RECENT_COLLECTIONS = 1024;
+    std::deque<Collection> recentCollections;
+    size_t minorCollections{ 0 };
+    size_t majorCollections{ 0 };
+    size_t incrementalSteps{ 0 };
+    size_t bytesAllocated{ 0 };
+    std::chrono::nanoseconds totalPauseDuration{ 0 };
+    std::chrono::nanoseconds maxPauseDuration{ 0 };
+    // including the overflow chunks
+    size_t peakHeapSize{ 0 };
+    // number of overflow chunks allocated because the allocation region was full
+    size_t overflowChunks{ 0 };
+    size_t completedIncrementalCollections{ 0 };
+    // incremental collections that had to be finished in one pause as the program allocated faster than they could copy
+    size_t abandonedIncrementalCollections{ 0 };
+
+    // e.g. 0.99 for the p99 pause time of the recent collections; 0 if there hasn't been a pause yet
+    [[nodiscard]] std::chrono::nanoseconds getPausePercentile(double percentile) const;
+};
+
 class GC final {
 public:
     explicit GC(VM&, const VMParameters& params);
@@ -17,12 +67,46 @@ public:
     GC(GC&&) = delete;
     GC& operator=(const GC&) = delete;
     GC& operator=(GC&&) = delete;
+    ~GC();
     uint8_t* alloc(int32_t num);
     void requestCollection();
+    // Every object needs room for the forwarding pointer that is written into it while collecting; the size is rounded
+    // up to an even number (used for pointer tagging for lambdas/functions) or to a multiple of 8 for parallel collections
+    [[nodiscard]] inline int32_t getAllocationSize(int32_t size) const {
+        size = std::max(size, 8);
+        return (size + mAllocationAlignment - 1) & ~(mAllocationAlignment - 1);
+    }
+
+    // The bump pointer of the region new objects are allocated in (the nursery in generational mode, the active region
+    // otherwise). Allocations are served from [top, end) until it's full;
+    // the JIT emits the fast path of alloc() inline against this struct, so its address must stay stable.
+    struct AllocationArea final {
+        uint8_t* top{ nullptr };
+        uint8_t* end{ nullptr };
+    };
+    [[nodiscard]] inline const AllocationArea* getAllocationArea() const {
+        return &mAllocationArea;
+    }
+    [[nodiscard]] inline const GCStatistics& getStatistics() const {
+        return mStatistics;
+    }
+    // first node of the list with the given index in Program::constantLists
+    [[nodiscard]] inline uint8_t* getConstantList(int32_t id) const {
+        return mConstantLists.at(id);
+    }
+    // called after every collection, including the steps of incremental collections
+    inline void setCollectionCallback(std::function<void(const GCStatistics::Collection&)> callback) {
+        mCollectionCallback = std::move(callback);
+    }
 
 private:
     int32_t mFunctionCallsSinceLastRun{ 0 };
     int32_t mConfigFunctionsCallsPerGCRun{ 0 };
+    double mConfigTriggerRatio{ 0 };
+    double mConfigHeapGrowthThreshold{ 0 };
+    double mConfigHeapGrowthFactor{ 0 };
+    // parallel collections need aligned objects to install forwarding pointers atomically
+    int32_t mAllocationAlignment{ 2 };
     VM& mVM;
     struct Region final {
         uint8_t *base{ nullptr };
@@ -47,33 +131,163 @@ private:
     Region& getActiveRegion();
     Region& getOtherRegion();
 
-    struct ArrayDeleter {
-        void operator()(uint8_t* toDelete) {
-            free(toDelete);
-        }
-    };
-    struct TemporaryAllocation {
-        std::unique_ptr<uint8_t, ArrayDeleter> data;
-        size_t len;
-    };
-    // This array contains allocations that had to be performed using new because the active
-    // region was full. As we can't garbage collect and resize a region at any point in time, we
-    // need to instead store it in this temporary array and copy it over to a new, larger page
-    // once we hit the next garbage collection.
-    std::vector<TemporaryAllocation> mTemporaryAllocations;
+    // Contains the constant lists of the program. They only consist of literals, so they can't point to any other
+    // objects and are never copied or freed; other objects can still point to them, e.g. if something is prepended.
+    Region mConstantArea;
+    std::vector<uint8_t*> mConstantLists;
+    void createConstantArea();
+    [[nodiscard]] inline bool isInConstantArea(uint8_t* ptr) const {
+        return ptr >= mConstantArea.base && ptr < mConstantArea.base + mConstantArea.size;
+    }
 
+    // Once the allocation region is full, the bump allocator continues in chunks that are chained behind it.
+    // As we can't garbage collect and resize a region at any point in time, allocations are served from these
+    // chunks until the next collection copies everything that's alive into a region that is large enough.
+    std::vector<Region> mOverflowChunks;
+    static constexpr size_t MIN_OVERFLOW_CHUNK_SIZE = 1024 * 1024;
+    static constexpr size_t MAX_OVERFLOW_CHUNK_SIZE = 64 * 1024 * 1024;
+    uint8_t* allocInNewChunk(int32_t size);
+    // the region the allocation area currently points into
+    Region& getCurrentAllocationRegion();
+    [[nodiscard]] size_t getOverflowChunksSize() const;
+
+    // In generational mode, these two regions hold the tenured objects and new objects are allocated in the nursery.
+    // As objects are immutable and only ever point to objects that are older than themselves, tenured objects
+    // can't point into the nursery, so a minor collection only needs to look at the stack and the nursery.
     std::array<Region, 2> mRegions{Region{}, Region{}};
     size_t mActiveRegion{ 0 };
-    [[nodiscard]] bool isInOtherRegion(uint8_t* ptr);
+    Region mNursery;
+    [[nodiscard]] inline bool isGenerational() const {
+        return mNursery.size > 0;
+    }
+    Region& getAllocationRegion();
+    // offset of the allocation region is only synchronized with the allocation area when collecting
+    AllocationArea mAllocationArea;
+    // a collection is requested once the allocation area reaches this pointer, see VMParameters::gcTriggerRatio
+    uint8_t* mCollectionTrigger{ nullptr };
+    void resetAllocationArea();
+
+    enum class CollectionType {
+        // only the nursery and the overflow chunks are collected, survivors are appended to the active region
+        // (or to the other region while an incremental collection is running)
+        Minor,
+        // everything is copied into the other region
+        Major,
+        // a step of an incremental collection, which copies the objects of the active region to the other one
+        Incremental
+    };
+    CollectionType mCollectionType{ CollectionType::Major };
+    // objects are copied to mToRegion starting at mToRegionStart
+    Region* mToRegion{ nullptr };
+    size_t mToRegionStart{ 0 };
+    [[nodiscard]] bool isInToSpace(uint8_t* ptr);
+    // whether the object doesn't need to be copied, either because it has already been copied or isn't collected
+    [[nodiscard]] bool shouldSkip(uint8_t* ptr);
 
-    enum class ScanningHeapOrStack {
-        Heap,
-        Stack
+    // a value at ptr (on the stack or already copied to the to-space) that still needs to be scanned
+    struct ScanQueueEntry {
+        uint8_t* ptr;
+        const PointerMap* map;
+    };
+    // State of each thread copying objects during a collection. Every worker copies the objects it finds into its own
+    // thread-local allocation buffer (TLAB) in the to-space and scans them itself, unless another worker runs out of work
+    // and takes some of its queue. If there's only one worker, it copies directly to the top of the to-space.
+    struct Worker {
+        std::vector<ScanQueueEntry> scanQueue;
+        size_t scanQueueHead{ 0 };
+        uint8_t* tlabTop{ nullptr };
+        uint8_t* tlabEnd{ nullptr };
     };
-    void searchForPtrs(uint8_t* ptr, const Datatype& type, ScanningHeapOrStack);
-    uint8_t* copyToOther(uint8_t** ptr, size_t len);
-    uint8_t* alloc(int32_t len, size_t heapIndex);
+    // the first worker is the thread running the VM, the others are started in the constructor
+    std::vector<Worker> mWorkers;
+    std::vector<std::thread> mWorkerThreads;
+    [[nodiscard]] inline bool isParallel() const {
+        return mWorkers.size() > 1;
+    }
+    static constexpr size_t TLAB_SIZE = 32 * 1024;
+    // objects larger than this are copied directly to the to-space so they don't waste the rest of a TLAB
+    static constexpr size_t MAX_TLAB_OBJECT_SIZE = TLAB_SIZE / 4;
+    // offset of the to-space shared by all workers in a parallel collection; TLABs are taken from it
+    std::atomic<size_t> mToSpaceOffset{ 0 };
+    // additional space the to-space needs if that many bytes are copied in parallel, as TLABs aren't filled completely
+    [[nodiscard]] size_t getParallelCopyReserve(size_t bytesToCopy) const;
+
+    // workers that ran out of work put up half of their queue here
+    std::mutex mSharedWorkMutex;
+    std::condition_variable mSharedWorkAvailable;
+    std::vector<ScanQueueEntry> mSharedWork;
+    // only modified while holding mSharedWorkMutex, but read without it to decide whether work should be shared
+    std::atomic<size_t> mSharedWorkSize{ 0 };
+    std::atomic<size_t> mIdleWorkers{ 0 };
+    // used to start the worker threads and wait until they are done
+    std::mutex mWorkerThreadsMutex;
+    std::condition_variable mCollectionStarted;
+    std::condition_variable mWorkerFinished;
+    uint64_t mCollectionCounter{ 0 };
+    size_t mFinishedWorkerThreads{ 0 };
+    bool mShutdown{ false };
+    void runWorkerThread(size_t index);
+    // scans values until no worker has any work left
+    void processScanQueue(Worker& worker);
+    void shareWork(Worker& worker);
+    // returns false once all workers are idle and the collection is done
+    bool takeSharedWork(Worker& worker);
+
+    void enqueue(Worker& worker, uint8_t* ptr, int32_t pointerMapIndex);
+    void enqueue(Worker& worker, uint8_t* ptr, const PointerMap& map);
+    void scanValue(Worker& worker, uint8_t* ptr, const PointerMap& map);
+    // Copies the object the slot points to into the to-space, installs the forwarding pointer in the old object and
+    // updates the slot. If the object has already been copied, the slot is just updated and false is returned.
+    // The size of the object is calculated from its first 8 bytes as they are overwritten by the forwarding pointer.
+    template<typename SizeCallback>
+    bool evacuate(Worker& worker, uint8_t** slot, SizeCallback sizeOfObject);
+    // the worker that scans the object the slot points to if it's copied
+    Worker& getWorkerForCopyOf(Worker& worker, uint8_t* object);
+    uint8_t* allocInToSpace(Worker& worker, size_t len);
+    // Incremental mode: the heap is copied into the other region over many pauses while the program continues to run.
+    // As objects are immutable, the program can keep using the old copies in the meantime. This is why the forwarding
+    // pointers are stored in a separate table instead of the objects. The nursery is still collected at once,
+    // with survivors going directly to the other region; pointers into the active region that are found on the stack
+    // or in survivors are replaced by their copies. Once there's nothing left to copy and the nursery has just been
+    // collected, nothing can point into the active region anymore and the regions are swapped.
+    std::chrono::nanoseconds mPauseBudget{ 0 };
+    [[nodiscard]] inline bool isIncremental() const {
+        return mPauseBudget.count() > 0;
+    }
+    bool mIncrementalCollectionRunning{ false };
+    // one entry for every 8 bytes of the active region, which can only contain one object as each has at least 8 bytes
+    Region mForwardingTable;
+    // upper bound for the size of the objects of the active region that haven't been copied yet
+    size_t mIncrementalBytesLeft{ 0 };
+    // its queue contains the copied objects that still need to be scanned
+    Worker mIncrementalWorker;
+    // Pointer maps of list nodes, indexed by the map of their element. Incremental collections scan lists node by
+    // node so the length of the lists doesn't affect the length of the pauses.
+    std::vector<PointerMap> mListNodeMaps;
+    int32_t mFunctionCallsSinceLastIncrement{ 0 };
+    static constexpr int32_t FUNCTION_CALLS_PER_INCREMENT = 1000;
+    static constexpr size_t DEFAULT_INCREMENTAL_NURSERY_SIZE = 256 * 1024;
+    // whether the object is in the active region and has to be copied by the incremental collection
+    [[nodiscard]] bool isInIncrementalFromSpace(uint8_t* ptr);
+    void startIncrementalCollection(size_t youngSize);
+    // copies objects until the pause budget is used up
+    void performIncrementalStep(std::chrono::steady_clock::time_point pauseStart);
+    void finishIncrementalCollection();
+    // copies everything that's alive into a new region at once
+    void abandonIncrementalCollection(size_t youngSize);
+
+    GCStatistics mStatistics;
+    std::function<void(const GCStatistics::Collection&)> mCollectionCallback;
+    // offset of the allocation region after the last collection, used to calculate the allocated bytes
+    size_t mAllocationStartOffset{ 0 };
+    // bytes copied to the to-space during the current pause
+    size_t mBytesCopied{ 0 };
+    [[nodiscard]] size_t getHeapSize() const;
+    void recordCollection(GCStatistics::Collection::Type type, std::chrono::steady_clock::time_point pauseStart, size_t bytesAllocated);
+
     void performGarbageCollection();
+    void collect(CollectionType type, Region& toRegion);
+    void growHeapIfNecessary();
 };
 
 }
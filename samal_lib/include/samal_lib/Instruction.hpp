@@ -5,53 +5,86 @@
 
 namespace samal {
 
-#define ENUMERATE_INSTRUCTIONS                  \
-    INSTRUCTION(INVALID, 5)                     \
-    INSTRUCTION(PUSH_1, 2)                      \
-    INSTRUCTION(PUSH_4, 5)                      \
-    INSTRUCTION(PUSH_8, 9)                      \
-    INSTRUCTION(POP_N_BELOW, 9)                 \
-    INSTRUCTION(ADD_I32, 1)                     \
-    INSTRUCTION(SUB_I32, 1)                     \
-    INSTRUCTION(MUL_I32, 1)                     \
-    INSTRUCTION(DIV_I32, 1)                     \
-    INSTRUCTION(MODULO_I32, 1)                  \
-    INSTRUCTION(COMPARE_LESS_THAN_I32, 1)       \
-    INSTRUCTION(COMPARE_MORE_THAN_I32, 1)       \
-    INSTRUCTION(COMPARE_LESS_EQUAL_THAN_I32, 1) \
-    INSTRUCTION(COMPARE_MORE_EQUAL_THAN_I32, 1) \
-    INSTRUCTION(COMPARE_EQUALS_I32, 1)          \
-    INSTRUCTION(COMPARE_NOT_EQUALS_I32, 1)      \
-    INSTRUCTION(ADD_I64, 1)                     \
-    INSTRUCTION(SUB_I64, 1)                     \
-    INSTRUCTION(MUL_I64, 1)                     \
-    INSTRUCTION(DIV_I64, 1)                     \
-    INSTRUCTION(MODULO_I64, 1)                  \
-    INSTRUCTION(COMPARE_LESS_THAN_I64, 1)       \
-    INSTRUCTION(COMPARE_MORE_THAN_I64, 1)       \
-    INSTRUCTION(COMPARE_LESS_EQUAL_THAN_I64, 1) \
-    INSTRUCTION(COMPARE_MORE_EQUAL_THAN_I64, 1) \
-    INSTRUCTION(COMPARE_EQUALS_I64, 1)          \
-    INSTRUCTION(COMPARE_NOT_EQUALS_I64, 1)      \
-    INSTRUCTION(LOGICAL_OR, 1)                  \
-    INSTRUCTION(LOGICAL_NOT, 1)                 \
-    INSTRUCTION(LOGICAL_AND, 1)                 \
-    INSTRUCTION(JUMP_IF_FALSE, 5)               \
-    INSTRUCTION(JUMP, 5)                        \
-    INSTRUCTION(REPUSH_FROM_N, 9)               \
-    INSTRUCTION(RETURN, 5)                      \
-    INSTRUCTION(CALL, 5)                        \
-    INSTRUCTION(CREATE_LAMBDA, 9)               \
-    INSTRUCTION(CREATE_LIST, 9)                 \
-    INSTRUCTION(LOAD_FROM_PTR, 9)               \
-    INSTRUCTION(LIST_GET_TAIL, 1)               \
-    INSTRUCTION(COMPARE_COMPLEX_EQUALITY, 5)    \
-    INSTRUCTION(LIST_PREPEND, 5)                \
-    INSTRUCTION(IS_LIST_EMPTY, 1)               \
-    INSTRUCTION(CREATE_STRUCT_OR_ENUM, 5)       \
-    INSTRUCTION(RUN_GC, 1)                      \
-    INSTRUCTION(INCREASE_STACK_SIZE, 5)         \
-    INSTRUCTION(NOOP, 1)
+// Width of the fused instructions that combine the push of an i32 constant (PUSH_8 if every stack slot
+// is 8 bytes wide, PUSH_4 otherwise) with an arithmetic instruction.
+#ifdef x86_64_BIT_MODE
+#    define SAMAL_I32_CONSTANT_INSTRUCTION_WIDTH 10
+#else
+#    define SAMAL_I32_CONSTANT_INSTRUCTION_WIDTH 6
+#endif
+
+// The instructions after NOOP are superinstructions which are only created by Compiler::fuseInstructions().
+// Each of them takes up exactly as many bytes as the instructions it replaces.
+#define ENUMERATE_INSTRUCTIONS                                          \
+    INSTRUCTION(INVALID, 5)                                             \
+    INSTRUCTION(PUSH_1, 2)                                              \
+    INSTRUCTION(PUSH_4, 5)                                              \
+    INSTRUCTION(PUSH_8, 9)                                              \
+    INSTRUCTION(POP_N_BELOW, 9)                                         \
+    INSTRUCTION(ADD_I32, 1)                                             \
+    INSTRUCTION(SUB_I32, 1)                                             \
+    INSTRUCTION(MUL_I32, 1)                                             \
+    INSTRUCTION(DIV_I32, 1)                                             \
+    INSTRUCTION(MODULO_I32, 1)                                          \
+    INSTRUCTION(COMPARE_LESS_THAN_I32, 1)                               \
+    INSTRUCTION(COMPARE_MORE_THAN_I32, 1)                               \
+    INSTRUCTION(COMPARE_LESS_EQUAL_THAN_I32, 1)                         \
+    INSTRUCTION(COMPARE_MORE_EQUAL_THAN_I32, 1)                         \
+    INSTRUCTION(COMPARE_EQUALS_I32, 1)                                  \
+    INSTRUCTION(COMPARE_NOT_EQUALS_I32, 1)                              \
+    INSTRUCTION(ADD_I64, 1)                                             \
+    INSTRUCTION(SUB_I64, 1)                                             \
+    INSTRUCTION(MUL_I64, 1)                                             \
+    INSTRUCTION(DIV_I64, 1)                                             \
+    INSTRUCTION(MODULO_I64, 1)                                          \
+    INSTRUCTION(COMPARE_LESS_THAN_I64, 1)                               \
+    INSTRUCTION(COMPARE_MORE_THAN_I64, 1)                               \
+    INSTRUCTION(COMPARE_LESS_EQUAL_THAN_I64, 1)                         \
+    INSTRUCTION(COMPARE_MORE_EQUAL_THAN_I64, 1)                         \
+    INSTRUCTION(COMPARE_EQUALS_I64, 1)                                  \
+    INSTRUCTION(COMPARE_NOT_EQUALS_I64, 1)                              \
+    INSTRUCTION(LOGICAL_OR, 1)                                          \
+    INSTRUCTION(LOGICAL_NOT, 1)                                         \
+    INSTRUCTION(LOGICAL_AND, 1)                                         \
+    INSTRUCTION(JUMP_IF_FALSE, 5)                                       \
+    INSTRUCTION(JUMP, 5)                                                \
+    INSTRUCTION(REPUSH_FROM_N, 9)                                       \
+    INSTRUCTION(RETURN, 5)                                              \
+    INSTRUCTION(CALL, 5)                                                \
+    INSTRUCTION(CREATE_LAMBDA, 9)                                       \
+    INSTRUCTION(CREATE_LIST, 9)                                         \
+    INSTRUCTION(LOAD_FROM_PTR, 9)                                       \
+    INSTRUCTION(LIST_GET_TAIL, 1)                                       \
+    INSTRUCTION(COMPARE_COMPLEX_EQUALITY, 5)                            \
+    INSTRUCTION(LIST_PREPEND, 5)                                        \
+    INSTRUCTION(IS_LIST_EMPTY, 1)                                       \
+    INSTRUCTION(CREATE_STRUCT_OR_ENUM, 5)                               \
+    INSTRUCTION(RUN_GC, 1)                                              \
+    INSTRUCTION(INCREASE_STACK_SIZE, 5)                                 \
+    INSTRUCTION(LOAD_CONSTANT_LIST, 5)                                  \
+    INSTRUCTION(NOOP, 1)                                                \
+    INSTRUCTION(ADD_I32_CONSTANT, SAMAL_I32_CONSTANT_INSTRUCTION_WIDTH) \
+    INSTRUCTION(SUB_I32_CONSTANT, SAMAL_I32_CONSTANT_INSTRUCTION_WIDTH) \
+    INSTRUCTION(MUL_I32_CONSTANT, SAMAL_I32_CONSTANT_INSTRUCTION_WIDTH) \
+    INSTRUCTION(DIV_I32_CONSTANT, SAMAL_I32_CONSTANT_INSTRUCTION_WIDTH) \
+    INSTRUCTION(ADD_I64_CONSTANT, 10)                                   \
+    INSTRUCTION(SUB_I64_CONSTANT, 10)                                   \
+    INSTRUCTION(MUL_I64_CONSTANT, 10)                                   \
+    INSTRUCTION(DIV_I64_CONSTANT, 10)                                   \
+    INSTRUCTION(COMPARE_LESS_THAN_I32_AND_JUMP_IF_FALSE, 6)             \
+    INSTRUCTION(COMPARE_MORE_THAN_I32_AND_JUMP_IF_FALSE, 6)             \
+    INSTRUCTION(COMPARE_LESS_EQUAL_THAN_I32_AND_JUMP_IF_FALSE, 6)       \
+    INSTRUCTION(COMPARE_MORE_EQUAL_THAN_I32_AND_JUMP_IF_FALSE, 6)       \
+    INSTRUCTION(COMPARE_EQUALS_I32_AND_JUMP_IF_FALSE, 6)                \
+    INSTRUCTION(COMPARE_NOT_EQUALS_I32_AND_JUMP_IF_FALSE, 6)            \
+    INSTRUCTION(COMPARE_LESS_THAN_I64_AND_JUMP_IF_FALSE, 6)             \
+    INSTRUCTION(COMPARE_MORE_THAN_I64_AND_JUMP_IF_FALSE, 6)             \
+    INSTRUCTION(COMPARE_LESS_EQUAL_THAN_I64_AND_JUMP_IF_FALSE, 6)       \
+    INSTRUCTION(COMPARE_MORE_EQUAL_THAN_I64_AND_JUMP_IF_FALSE, 6)       \
+    INSTRUCTION(COMPARE_EQUALS_I64_AND_JUMP_IF_FALSE, 6)                \
+    INSTRUCTION(COMPARE_NOT_EQUALS_I64_AND_JUMP_IF_FALSE, 6)            \
+    INSTRUCTION(IS_LIST_EMPTY_AND_JUMP_IF_FALSE, 6)                     \
+    INSTRUCTION(REPUSH_AND_LOAD_FROM_PTR, 18)
 
 enum class Instruction : uint8_t {
 #define INSTRUCTION(name, width) name,
@@ -81,4 +114,28 @@ static constexpr inline size_t instructionToWidth(Instruction ins) {
     return instructionWidths[instructionIndex];
 }
 
-}
\ No newline at end of file
+// Returns true for all instructions that (might) jump to the ip stored in their first parameter
+static inline constexpr bool isJumpInstruction(Instruction ins) {
+    switch(ins) {
+    case Instruction::JUMP:
+    case Instruction::JUMP_IF_FALSE:
+    case Instruction::COMPARE_LESS_THAN_I32_AND_JUMP_IF_FALSE:
+    case Instruction::COMPARE_MORE_THAN_I32_AND_JUMP_IF_FALSE:
+    case Instruction::COMPARE_LESS_EQUAL_THAN_I32_AND_JUMP_IF_FALSE:
+    case Instruction::COMPARE_MORE_EQUAL_THAN_I32_AND_JUMP_IF_FALSE:
+    case Instruction::COMPARE_EQUALS_I32_AND_JUMP_IF_FALSE:
+    case Instruction::COMPARE_NOT_EQUALS_I32_AND_JUMP_IF_FALSE:
+    case Instruction::COMPARE_LESS_THAN_I64_AND_JUMP_IF_FALSE:
+    case Instruction::COMPARE_MORE_THAN_I64_AND_JUMP_IF_FALSE:
+    case Instruction::COMPARE_LESS_EQUAL_THAN_I64_AND_JUMP_IF_FALSE:
+    case Instruction::COMPARE_MORE_EQUAL_THAN_I64_AND_JUMP_IF_FALSE:
+    case Instruction::COMPARE_EQUALS_I64_AND_JUMP_IF_FALSE:
+    case Instruction::COMPARE_NOT_EQUALS_I64_AND_JUMP_IF_FALSE:
+    case Instruction::IS_LIST_EMPTY_AND_JUMP_IF_FALSE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+}
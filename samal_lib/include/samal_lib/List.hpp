@@ -0,0 +1,147 @@
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+namespace samal {
+
+// A list is a pointer to its first node or nullptr if it's empty. A regular node consists of the pointer to the next
+// node followed by the element. Lists of scalars that are created at once (strings and byte arrays passed in by native
+// functions and lists of literals) are packed into chunks instead, which consist of the pointer to the next node
+// followed by up to MAX_PACKED_LIST_CHUNK_ELEMENTS elements without any padding between them.
+// A list starting inside of a chunk is the address of its first element with the following tag in the upper 16 bits,
+// which are unused by user space addresses on x86-64:
+//   bits 48-54: index of the element in the chunk
+//   bits 55-61: number of elements left in the chunk, including this one
+//   bits 62-63: size of the elements (1 => 1 byte, 2 => 4 bytes, 3 => 8 bytes)
+// Tails of chunks can be shared like regular nodes. As the tag is never zero, a pointer with the upper bits set
+// is always a packed list. Everything that walks lists has to use the functions below.
+
+static constexpr int32_t MAX_PACKED_LIST_CHUNK_ELEMENTS = 127;
+
+namespace packed_list_detail {
+static constexpr uint64_t INDEX_SHIFT = 48;
+static constexpr uint64_t REMAINING_SHIFT = 55;
+static constexpr uint64_t SIZE_CODE_SHIFT = 62;
+static constexpr uint64_t FIELD_MASK = 127;
+static constexpr uint64_t ADDRESS_MASK = (uint64_t{ 1 } << INDEX_SHIFT) - 1;
+
+static inline int32_t getElementSize(uint64_t list) {
+    constexpr int32_t sizes[] = { 0, 1, 4, 8 };
+    return sizes[list >> SIZE_CODE_SHIFT];
+}
+static inline uint64_t getIndex(uint64_t list) {
+    return (list >> INDEX_SHIFT) & FIELD_MASK;
+}
+static inline uint64_t getRemaining(uint64_t list) {
+    return (list >> REMAINING_SHIFT) & FIELD_MASK;
+}
+static inline uint64_t getSizeCode(int32_t elementSize) {
+    switch(elementSize) {
+    case 1:
+        return 1;
+    case 4:
+        return 2;
+    case 8:
+        return 3;
+    default:
+        assert(false);
+        return 0;
+    }
+}
+}
+
+static inline bool isPackedList(const uint8_t* list) {
+    return ((uint64_t)list >> packed_list_detail::INDEX_SHIFT) != 0;
+}
+// the address of the element of the first node
+static inline const uint8_t* getListHead(const uint8_t* list) {
+    if(isPackedList(list)) {
+        return (const uint8_t*)((uint64_t)list & packed_list_detail::ADDRESS_MASK);
+    }
+    return list + 8;
+}
+// Returns a pointer that has the first element at offset 8 like a regular node, so the head can still be
+// loaded with a fixed offset. Pointers that aren't lists are returned unchanged.
+static inline uint8_t* getListNode(const uint8_t* list) {
+    return const_cast<uint8_t*>(getListHead(list) - 8);
+}
+static inline uint8_t* getListTail(const uint8_t* list) {
+    using namespace packed_list_detail;
+    const auto value = (uint64_t)list;
+    if(!isPackedList(list)) {
+        uint8_t* next;
+        memcpy(&next, list, 8);
+        return next;
+    }
+    if(getRemaining(value) > 1) {
+        // move to the next element of the chunk
+        return (uint8_t*)(value + getElementSize(value) + (uint64_t{ 1 } << INDEX_SHIFT) - (uint64_t{ 1 } << REMAINING_SHIFT));
+    }
+    uint8_t* next;
+    memcpy(&next, (const uint8_t*)((value & ADDRESS_MASK) - getIndex(value) * getElementSize(value) - 8), 8);
+    return next;
+}
+
+// number of elements from the head of the packed list to the end of its chunk
+static inline int32_t getPackedListRemaining(const uint8_t* list) {
+    assert(isPackedList(list));
+    return static_cast<int32_t>(packed_list_detail::getRemaining((uint64_t)list));
+}
+static inline int32_t getPackedListElementSize(const uint8_t* list) {
+    assert(isPackedList(list));
+    return packed_list_detail::getElementSize((uint64_t)list);
+}
+// Skips count elements of the packed list, which must not be more than getPackedListRemaining(). Skipping all of
+// them returns the list the chunk points to.
+static inline uint8_t* dropPackedListElements(const uint8_t* list, int32_t count) {
+    using namespace packed_list_detail;
+    assert(count > 0 && count <= getPackedListRemaining(list));
+    const auto value = (uint64_t)list;
+    if(static_cast<uint64_t>(count) < getRemaining(value)) {
+        return (uint8_t*)(value + count * getElementSize(value) + ((uint64_t)count << INDEX_SHIFT) - ((uint64_t)count << REMAINING_SHIFT));
+    }
+    uint8_t* next;
+    memcpy(&next, (const uint8_t*)((value & ADDRESS_MASK) - getIndex(value) * getElementSize(value) - 8), 8);
+    return next;
+}
+
+// start of the chunk the packed list points into, which is the object the GC copies
+static inline uint8_t* getPackedListChunk(const uint8_t* list) {
+    using namespace packed_list_detail;
+    assert(isPackedList(list));
+    const auto value = (uint64_t)list;
+    return (uint8_t*)((value & ADDRESS_MASK) - getIndex(value) * getElementSize(value) - 8);
+}
+static inline size_t getPackedListChunkSize(const uint8_t* list) {
+    using namespace packed_list_detail;
+    const auto value = (uint64_t)list;
+    return 8 + (getIndex(value) + getRemaining(value)) * getElementSize(value);
+}
+// the same position in a copy of the chunk
+static inline uint8_t* movePackedList(const uint8_t* list, const uint8_t* newChunk) {
+    using namespace packed_list_detail;
+    const auto offset = ((uint64_t)list & ADDRESS_MASK) - (uint64_t)getPackedListChunk(list);
+    return (uint8_t*)(((uint64_t)newChunk + offset) | ((uint64_t)list & ~ADDRESS_MASK));
+}
+
+// Creates a packed list of elementCount elements, which are laid out one after another in elements.
+// The chunks are allocated from the back using alloc(size), so each one only points to older ones.
+template<typename Alloc>
+static inline uint8_t* createPackedList(const uint8_t* elements, size_t elementCount, int32_t elementSize, Alloc&& alloc) {
+    using namespace packed_list_detail;
+    uint8_t* list = nullptr;
+    size_t end = elementCount;
+    while(end > 0) {
+        const size_t begin = end > MAX_PACKED_LIST_CHUNK_ELEMENTS ? end - MAX_PACKED_LIST_CHUNK_ELEMENTS : 0;
+        const auto count = end - begin;
+        uint8_t* chunk = alloc(8 + count * elementSize);
+        memcpy(chunk, &list, 8);
+        memcpy(chunk + 8, elements + begin * elementSize, count * elementSize);
+        list = (uint8_t*)((uint64_t)(chunk + 8) | (count << REMAINING_SHIFT) | (getSizeCode(elementSize) << SIZE_CODE_SHIFT));
+        end = begin;
+    }
+    return list;
+}
+
+}
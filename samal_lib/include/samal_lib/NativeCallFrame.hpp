@@ -0,0 +1,105 @@
+#pragma once
+#include "Datatype.hpp"
+#include "Forward.hpp"
+#include "List.hpp"
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+namespace samal {
+
+// Iterates over a list on the heap without copying it; dereferencing yields a pointer to the current element.
+class NativeListView final {
+public:
+    class Iterator final {
+    public:
+        explicit Iterator(const uint8_t* node)
+        : mNode(node) { }
+        inline const uint8_t* operator*() const {
+            return getListHead(mNode);
+        }
+        inline Iterator& operator++() {
+            mNode = getListTail(mNode);
+            return *this;
+        }
+        inline bool operator!=(const Iterator& other) const {
+            return mNode != other.mNode;
+        }
+
+    private:
+        const uint8_t* mNode;
+    };
+    explicit NativeListView(const uint8_t* firstNode)
+    : mFirstNode(firstNode) { }
+    [[nodiscard]] inline Iterator begin() const {
+        return Iterator{ mFirstNode };
+    }
+    [[nodiscard]] inline Iterator end() const {
+        return Iterator{ nullptr };
+    }
+    [[nodiscard]] inline bool isEmpty() const {
+        return mFirstNode == nullptr;
+    }
+    [[nodiscard]] inline const uint8_t* getFirstNode() const {
+        return mFirstNode;
+    }
+
+private:
+    const uint8_t* mFirstNode;
+};
+
+// View on the parameters of a native function call. The parameters stay on the stack of the VM while the
+// callback runs and are read in place; the callback writes its return value into a buffer owned by the VM
+// that is pushed afterwards, so no ExternalVMValue has to be created. Scalars only use the lower bytes of their slot.
+class NativeCallFrame final {
+public:
+    NativeCallFrame(VM& vm, const NativeFunction& function, const int32_t* paramOffsets, const uint8_t* params, uint8_t* returnValue);
+
+    [[nodiscard]] inline VM& getVM() const {
+        return mVM;
+    }
+    [[nodiscard]] size_t getArgCount() const;
+    [[nodiscard]] const Datatype& getArgType(size_t index) const;
+    [[nodiscard]] inline const uint8_t* getArgPtr(size_t index) const {
+        return mParams + mParamOffsets[index];
+    }
+    template<typename T>
+    [[nodiscard]] inline T arg(size_t index) const {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T ret;
+        memcpy(&ret, getArgPtr(index), sizeof(T));
+        return ret;
+    }
+    [[nodiscard]] inline NativeListView argList(size_t index) const {
+        return NativeListView{ arg<const uint8_t*>(index) };
+    }
+    // Slow path for parameters that don't have a typed accessor like structs or enums
+    [[nodiscard]] ExternalVMValue argValue(size_t index) const;
+
+    [[nodiscard]] const Datatype& getReturnType() const;
+    // The return slot is zeroed before the callback runs, so functions returning () don't need to set anything
+    [[nodiscard]] inline uint8_t* getReturnPtr() const {
+        return mReturnValue;
+    }
+    template<typename T>
+    inline void setReturn(const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        memcpy(mReturnValue, &value, sizeof(T));
+    }
+    void setReturn(const ExternalVMValue& value);
+
+    // Wraps a callback taking ExternalVMValues, which copies all parameters and the return value
+    static std::function<void(NativeCallFrame&)> adapt(std::function<ExternalVMValue(VM&, const std::vector<ExternalVMValue>&)> callback);
+
+private:
+    VM& mVM;
+    const NativeFunction& mFunction;
+    const int32_t* mParamOffsets;
+    const uint8_t* mParams;
+    uint8_t* mReturnValue;
+};
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "Datatype.hpp"
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace samal {
+
+// Flattened description of where a value of one datatype contains pointers, so the GC can trace objects by
+// iterating over offsets instead of walking the Datatype. Nested tuples and structs are inlined into their parent.
+struct PointerMap {
+    struct Entry {
+        enum class Type : uint8_t {
+            // target is the map of the contained type
+            List,
+            // target is the map of the base type
+            Pointer,
+            // might be a lambda, its captured values are traced using the map of its auxiliary datatype
+            Function,
+            // target is an enum map, see enumFieldMaps
+            Enum,
+            // buffer of a bytes value, which doesn't contain pointers; its size is stored in its header
+            Bytes
+        };
+        Type type;
+        int32_t offset{ 0 };
+        int32_t target{ -1 };
+    };
+    // size of the value, which is the amount of bytes copied for pointers or the size of a list element
+    int32_t size{ 0 };
+    std::vector<Entry> entries;
+    // Only set for enum maps; contains the map of the parameters of each field with offsets relative to the start of the enum.
+    // Which one is used is decided by the index stored in the enum.
+    std::vector<int32_t> enumFieldMaps;
+
+    [[nodiscard]] inline bool containsPointers() const {
+        return !entries.empty() || !enumFieldMaps.empty();
+    }
+};
+
+// Creates the pointer maps while compiling and deduplicates them by their datatype.
+class PointerMapBuilder final {
+public:
+    explicit PointerMapBuilder(std::vector<PointerMap>& maps);
+    // returns the index of the map in the vector passed to the constructor
+    int32_t getIndex(const Datatype& type);
+
+private:
+    void flatten(const Datatype& type, int32_t offset, std::vector<PointerMap::Entry>& entries);
+    int32_t getEnumIndex(const Datatype& type);
+    static int32_t findInCache(const std::vector<std::pair<Datatype, int32_t>>& cache, const Datatype& type);
+
+    std::vector<PointerMap>& mMaps;
+    std::vector<std::pair<Datatype, int32_t>> mCache;
+    std::vector<std::pair<Datatype, int32_t>> mEnumCache;
+};
+
+}
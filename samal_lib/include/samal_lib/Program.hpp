@@ -1,6 +1,7 @@
 #pragma once
 #include "Datatype.hpp"
 #include "Forward.hpp"
+#include "PointerMap.hpp"
 #include <cctype>
 #include <map>
 #include <string>
@@ -9,10 +10,49 @@
 
 namespace samal {
 
+// Fast path for native functions that only take and return scalars (i32, i64, f64, char, bool and byte, the return type
+// may also be ()). The parameters are passed in order; values smaller than 8 bytes only have their lower bytes set,
+// f64 values are passed as their bit pattern and the remaining parameters are undefined.
+// The JIT calls it directly without leaving the native code, so stack traces can only be generated inside it when the
+// interpreter is used.
+using RawNativeCallback = int64_t (*)(VM&, int64_t, int64_t, int64_t, int64_t, int64_t);
+
 struct NativeFunction {
     std::string fullName;
     Datatype functionType;
     mutable std::function<ExternalVMValue(VM&, const std::vector<ExternalVMValue>&)> callback;
+    // if set, it's used instead of callback
+    RawNativeCallback rawCallback{ nullptr };
+    // if set, it's used instead of callback; reads the parameters directly from the stack, see NativeCallFrame
+    mutable std::function<void(NativeCallFrame&)> frameCallback{};
+
+    static constexpr size_t MAX_RAW_CALLBACK_PARAMS = 5;
+};
+
+// Describes the variables that are alive at an ip where the GC can run. These are the RUN_GC at the start of each
+// function and the return addresses behind each CALL for the frames of the callers.
+struct StackMap {
+    struct Root {
+        // offset of the variable from the top of the frame
+        int32_t offset;
+        int32_t pointerMapIndex;
+    };
+    int32_t ip;
+    // size of the frame at the ip, the return address of the caller is stored above it
+    int32_t frameSize;
+    // size of the return value of the function that contains the ip
+    int32_t returnValueSize;
+    // range in Program::stackMapRoots; only contains variables that hold pointers
+    int32_t firstRoot;
+    int32_t rootCount;
+};
+
+// A list that only contains literals. These are created once when the VM is constructed and are never collected,
+// so evaluating a string literal doesn't allocate; see Instruction::LOAD_CONSTANT_LIST.
+struct ConstantList {
+    int32_t elementSize;
+    // the stack values of the elements in list order
+    std::vector<uint8_t> elements;
 };
 
 struct Program final {
@@ -29,8 +69,23 @@ struct Program final {
     std::vector<uint8_t> code;
     std::vector<Function> functions;
     std::vector<Datatype> auxiliaryDatatypes;
+    // index into pointerMaps for each auxiliary datatype
+    std::vector<int32_t> auxiliaryDatatypePointerMaps;
+    // used by the GC to find pointers in values, see PointerMap
+    std::vector<PointerMap> pointerMaps;
+    // sorted by ip, used by the GC to find the roots on the stack without walking the StackInformationTrees
+    std::vector<StackMap> stackMaps;
+    std::vector<StackMap::Root> stackMapRoots;
+    // deduplicated, indexed by the parameter of LOAD_CONSTANT_LIST
+    std::vector<ConstantList> constantLists;
     std::vector<NativeFunction> nativeFunctions;
+    // maps the ip of a CALL to the offset of the called function if the callee is known at compile time
+    std::unordered_map<int32_t, int32_t> staticCallTargets;
+    // same for calls of native functions, maps to the index in nativeFunctions
+    std::unordered_map<int32_t, int32_t> staticNativeCallTargets;
     [[nodiscard]] std::string disassemble() const;
+    // returns nullptr if the GC can't run at the ip
+    [[nodiscard]] const StackMap* findStackMap(int32_t ip) const;
 };
 
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 #include "Datatype.hpp"
 #include "Util.hpp"
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -22,7 +23,7 @@ public:
         No
     };
     StackInformationTree(int32_t startIp, int32_t totalStackSize, IsAtPopInstruction);
-    StackInformationTree(int32_t startIp, int32_t totalStackSize, std::string name, Datatype type, StorageType);
+    StackInformationTree(int32_t startIp, int32_t totalStackSize, std::string name, Datatype type, int32_t pointerMapIndex, StorageType);
     StackInformationTree* addChild(up<StackInformationTree> child);
     inline StackInformationTree* getParent() {
         return mParent;
@@ -46,6 +47,8 @@ private:
     struct VariableEntry {
         std::string name;
         Datatype datatype;
+        // index into Program::pointerMaps
+        int32_t pointerMapIndex;
         StorageType storageType;
     };
     StackInformationTree *mParent{ nullptr }, *mPrevSibling{ nullptr };
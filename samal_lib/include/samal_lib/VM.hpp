@@ -1,7 +1,9 @@
 #pragma once
 
+#include "EqualityComparator.hpp"
 #include "Forward.hpp"
 #include "GC.hpp"
+#include "Instruction.hpp"
 #include "Program.hpp"
 #include "Util.hpp"
 #ifdef SAMAL_ENABLE_JIT
@@ -39,9 +41,59 @@ private:
     size_t mDataReserved{ 0 };
 };
 
+enum class InterpreterMode {
+    // Calls VM::interpretInstruction() once per instruction and dispatches using a switch
+    Switch,
+    // Runs instructions in a loop using direct-threaded dispatch (computed gotos)
+    Threaded
+};
+
 struct VMParameters {
+    // The GC also runs after this many function calls, even if not enough memory has been allocated to trigger it
     int32_t functionsCallsPerGCRun = 2'000'000;
     int32_t initialHeapSize = 1024 * 1024;
+    // If > 0, new objects are allocated in a nursery of this size which is collected on its own and survivors are
+    // moved to the heap. The heap itself is only collected once it can't take the survivors of the nursery anymore.
+    int32_t nurserySize = 0;
+    // The GC runs at the next function call once this fraction of the memory that was free after the last collection
+    // has been allocated (in the nursery in generational mode) or once an allocation didn't fit anymore
+    double gcTriggerRatio = 0.8;
+    // If more than this fraction of the heap survives a collection of the whole heap, the heap is grown by heapGrowthFactor
+    double heapGrowthThreshold = 0.5;
+    double heapGrowthFactor = 2.0;
+    // If > 1, live objects are copied by this many threads in parallel during each collection
+    int32_t gcThreads = 1;
+    // If > 0, the heap is collected incrementally and every pause only copies objects until this budget is used up.
+    // This requires a nursery, which is 256 KiB if nurserySize isn't set; gcThreads is ignored.
+    // The budget only limits the incremental copying: the nursery is still collected completely in each pause, and
+    // an incremental collection that has to be abandoned copies the whole heap in one pause.
+    std::chrono::microseconds gcPauseBudget{ 0 };
+    // Only used if the JIT is disabled
+    InterpreterMode interpreterMode = InterpreterMode::Threaded;
+    // Only used if the JIT is enabled; keeps the topmost values of the stack in registers within basic blocks
+    bool jitRegisterAllocation = false;
+    // Only used if the JIT is enabled; if > 0, functions are interpreted until they have been called or jumped back in
+    // this often and are then compiled individually. If 0, the whole program is compiled when creating the VM.
+    int32_t jitTierUpThreshold = 0;
+};
+
+// Only filled if the JIT is enabled
+struct JitStatistics {
+    struct TierUpEvent {
+        std::string functionName;
+        // number of calls and backward jumps that were counted before the function got compiled
+        int32_t hotness{ 0 };
+        std::chrono::nanoseconds compileTime{ 0 };
+    };
+    std::vector<TierUpEvent> tierUpEvents;
+    // Every time the VM enters the native code, it's counted for the function the ip belongs to.
+    // Exits are counted for the function containing the instruction the native code couldn't execute.
+    struct Transitions {
+        int64_t entries{ 0 };
+        int64_t exits{ 0 };
+    };
+    // indexed like Program::functions
+    std::vector<Transitions> transitionsPerFunction;
 };
 
 class VM final {
@@ -54,22 +106,86 @@ public:
     [[nodiscard]] const Program& getProgram() const;
 
     void generateStacktrace(const std::function<void(const uint8_t* ptr, const Datatype&, const std::string& name)>& variableCallback, const std::function<void(const std::string&)>& functionCallback) const;
+    // calls the callback with the location of every variable on the stack that contains pointers and the index of its map
+    // in Program::pointerMaps; uses the stack maps of the program, see StackMap
+    void forEachStackRoot(const std::function<void(uint8_t* ptr, int32_t pointerMapIndex)>& callback) const;
     std::string dumpVariablesOnStack();
     int32_t getIp() const;
     inline uint8_t* alloc(int32_t len) {
         return mGC.alloc(len);
     }
+    [[nodiscard]] inline const JitStatistics& getJitStatistics() const {
+        return mJitStatistics;
+    }
+    [[nodiscard]] inline const GCStatistics& getGCStatistics() const {
+        return mGC.getStatistics();
+    }
+    // e.g. for exporting metrics, see GC::setCollectionCallback()
+    inline void setGCCallback(std::function<void(const GCStatistics::Collection&)> callback) {
+        mGC.setCollectionCallback(std::move(callback));
+    }
 
 private:
+    // Fixed-size representation of an instruction used by the threaded interpreter, created once in
+    // decodeProgram() so operands don't have to be read unaligned from Program::code on every execution.
+    struct DecodedInstruction {
+        // value pushed by PUSH_1, PUSH_4, PUSH_8 and LOAD_CONSTANT_LIST or the constant operand of the *_CONSTANT instructions
+        int64_t immediate{ 0 };
+        // jump targets are stored as indices into mDecodedCode instead of byte offsets
+        int32_t param1{ 0 };
+        int32_t param2{ 0 };
+        int32_t param3{ 0 };
+        // offset of the instruction in Program::code, which is still used for return addresses and stack traces
+        int32_t ip{ 0 };
+        Instruction ins{ Instruction::INVALID };
+    };
+    void decodeProgram();
+    void walkStack(const std::function<void(const uint8_t* ptr, const StackInformationTree& node)>& variableCallback, const std::function<void(const std::string&)>& functionCallback) const;
+    void createEqualityComparators();
+
     inline bool interpretInstruction();
+    void interpretInstructionsThreaded();
     void execNativeFunction(int32_t id);
+    void execCreateLambda(int32_t capturedDataSize, int32_t lambdaCapturedTypesId);
+    void execCreateList(int32_t elementSize, int32_t elementCount);
+    void execCompareComplexEquality(int32_t datatypeIndex);
     void jitRequestGCCollection(int64_t newStackSize, int64_t newIp);
+    class JitCode* getCompiledCode();
+    void countJitHotness();
+    bool canEnterCompiledCode();
+    void countJitTransition(int64_t JitStatistics::Transitions::*counter);
+    [[nodiscard]] int32_t findFunctionIndex(int32_t ip) const;
 
     Stack mStack;
     Program mProgram;
     int32_t mIp = 0;
     up<class JitCode> mCompiledCode;
+    // used instead of mCompiledCode if tiered compilation is enabled, indexed like Program::functions
+    std::vector<up<class JitCode>> mCompiledFunctions;
+    std::vector<int32_t> mFunctionHotness;
+    // (offset, index) of all functions in Program::functions, sorted by offset
+    std::vector<std::pair<int32_t, int32_t>> mFunctionOffsets;
+    int32_t mJitTierUpThreshold{ 0 };
+    bool mJitRegisterAllocation{ false };
+    JitStatistics mJitStatistics;
     GC mGC;
+    InterpreterMode mInterpreterMode;
+    std::vector<DecodedInstruction> mDecodedCode;
+    // maps an offset in Program::code to the index of the instruction in mDecodedCode, -1 if no instruction starts there
+    std::vector<int32_t> mIpToDecodedIndex;
+    // indexed by the auxiliary datatype id of COMPARE_COMPLEX_EQUALITY, nullptr for types that aren't compared
+    std::vector<up<EqualityComparator>> mEqualityComparators;
+    struct NativeFunctionLayout {
+        // offset of each parameter from the top of the stack when the native function is called
+        std::vector<int32_t> paramOffsets;
+        std::vector<int32_t> paramSizes;
+        int32_t sumOfParamSizes{ 0 };
+        int32_t returnTypeSize{ 0 };
+    };
+    // indexed like Program::nativeFunctions, computed once in the constructor
+    std::vector<NativeFunctionLayout> mNativeFunctionLayouts;
+    // the return value of a native function call is written here, large enough for every native function
+    std::vector<uint8_t> mNativeReturnValue;
 };
 
 }
@@ -1,6 +1,7 @@
 #include "samal_lib/AST.hpp"
 #include "samal_lib/Compiler.hpp"
 #include <cassert>
+#include <cstring>
 
 namespace samal {
 
@@ -172,6 +173,13 @@ void BinaryExpressionNode::findUsedVariables(VariableSearcher& searcher) const {
 LiteralNode::LiteralNode(SourceCodeRef source)
 : ExpressionNode(source) {
 }
+template<typename T>
+static std::vector<uint8_t> literalToStackValue(DatatypeCategory category, T value) {
+    // the rest of the slot is zeroed like it is by the PUSH instructions
+    std::vector<uint8_t> ret(Datatype::createSimple(category).getSizeOnStack(), 0);
+    memcpy(ret.data(), &value, sizeof(T));
+    return ret;
+}
 
 LiteralInt32Node::LiteralInt32Node(SourceCodeRef source, int32_t val)
 : LiteralNode(std::move(source)), mValue(val) {
@@ -179,6 +187,12 @@ LiteralInt32Node::LiteralInt32Node(SourceCodeRef source, int32_t val)
 std::string LiteralInt32Node::dump(unsigned int indent) const {
     return createIndent(indent) + getClassName() + ": " + std::to_string(mValue) + "\n";
 }
+Datatype LiteralInt32Node::getDatatype() const {
+    return Datatype::createSimple(DatatypeCategory::i32);
+}
+std::vector<uint8_t> LiteralInt32Node::toStackValue() const {
+    return literalToStackValue(DatatypeCategory::i32, mValue);
+}
 Datatype LiteralInt32Node::compile(Compiler& comp) const {
     return comp.compileLiteralI32(mValue);
 }
@@ -188,6 +202,12 @@ void LiteralInt32Node::findUsedVariables(VariableSearcher&) const {
 LiteralInt64Node::LiteralInt64Node(SourceCodeRef source, int64_t val)
 : LiteralNode(std::move(source)), mValue(val) {
 }
+Datatype LiteralInt64Node::getDatatype() const {
+    return Datatype::createSimple(DatatypeCategory::i64);
+}
+std::vector<uint8_t> LiteralInt64Node::toStackValue() const {
+    return literalToStackValue(DatatypeCategory::i64, mValue);
+}
 Datatype LiteralInt64Node::compile(Compiler& comp) const {
     return comp.compileLiteralI64(mValue);
 }
@@ -200,6 +220,12 @@ void LiteralInt64Node::findUsedVariables(VariableSearcher&) const {
 LiteralBoolNode::LiteralBoolNode(SourceCodeRef source, bool val)
 : LiteralNode(std::move(source)), mValue(val) {
 }
+Datatype LiteralBoolNode::getDatatype() const {
+    return Datatype::createSimple(DatatypeCategory::bool_);
+}
+std::vector<uint8_t> LiteralBoolNode::toStackValue() const {
+    return literalToStackValue(DatatypeCategory::bool_, mValue);
+}
 Datatype LiteralBoolNode::compile(Compiler& comp) const {
     return comp.compileLiteralBool(mValue);
 }
@@ -212,6 +238,12 @@ void LiteralBoolNode::findUsedVariables(VariableSearcher&) const {
 LiteralCharNode::LiteralCharNode(SourceCodeRef source, int32_t val)
 : LiteralNode(source), mValue(val) {
 }
+Datatype LiteralCharNode::getDatatype() const {
+    return Datatype::createSimple(DatatypeCategory::char_);
+}
+std::vector<uint8_t> LiteralCharNode::toStackValue() const {
+    return literalToStackValue(DatatypeCategory::char_, mValue);
+}
 Datatype LiteralCharNode::compile(Compiler& comp) const {
     return comp.compileLiteralChar(mValue);
 }
@@ -224,6 +256,12 @@ std::string LiteralCharNode::dump(unsigned int indent) const {
 LiteralByteNode::LiteralByteNode(SourceCodeRef source, uint8_t val)
 : LiteralNode(source), mValue(val) {
 }
+Datatype LiteralByteNode::getDatatype() const {
+    return Datatype::createSimple(DatatypeCategory::byte);
+}
+std::vector<uint8_t> LiteralByteNode::toStackValue() const {
+    return literalToStackValue(DatatypeCategory::byte, mValue);
+}
 Datatype LiteralByteNode::compile(Compiler& comp) const {
     return comp.compileLiteralByte(mValue);
 }
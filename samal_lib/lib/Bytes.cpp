@@ -0,0 +1,150 @@
+#include "samal_lib/Bytes.hpp"
+#include "samal_lib/ExternalVMValue.hpp"
+#include "samal_lib/NativeCallFrame.hpp"
+#include "samal_lib/Program.hpp"
+#include "samal_lib/VM.hpp"
+#include "peg_parser/PegUtil.hpp"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace samal {
+
+// allocates a buffer for len bytes without initialising them; len has to be > 0
+static BytesValue allocBytes(VM& vm, size_t len) {
+    if(len > static_cast<size_t>(std::numeric_limits<int32_t>::max() - 16)) {
+        throw std::runtime_error{ "Unable to create bytes of length " + std::to_string(len) };
+    }
+    // the capacity is rounded up so the buffer can be allocated in x86_64_BIT_MODE as well
+    const int64_t capacity = static_cast<int64_t>((len + 7) & ~static_cast<size_t>(7));
+    auto* buffer = vm.alloc(static_cast<int32_t>(8 + capacity));
+    memcpy(buffer, &capacity, 8);
+    return BytesValue{ .buffer = buffer, .offset = 0, .length = static_cast<int32_t>(len) };
+}
+
+BytesValue createBytes(VM& vm, const uint8_t* data, size_t len) {
+    if(len == 0) {
+        return BytesValue{};
+    }
+    auto bytes = allocBytes(vm, len);
+    memcpy(bytes.buffer + 8, data, len);
+    return bytes;
+}
+
+static void checkIndex(const BytesValue& bytes, int32_t index) {
+    if(index < 0 || index >= bytes.length) {
+        throw std::runtime_error{ "Index " + std::to_string(index) + " is out of range for bytes of length " + std::to_string(bytes.length) };
+    }
+}
+
+std::vector<NativeFunction> createBytesNativeFunctions() {
+    const auto bytesType = Datatype::createSimple(DatatypeCategory::bytes);
+    const auto i32Type = Datatype::createSimple(DatatypeCategory::i32);
+    const auto byteType = Datatype::createSimple(DatatypeCategory::byte);
+    const auto charType = Datatype::createSimple(DatatypeCategory::char_);
+    std::vector<NativeFunction> ret;
+    auto add = [&ret](std::string name, Datatype type, std::function<void(NativeCallFrame&)> callback) {
+        ret.emplace_back(NativeFunction{ "Bytes." + std::move(name), std::move(type), {}, nullptr, std::move(callback) });
+    };
+    add("len", Datatype::createFunctionType(i32Type, { bytesType }), [](NativeCallFrame& frame) {
+        frame.setReturn(frame.arg<BytesValue>(0).length);
+    });
+    add("get", Datatype::createFunctionType(byteType, { bytesType, i32Type }), [](NativeCallFrame& frame) {
+        auto bytes = frame.arg<BytesValue>(0);
+        auto index = frame.arg<int32_t>(1);
+        checkIndex(bytes, index);
+        frame.setReturn(bytes.data()[index]);
+    });
+    // shares the buffer, so creating a slice doesn't allocate
+    add("slice", Datatype::createFunctionType(bytesType, { bytesType, i32Type, i32Type }), [](NativeCallFrame& frame) {
+        auto bytes = frame.arg<BytesValue>(0);
+        auto start = frame.arg<int32_t>(1);
+        auto end = frame.arg<int32_t>(2);
+        if(start < 0 || start > end || end > bytes.length) {
+            throw std::runtime_error{ "Slice [" + std::to_string(start) + ", " + std::to_string(end) + ") is out of range for bytes of length " + std::to_string(bytes.length) };
+        }
+        if(start == end) {
+            frame.setReturn(BytesValue{});
+            return;
+        }
+        frame.setReturn(BytesValue{ .buffer = bytes.buffer, .offset = bytes.offset + start, .length = end - start });
+    });
+    add("concat", Datatype::createFunctionType(bytesType, { bytesType, bytesType }), [](NativeCallFrame& frame) {
+        auto lhs = frame.arg<BytesValue>(0);
+        auto rhs = frame.arg<BytesValue>(1);
+        if(rhs.length == 0) {
+            frame.setReturn(lhs);
+            return;
+        }
+        if(lhs.length == 0) {
+            frame.setReturn(rhs);
+            return;
+        }
+        // the GC only runs at function calls, so both buffers stay where they are during the allocation
+        auto joined = allocBytes(frame.getVM(), static_cast<size_t>(lhs.length) + static_cast<size_t>(rhs.length));
+        memcpy(joined.buffer + 8, lhs.data(), lhs.length);
+        memcpy(joined.buffer + 8 + lhs.length, rhs.data(), rhs.length);
+        frame.setReturn(joined);
+    });
+    // index of the first occurrence of the needle or -1
+    add("find", Datatype::createFunctionType(i32Type, { bytesType, bytesType }), [](NativeCallFrame& frame) {
+        auto haystack = frame.arg<BytesValue>(0);
+        auto needle = frame.arg<BytesValue>(1);
+        if(needle.length == 0) {
+            frame.setReturn(int32_t{ 0 });
+            return;
+        }
+        const auto* end = haystack.data() + haystack.length;
+        const auto* found = std::search(haystack.data(), end, needle.data(), needle.data() + needle.length);
+        frame.setReturn(found == end ? int32_t{ -1 } : static_cast<int32_t>(found - haystack.data()));
+    });
+    // lexicographic comparison, returns -1, 0 or 1
+    add("compare", Datatype::createFunctionType(i32Type, { bytesType, bytesType }), [](NativeCallFrame& frame) {
+        auto lhs = frame.arg<BytesValue>(0);
+        auto rhs = frame.arg<BytesValue>(1);
+        const auto commonLength = std::min(lhs.length, rhs.length);
+        int result = commonLength > 0 ? memcmp(lhs.data(), rhs.data(), commonLength) : 0;
+        if(result == 0) {
+            result = lhs.length - rhs.length;
+        }
+        frame.setReturn(int32_t{ (result > 0) - (result < 0) });
+    });
+    add("fromList", Datatype::createFunctionType(bytesType, { Datatype::createListType(byteType) }), [](NativeCallFrame& frame) {
+        std::vector<uint8_t> data;
+        for(auto* element : frame.argList(0)) {
+            data.push_back(*element);
+        }
+        frame.setReturn(createBytes(frame.getVM(), data.data(), data.size()));
+    });
+    add("toList", Datatype::createFunctionType(Datatype::createListType(byteType), { bytesType }), [](NativeCallFrame& frame) {
+        auto bytes = frame.arg<BytesValue>(0);
+        frame.setReturn(ExternalVMValue::wrapByteArray(frame.getVM(), bytes.data(), bytes.length));
+    });
+    // encodes the string as UTF-8
+    add("fromString", Datatype::createFunctionType(bytesType, { Datatype::createListType(charType) }), [](NativeCallFrame& frame) {
+        std::string data;
+        for(auto* element : frame.argList(0)) {
+            int32_t charValue;
+            memcpy(&charValue, element, 4);
+            data += peg::encodeUTF8Codepoint(charValue);
+        }
+        frame.setReturn(createBytes(frame.getVM(), (const uint8_t*)data.data(), data.size()));
+    });
+    // decodes the bytes as UTF-8
+    add("toString", Datatype::createFunctionType(Datatype::createListType(charType), { bytesType }), [](NativeCallFrame& frame) {
+        auto bytes = frame.arg<BytesValue>(0);
+        std::string data{ (const char*)bytes.data(), static_cast<size_t>(bytes.length) };
+        size_t offset = 0;
+        while(offset < data.size()) {
+            auto decoded = peg::decodeUTF8Codepoint(std::string_view{ data }.substr(offset));
+            if(!decoded) {
+                throw std::runtime_error{ "Bytes contain invalid UTF-8 at offset " + std::to_string(offset) };
+            }
+            offset += decoded->len;
+        }
+        frame.setReturn(ExternalVMValue::wrapString(frame.getVM(), data));
+    });
+    return ret;
+}
+
+}
@@ -1,6 +1,7 @@
 #include "samal_lib/Compiler.hpp"
 #include "samal_lib/AST.hpp"
 #include "samal_lib/StackInformationTree.hpp"
+#include <algorithm>
 #include <unordered_set>
 
 namespace samal {
@@ -185,8 +186,234 @@ Program Compiler::compileInternal() {
         }
         assert(found);
     }
+    for(auto& staticCall : mStaticCalls) {
+        auto ptr = labelToPtr(staticCall.functionIdLabel);
+        auto functionIdType = *reinterpret_cast<int32_t*>(ptr + 1);
+        if(functionIdType == 1) {
+            mProgram.staticCallTargets.emplace(staticCall.callIp, *reinterpret_cast<int32_t*>(ptr + 5));
+        } else if(functionIdType == 3) {
+            mProgram.staticNativeCallTargets.emplace(staticCall.callIp, *reinterpret_cast<int32_t*>(ptr + 5));
+        }
+    }
+    fuseInstructions();
     return std::move(mProgram);
 }
+// Values containing functions can't be compared with ==, as there is no sensible equality for lambdas.
+// Structs and enums are only visited once, as they can contain themselves through lists and pointers.
+static bool containsFunction(const Datatype& typeParam, std::vector<Datatype>& visited) {
+    auto type = completeTypeUntilNoLongerUndefined(typeParam);
+    switch(type.getCategory()) {
+    case DatatypeCategory::function:
+        return true;
+    case DatatypeCategory::tuple:
+        for(auto& element : type.getTupleInfo()) {
+            if(containsFunction(element, visited)) {
+                return true;
+            }
+        }
+        return false;
+    case DatatypeCategory::list:
+        return containsFunction(type.getListContainedType(), visited);
+    case DatatypeCategory::pointer:
+        return containsFunction(type.getPointerBaseType(), visited);
+    case DatatypeCategory::struct_:
+        if(std::find(visited.begin(), visited.end(), type) != visited.end()) {
+            return false;
+        }
+        visited.push_back(type);
+        for(auto& field : type.getStructInfo().fields) {
+            if(containsFunction(field.type.completeWithSavedTemplateParameters(), visited)) {
+                return true;
+            }
+        }
+        return false;
+    case DatatypeCategory::enum_:
+        if(std::find(visited.begin(), visited.end(), type) != visited.end()) {
+            return false;
+        }
+        visited.push_back(type);
+        for(auto& field : type.getEnumInfo().fields) {
+            for(auto& param : field.params) {
+                if(containsFunction(param.completeWithSavedTemplateParameters(), visited)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    default:
+        return false;
+    }
+}
+static Instruction getFusedConstantInstruction(Instruction pushInstruction, Instruction ins) {
+#ifdef x86_64_BIT_MODE
+    constexpr auto pushI32Instruction = Instruction::PUSH_8;
+#else
+    constexpr auto pushI32Instruction = Instruction::PUSH_4;
+#endif
+    if(pushInstruction == pushI32Instruction) {
+        switch(ins) {
+        case Instruction::ADD_I32:
+            return Instruction::ADD_I32_CONSTANT;
+        case Instruction::SUB_I32:
+            return Instruction::SUB_I32_CONSTANT;
+        case Instruction::MUL_I32:
+            return Instruction::MUL_I32_CONSTANT;
+        case Instruction::DIV_I32:
+            return Instruction::DIV_I32_CONSTANT;
+        default:
+            break;
+        }
+    }
+    if(pushInstruction == Instruction::PUSH_8) {
+        switch(ins) {
+        case Instruction::ADD_I64:
+            return Instruction::ADD_I64_CONSTANT;
+        case Instruction::SUB_I64:
+            return Instruction::SUB_I64_CONSTANT;
+        case Instruction::MUL_I64:
+            return Instruction::MUL_I64_CONSTANT;
+        case Instruction::DIV_I64:
+            return Instruction::DIV_I64_CONSTANT;
+        default:
+            break;
+        }
+    }
+    return Instruction::INVALID;
+}
+static Instruction getFusedJumpIfFalseInstruction(Instruction ins) {
+    switch(ins) {
+    case Instruction::COMPARE_LESS_THAN_I32:
+        return Instruction::COMPARE_LESS_THAN_I32_AND_JUMP_IF_FALSE;
+    case Instruction::COMPARE_MORE_THAN_I32:
+        return Instruction::COMPARE_MORE_THAN_I32_AND_JUMP_IF_FALSE;
+    case Instruction::COMPARE_LESS_EQUAL_THAN_I32:
+        return Instruction::COMPARE_LESS_EQUAL_THAN_I32_AND_JUMP_IF_FALSE;
+    case Instruction::COMPARE_MORE_EQUAL_THAN_I32:
+        return Instruction::COMPARE_MORE_EQUAL_THAN_I32_AND_JUMP_IF_FALSE;
+    case Instruction::COMPARE_EQUALS_I32:
+        return Instruction::COMPARE_EQUALS_I32_AND_JUMP_IF_FALSE;
+    case Instruction::COMPARE_NOT_EQUALS_I32:
+        return Instruction::COMPARE_NOT_EQUALS_I32_AND_JUMP_IF_FALSE;
+    case Instruction::COMPARE_LESS_THAN_I64:
+        return Instruction::COMPARE_LESS_THAN_I64_AND_JUMP_IF_FALSE;
+    case Instruction::COMPARE_MORE_THAN_I64:
+        return Instruction::COMPARE_MORE_THAN_I64_AND_JUMP_IF_FALSE;
+    case Instruction::COMPARE_LESS_EQUAL_THAN_I64:
+        return Instruction::COMPARE_LESS_EQUAL_THAN_I64_AND_JUMP_IF_FALSE;
+    case Instruction::COMPARE_MORE_EQUAL_THAN_I64:
+        return Instruction::COMPARE_MORE_EQUAL_THAN_I64_AND_JUMP_IF_FALSE;
+    case Instruction::COMPARE_EQUALS_I64:
+        return Instruction::COMPARE_EQUALS_I64_AND_JUMP_IF_FALSE;
+    case Instruction::COMPARE_NOT_EQUALS_I64:
+        return Instruction::COMPARE_NOT_EQUALS_I64_AND_JUMP_IF_FALSE;
+    case Instruction::IS_LIST_EMPTY:
+        return Instruction::IS_LIST_EMPTY_AND_JUMP_IF_FALSE;
+    default:
+        return Instruction::INVALID;
+    }
+}
+void Compiler::fuseInstructions() {
+    auto& code = mProgram.code;
+    const auto codeSize = static_cast<int32_t>(code.size());
+    // The second instruction of a pair vanishes, so we can't fuse it if something jumps to it.
+    // Return addresses always point to the instruction after a CALL, which is never fused with its predecessor.
+    std::unordered_set<int32_t> jumpTargets;
+    for(auto& function : mProgram.functions) {
+        jumpTargets.emplace(function.offset);
+    }
+    for(int32_t ip = 0; ip < codeSize;) {
+        auto ins = static_cast<Instruction>(code.at(ip));
+        if(isJumpInstruction(ins)) {
+            jumpTargets.emplace(*reinterpret_cast<int32_t*>(&code.at(ip + 1)));
+        }
+        ip += instructionToWidth(ins);
+    }
+
+    for(int32_t ip = 0; ip < codeSize;) {
+        auto ins = static_cast<Instruction>(code.at(ip));
+        const auto width = static_cast<int32_t>(instructionToWidth(ins));
+        const auto nextIp = ip + width;
+        if(nextIp >= codeSize || jumpTargets.count(nextIp) > 0) {
+            ip = nextIp;
+            continue;
+        }
+        auto nextIns = static_cast<Instruction>(code.at(nextIp));
+        const auto nextWidth = static_cast<int32_t>(instructionToWidth(nextIns));
+
+        std::vector<uint8_t> fused(width + nextWidth, 0);
+        auto fusedIns = Instruction::INVALID;
+        if(ins == Instruction::PUSH_4 || ins == Instruction::PUSH_8) {
+            // <ins> <constant>
+            fusedIns = getFusedConstantInstruction(ins, nextIns);
+            memcpy(&fused.at(1), &code.at(ip + 1), width - 1);
+        } else if(nextIns == Instruction::JUMP_IF_FALSE) {
+            // <ins> <target ip>
+            fusedIns = getFusedJumpIfFalseInstruction(ins);
+            memcpy(&fused.at(1), &code.at(nextIp + 1), 4);
+        } else if(ins == Instruction::REPUSH_FROM_N && nextIns == Instruction::LOAD_FROM_PTR && *reinterpret_cast<int32_t*>(&code.at(ip + 1)) == 8) {
+            // <ins> <offset of the pointer> <size to load> <offset to load from>
+            fusedIns = Instruction::REPUSH_AND_LOAD_FROM_PTR;
+            memcpy(&fused.at(1), &code.at(ip + 5), 4);
+            memcpy(&fused.at(5), &code.at(nextIp + 1), 8);
+        }
+        if(fusedIns == Instruction::INVALID) {
+            ip = nextIp;
+            continue;
+        }
+        assert(static_cast<int32_t>(instructionToWidth(fusedIns)) == width + nextWidth);
+        fused.at(0) = static_cast<uint8_t>(fusedIns);
+        memcpy(&code.at(ip), fused.data(), fused.size());
+        ip += width + nextWidth;
+    }
+}
+void Compiler::createStackMaps(Program::Function& function) {
+    const auto returnValueSize = static_cast<int32_t>(function.type.getFunctionTypeInfo().first.getSizeOnStack());
+    const auto addStackMap = [&](int32_t ip, bool isReturnAddress) {
+        auto stackSize = function.stackSizePerIp.find(ip);
+        if(stackSize == function.stackSizePerIp.end()) {
+            throw std::runtime_error{ "Unknown stack size at safepoint " + std::to_string(ip) + " in " + function.name };
+        }
+        StackMap map{
+            .ip = ip,
+            .frameSize = stackSize->second,
+            .returnValueSize = returnValueSize,
+            .firstRoot = static_cast<int32_t>(mProgram.stackMapRoots.size()),
+            .rootCount = 0 };
+        // same traversal as VM::walkStack()
+        auto stackInfo = function.stackInformation->getBestNodeForIp(ip);
+        assert(stackInfo);
+        bool afterPop = false;
+        while(stackInfo) {
+            if(stackInfo->isAtPopInstruction()) {
+                afterPop = true;
+            }
+            auto& variable = stackInfo->getVarEntry();
+            // a variable starting at a return address is the return value of a call that hasn't returned yet
+            if(variable && !afterPop && !(isReturnAddress && stackInfo->getIp() == ip) && mProgram.pointerMaps.at(variable->pointerMapIndex).containsPointers()) {
+                mProgram.stackMapRoots.push_back(StackMap::Root{ .offset = map.frameSize - stackInfo->getStackSize(), .pointerMapIndex = variable->pointerMapIndex });
+                ++map.rootCount;
+            }
+            if(stackInfo->getPrevSibling()) {
+                stackInfo = stackInfo->getPrevSibling();
+            } else {
+                afterPop = false;
+                stackInfo = stackInfo->getParent();
+            }
+        }
+        assert(mProgram.stackMaps.empty() || mProgram.stackMaps.back().ip < ip);
+        mProgram.stackMaps.push_back(map);
+    };
+    for(int32_t ip = function.offset; ip < function.offset + function.len;) {
+        auto ins = static_cast<Instruction>(mProgram.code.at(ip));
+        const auto nextIp = ip + static_cast<int32_t>(instructionToWidth(ins));
+        if(ins == Instruction::RUN_GC) {
+            addStackMap(ip, false);
+        } else if(ins == Instruction::CALL) {
+            addStackMap(nextIp, true);
+        }
+        ip = nextIp;
+    }
+}
 void Compiler::compileFunction(const FunctionDeclarationNode& function) {
     // search for the full function name (this is the name prepended by the module)
     // TODO maybe add reverse list?
@@ -276,6 +503,7 @@ Program::Function& Compiler::helperCompileFunctionLikeThing(const std::string& n
     assert(mCurrentStackInfoTreeNode->getParent() == nullptr);
     mCurrentStackInfoTreeNode = nullptr;
     mIpToStackSize = {};
+    createStackMaps(entry);
     return entry;
 }
 Datatype Compiler::compileScope(const ScopeNode& scope) {
@@ -314,7 +542,8 @@ void Compiler::saveVariableLocation(std::string name, Datatype type, StorageType
     type = completeTypeUntilNoLongerUndefined(type);
     mStackFrames.top().variables.erase(name);
     mStackFrames.top().variables.emplace(name, VariableOnStack{ .offsetFromBottom = mStackSize - offset, .type = type });
-    mCurrentStackInfoTreeNode->addChild(std::make_unique<StackInformationTree>(mProgram.code.size(), mStackSize - offset, name, std::move(type), storageType));
+    auto pointerMapIndex = mPointerMapBuilder.getIndex(type);
+    mCurrentStackInfoTreeNode->addChild(std::make_unique<StackInformationTree>(mProgram.code.size(), mStackSize - offset, name, std::move(type), pointerMapIndex, storageType));
 }
 void Compiler::saveCurrentStackSizeToDebugInfo() {
     mIpToStackSize.emplace(mProgram.code.size(), mStackSize);
@@ -331,7 +560,8 @@ void Compiler::saveTinyStackFrameVariableLocation(Datatype type) {
     std::string name{"param$"};
     name += std::to_string(mStackFrames.top().variables.size());
     mStackFrames.top().variables.emplace(name, VariableOnStack{ .offsetFromBottom = mStackSize, .type = type });
-    mCurrentStackInfoTreeNode->addChild(std::make_unique<StackInformationTree>(mProgram.code.size(), mStackSize, name, std::move(type), StorageType::Local));
+    auto pointerMapIndex = mPointerMapBuilder.getIndex(type);
+    mCurrentStackInfoTreeNode->addChild(std::make_unique<StackInformationTree>(mProgram.code.size(), mStackSize, name, std::move(type), pointerMapIndex, StorageType::Local));
 }
 
 void Compiler::addInstructions(Instruction insn, int32_t param) {
@@ -602,6 +832,14 @@ Datatype Compiler::compileBinaryExpression(const BinaryExpressionNode& binaryExp
         }
         break;
     case DatatypeCategory::list:
+    case DatatypeCategory::tuple:
+    case DatatypeCategory::struct_:
+    case DatatypeCategory::enum_:
+    case DatatypeCategory::bytes: {
+        std::vector<Datatype> visited;
+        if(containsFunction(lhsType, visited)) {
+            binaryExpression.throwException("Unable to compare values of type " + lhsType.toString() + " as they contain functions");
+        }
         switch(binaryExpression.getOperator()) {
         case BinaryExpressionNode::BinaryOperator::LOGICAL_EQUALS:
             addInstructions(Instruction::COMPARE_COMPLEX_EQUALITY, saveAuxiliaryDatatypeToProgram(lhsType));
@@ -622,6 +860,7 @@ Datatype Compiler::compileBinaryExpression(const BinaryExpressionNode& binaryExp
             break;
         }
         break;
+    }
     case DatatypeCategory::bool_:
         switch(binaryExpression.getOperator()) {
         case BinaryExpressionNode::BinaryOperator::LOGICAL_OR:
@@ -889,10 +1128,17 @@ Datatype Compiler::helperCompileFunctionCallLikeThing(const up<ExpressionNode>&
     UndeterminedIdentifierReplacementMap inferredTemplateParameters;
     std::string fullFunctionName;
     CallableDeclaration* callableDeclaration = nullptr;
+    const auto codeSizeBeforeFunctionName = static_cast<int32_t>(mProgram.code.size());
     try {
         functionNameType = functionNameNode->compile(*this);
         functionNameType = completeTypeUntilNoLongerUndefined(functionNameType);
         couldCompileIdentifierLoad = true;
+        // check if the function name was compiled to a single function id push, i.e. we know the callee at compile time
+        // (lambdas are always followed by CREATE_LAMBDA)
+        if(mProgram.code.size() == codeSizeBeforeFunctionName + instructionToWidth(Instruction::PUSH_8)
+           && static_cast<Instruction>(mProgram.code.at(codeSizeBeforeFunctionName)) == Instruction::PUSH_8) {
+            pushLabel = codeSizeBeforeFunctionName;
+        }
     } catch(std::exception& e) {
         auto* functionIdentifier = dynamic_cast<IdentifierNode*>(functionNameNode.get());
         if(!functionIdentifier) {
@@ -991,6 +1237,9 @@ Datatype Compiler::helperCompileFunctionCallLikeThing(const up<ExpressionNode>&
     }
 
 
+    if(pushLabel >= 0) {
+        mStaticCalls.emplace_back(StaticCall{ .functionIdLabel = pushLabel, .callIp = static_cast<int32_t>(mProgram.code.size()) });
+    }
     addInstructions(Instruction::CALL, paramTypesSummedSize);
     mStackSize -= paramTypesSummedSize + functionNameType.getSizeOnStack();
     mStackSize += functionNameType.getFunctionTypeInfo().first.getSizeOnStack();
@@ -1129,6 +1378,9 @@ Datatype Compiler::compileListCreation(const ListCreationNode& node) {
         mStackSize += 8;
         return Datatype::createListType(*elementType);
     }
+    if(auto constantListType = tryCompileConstantList(node, elementType)) {
+        return std::move(*constantListType);
+    }
     pushTinyStackFrame();
     for(auto& param : node.getParams()) {
         auto paramType = param->compile(*this);
@@ -1148,6 +1400,33 @@ Datatype Compiler::compileListCreation(const ListCreationNode& node) {
     popTinyStackFrame();
     return Datatype::createListType(std::move(*elementType));
 }
+std::optional<Datatype> Compiler::tryCompileConstantList(const ListCreationNode& node, const std::optional<Datatype>& elementType) {
+    std::optional<Datatype> literalType = elementType;
+    std::vector<uint8_t> elements;
+    for(auto& param : node.getParams()) {
+        auto* literal = dynamic_cast<const LiteralNode*>(param.get());
+        if(!literal) {
+            return {};
+        }
+        auto paramType = literal->getDatatype();
+        if(literalType && paramType != *literalType) {
+            // the regular path reports the error
+            return {};
+        }
+        literalType = paramType;
+        auto value = literal->toStackValue();
+        elements.insert(elements.end(), value.begin(), value.end());
+    }
+    assert(literalType);
+    const auto elementSize = literalType->getSizeOnStack();
+    auto [it, inserted] = mConstantListIds.emplace(std::make_pair(elementSize, elements), static_cast<int32_t>(mProgram.constantLists.size()));
+    if(inserted) {
+        mProgram.constantLists.push_back(ConstantList{ .elementSize = elementSize, .elements = std::move(elements) });
+    }
+    addInstructions(Instruction::LOAD_CONSTANT_LIST, it->second);
+    mStackSize += 8;
+    return Datatype::createListType(std::move(*literalType));
+}
 Datatype Compiler::compileListPropertyAccess(const ListPropertyAccessExpression& node) {
     auto listType = completeTypeUntilNoLongerUndefined(node.getList()->compile(*this));
     if(listType.getCategory() != DatatypeCategory::list) {
@@ -1436,6 +1715,7 @@ MatchCompileReturn Compiler::compileTryMatchIdentifier(const IdentifierMatchCond
 
 
 int32_t Compiler::saveAuxiliaryDatatypeToProgram(Datatype type) {
+    mProgram.auxiliaryDatatypePointerMaps.push_back(mPointerMapBuilder.getIndex(type));
     mProgram.auxiliaryDatatypes.emplace_back(type);
     return mProgram.auxiliaryDatatypes.size() - 1;
 }
@@ -45,6 +45,8 @@ std::string Datatype::toString() const {
         return "bool";
     case DatatypeCategory::byte:
         return "byte";
+    case DatatypeCategory::bytes:
+        return "bytes";
     case DatatypeCategory::char_:
         return "char";
     case DatatypeCategory::undetermined_identifier:
@@ -201,6 +203,9 @@ int32_t Datatype::getSizeOnStack(int32_t depth) const {
     case DatatypeCategory::pointer:
         mSizeOnStackCache = 8;
         return mSizeOnStackCache;
+    case DatatypeCategory::bytes:
+        mSizeOnStackCache = 16;
+        return mSizeOnStackCache;
     case DatatypeCategory::enum_:
         mSizeOnStackCache = getEnumInfo().getLargestFieldSizePlusIndex(depth + 1);
         return mSizeOnStackCache;
@@ -245,6 +250,9 @@ int32_t Datatype::getSizeOnStack(int32_t depth) const {
     case DatatypeCategory::pointer:
         mSizeOnStackCache = 8;
         return mSizeOnStackCache;
+    case DatatypeCategory::bytes:
+        mSizeOnStackCache = 16;
+        return mSizeOnStackCache;
     case DatatypeCategory::struct_: {
         size_t sum = 0;
         for(auto& field : getStructInfo().fields) {
@@ -293,6 +301,7 @@ Datatype Datatype::attachUndeterminedIdentifierMap(sp<UndeterminedIdentifierComp
     case DatatypeCategory::i64:
     case DatatypeCategory::char_:
     case DatatypeCategory::byte:
+    case DatatypeCategory::bytes:
     case DatatypeCategory::undetermined_identifier:
         break;
     case DatatypeCategory::function: {
@@ -362,6 +371,7 @@ Datatype Datatype::completeWithTemplateParameters(const UndeterminedIdentifierRe
         case DatatypeCategory::i64:
         case DatatypeCategory::char_:
         case DatatypeCategory::byte:
+        case DatatypeCategory::bytes:
             return *this;
         default:
             break;
@@ -378,6 +388,7 @@ Datatype Datatype::completeWithTemplateParameters(const UndeterminedIdentifierRe
     case DatatypeCategory::i64:
     case DatatypeCategory::char_:
     case DatatypeCategory::byte:
+    case DatatypeCategory::bytes:
         break;
     case DatatypeCategory::function: {
         const auto& ourFunctionType = getFunctionTypeInfo();
@@ -479,6 +490,7 @@ void Datatype::inferTemplateTypes(const Datatype& realTypeParam, UndeterminedIde
     case DatatypeCategory::i64:
     case DatatypeCategory::char_:
     case DatatypeCategory::byte:
+    case DatatypeCategory::bytes:
         break;
     case DatatypeCategory::undetermined_identifier:
         output.emplace(getUndeterminedIdentifierString(), UndeterminedIdentifierReplacementMapValue{realType, CheckTypeRecursively::Yes, usingModuleNames});
@@ -0,0 +1,198 @@
+#include "samal_lib/EqualityComparator.hpp"
+#include "samal_lib/Bytes.hpp"
+#include "samal_lib/EnumField.hpp"
+#include "samal_lib/List.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace samal {
+
+EqualityComparator::EqualityComparator(const Datatype& type)
+: mSizeOnStack(type.getSizeOnStack()) {
+    addSteps(type, 0);
+}
+void EqualityComparator::addSteps(const Datatype& type, int32_t offset) {
+    switch(type.getCategory()) {
+    case DatatypeCategory::i32:
+    case DatatypeCategory::char_:
+        // in x86_64_BIT_MODE only the lower four bytes of the slot are meaningful
+        addBytes(offset, 4);
+        break;
+    case DatatypeCategory::i64:
+        addBytes(offset, 8);
+        break;
+    case DatatypeCategory::bool_:
+    case DatatypeCategory::byte:
+        addBytes(offset, 1);
+        break;
+    case DatatypeCategory::f64:
+        mSteps.emplace_back(Step{ .type = StepType::F64, .offset = offset });
+        break;
+    case DatatypeCategory::bytes:
+        mSteps.emplace_back(Step{ .type = StepType::BytesValue, .offset = offset });
+        break;
+    case DatatypeCategory::tuple: {
+        int32_t elementOffset = offset + type.getSizeOnStack();
+        for(auto& element : type.getTupleInfo()) {
+            elementOffset -= element.getSizeOnStack();
+            addSteps(element, elementOffset);
+        }
+        break;
+    }
+    case DatatypeCategory::struct_: {
+        int32_t fieldOffset = offset + type.getSizeOnStack();
+        for(auto& field : type.getStructInfo().fields) {
+            auto fieldType = field.type.completeWithSavedTemplateParameters();
+            fieldOffset -= fieldType.getSizeOnStack();
+            addSteps(fieldType, fieldOffset);
+        }
+        break;
+    }
+    case DatatypeCategory::enum_: {
+        Step step{ .type = StepType::Enum, .offset = offset };
+        for(auto& field : type.getEnumInfo().fields) {
+            up<EqualityComparator> fieldComparator{ new EqualityComparator{} };
+            int32_t paramOffset = type.getEnumInfo().getLargestFieldSizePlusIndex();
+            for(auto& param : field.params) {
+                auto paramType = param.completeWithSavedTemplateParameters();
+                paramOffset -= paramType.getSizeOnStack();
+                fieldComparator->addSteps(paramType, paramOffset);
+            }
+            step.enumFields.emplace_back(std::move(fieldComparator));
+        }
+        mSteps.emplace_back(std::move(step));
+        break;
+    }
+    case DatatypeCategory::list:
+        mSteps.emplace_back(Step{ .type = StepType::List, .offset = offset, .nestedType = type.getListContainedType() });
+        break;
+    case DatatypeCategory::pointer:
+        mSteps.emplace_back(Step{ .type = StepType::Pointer, .offset = offset, .nestedType = type.getPointerBaseType() });
+        break;
+    case DatatypeCategory::undetermined_identifier:
+        addSteps(completeTypeUntilNoLongerUndefined(type), offset);
+        break;
+    default:
+        todo();
+    }
+}
+void EqualityComparator::addBytes(int32_t offset, int32_t size) {
+    // merge adjacent scalars into one memcmp; tuple and struct elements are added from the highest offset downwards
+    if(!mSteps.empty() && mSteps.back().type == StepType::Bytes) {
+        auto& previous = mSteps.back();
+        if(offset + size == previous.offset) {
+            previous.offset = offset;
+            previous.size += size;
+            return;
+        }
+        if(previous.offset + previous.size == offset) {
+            previous.size += size;
+            return;
+        }
+    }
+    mSteps.emplace_back(Step{ .type = StepType::Bytes, .offset = offset, .size = size });
+}
+const EqualityComparator& EqualityComparator::getNested(const Step& step) const {
+    if(!step.nested) {
+        step.nested = std::make_unique<EqualityComparator>(step.nestedType);
+    }
+    return *step.nested;
+}
+bool EqualityComparator::listEquals(const Step& step, const uint8_t* lhs, const uint8_t* rhs) const {
+    const auto& elementComparator = getNested(step);
+    // lists of scalars like [char] are compared with a single memcmp per element instead of going through equals()
+    const bool elementIsBytes = elementComparator.mSteps.size() == 1 && elementComparator.mSteps.front().type == StepType::Bytes;
+    const int32_t bytesOffset = elementIsBytes ? elementComparator.mSteps.front().offset : 0;
+    const int32_t bytesSize = elementIsBytes ? elementComparator.mSteps.front().size : 0;
+    while(true) {
+        // lists often share their tail, e.g. after prepending to the same list
+        if(lhs == rhs) {
+            return true;
+        }
+        if(!lhs || !rhs) {
+            return false;
+        }
+        // Packed chunks store their elements one after another, so the elements both chunks have left are compared in
+        // one go. In x86_64_BIT_MODE, chars and bytes are padded to 8 bytes that aren't compared, so this only applies
+        // if the compared bytes are the whole element.
+        if(elementIsBytes && isPackedList(lhs) && isPackedList(rhs) && getPackedListElementSize(lhs) == bytesSize && getPackedListElementSize(rhs) == bytesSize) {
+            const auto count = std::min(getPackedListRemaining(lhs), getPackedListRemaining(rhs));
+            if(memcmp(getListHead(lhs), getListHead(rhs), static_cast<size_t>(count) * bytesSize) != 0) {
+                return false;
+            }
+            lhs = dropPackedListElements(lhs, count);
+            rhs = dropPackedListElements(rhs, count);
+            continue;
+        }
+        if(elementIsBytes) {
+            if(memcmp(getListHead(lhs) + bytesOffset, getListHead(rhs) + bytesOffset, bytesSize) != 0) {
+                return false;
+            }
+        } else if(!elementComparator.equals(getListHead(lhs), getListHead(rhs))) {
+            return false;
+        }
+        lhs = getListTail(lhs);
+        rhs = getListTail(rhs);
+    }
+}
+bool EqualityComparator::equals(const uint8_t* lhs, const uint8_t* rhs) const {
+    for(auto& step : mSteps) {
+        switch(step.type) {
+        case StepType::Bytes:
+            if(memcmp(lhs + step.offset, rhs + step.offset, step.size) != 0) {
+                return false;
+            }
+            break;
+        case StepType::F64: {
+            double lhsValue, rhsValue;
+            memcpy(&lhsValue, lhs + step.offset, sizeof(double));
+            memcpy(&rhsValue, rhs + step.offset, sizeof(double));
+            if(lhsValue != rhsValue) {
+                return false;
+            }
+            break;
+        }
+        case StepType::List:
+            if(!listEquals(step, *(const uint8_t**)(lhs + step.offset), *(const uint8_t**)(rhs + step.offset))) {
+                return false;
+            }
+            break;
+        case StepType::Pointer: {
+            auto* lhsPtr = *(const uint8_t**)(lhs + step.offset);
+            auto* rhsPtr = *(const uint8_t**)(rhs + step.offset);
+            if(lhsPtr != rhsPtr && !getNested(step).equals(lhsPtr, rhsPtr)) {
+                return false;
+            }
+            break;
+        }
+        case StepType::Enum: {
+            // the index is stored in the first four bytes (the lower half of the slot in x86_64_BIT_MODE)
+            int32_t lhsIndex, rhsIndex;
+            memcpy(&lhsIndex, lhs + step.offset, 4);
+            memcpy(&rhsIndex, rhs + step.offset, 4);
+            if(lhsIndex != rhsIndex) {
+                return false;
+            }
+            if(!step.enumFields.at(lhsIndex)->equals(lhs + step.offset, rhs + step.offset)) {
+                return false;
+            }
+            break;
+        }
+        case StepType::BytesValue: {
+            BytesValue lhsValue, rhsValue;
+            memcpy(&lhsValue, lhs + step.offset, sizeof(BytesValue));
+            memcpy(&rhsValue, rhs + step.offset, sizeof(BytesValue));
+            if(lhsValue.length != rhsValue.length) {
+                return false;
+            }
+            if(lhsValue.length > 0 && memcmp(lhsValue.data(), rhsValue.data(), lhsValue.length) != 0) {
+                return false;
+            }
+            break;
+        }
+        }
+    }
+    return true;
+}
+
+}
@@ -1,4 +1,5 @@
 #include "samal_lib/ExternalVMValue.hpp"
+#include "samal_lib/List.hpp"
 #include "samal_lib/VM.hpp"
 #include "peg_parser/PegUtil.hpp"
 #include <cassert>
@@ -21,49 +22,41 @@ ExternalVMValue ExternalVMValue::wrapChar(VM& vm, int32_t charValue) {
     return ExternalVMValue(vm, Datatype::createSimple(DatatypeCategory::char_), charValue);
 }
 ExternalVMValue ExternalVMValue::wrapString(VM& vm, const std::string& str) {
-    const auto chunkSize = 8 + getSimpleSize(DatatypeCategory::char_);
-    uint8_t* startPtr = nullptr;
-
+    const auto charSize = getSimpleSize(DatatypeCategory::char_);
+    // the characters are laid out like on the stack, with the upper half of each slot zeroed in x86_64_BIT_MODE
+    std::vector<uint8_t> elements;
+    elements.reserve(str.size() * charSize);
     size_t offset = 0;
-    uint8_t* ptr = nullptr;
     while(offset < str.size()) {
-        uint8_t* nextPtr = vm.alloc(chunkSize);
-        memset(nextPtr, 0, chunkSize);
-        if(startPtr == nullptr) {
-            startPtr = nextPtr;
-        }
-        if(ptr) {
-            memcpy(ptr, &nextPtr, sizeof(nextPtr));
-        }
         auto encoded = peg::decodeUTF8Codepoint(std::string_view{str}.substr(offset));
         assert(encoded);
-        memcpy(nextPtr + 8, &encoded->utf32Value, 4);
-
+        elements.resize(elements.size() + charSize);
+        memcpy(elements.data() + elements.size() - charSize, &encoded->utf32Value, 4);
         offset += encoded->len;
-        ptr = nextPtr;
     }
-    return ExternalVMValue(vm, Datatype::createListType(Datatype::createSimple(DatatypeCategory::char_)), startPtr);
+    auto* list = createPackedList(elements.data(), elements.size() / charSize, charSize, [&vm](size_t size) { return vm.alloc(static_cast<int32_t>(size)); });
+    return ExternalVMValue(vm, Datatype::createListType(Datatype::createSimple(DatatypeCategory::char_)), list);
 }
 ExternalVMValue ExternalVMValue::wrapStringAsByteArray(VM& vm, const std::string& str) {
     return wrapByteArray(vm, (uint8_t*)str.c_str(), str.size());
 }
 ExternalVMValue ExternalVMValue::wrapByteArray(VM& vm, const uint8_t* data, size_t len) {
-    const auto chunkSize = 8 + getSimpleSize(DatatypeCategory::byte);
-    uint8_t* startPtr = nullptr;
-    uint8_t* ptr = nullptr;
-    for(size_t i = 0; i < len; ++i) {
-        uint8_t* nextPtr = vm.alloc(chunkSize);
-        memset(nextPtr, 0, chunkSize);
-        if(startPtr == nullptr) {
-            startPtr = nextPtr;
+    const auto byteSize = getSimpleSize(DatatypeCategory::byte);
+    auto allocator = [&vm](size_t size) { return vm.alloc(static_cast<int32_t>(size)); };
+    uint8_t* list;
+    if(byteSize == 1) {
+        list = createPackedList(data, len, byteSize, allocator);
+    } else {
+        std::vector<uint8_t> elements(len * byteSize, 0);
+        for(size_t i = 0; i < len; ++i) {
+            elements[i * byteSize] = data[i];
         }
-        if(ptr) {
-            memcpy(ptr, &nextPtr, sizeof(nextPtr));
-        }
-        memcpy(nextPtr + 8, &data[i], 1);
-        ptr = nextPtr;
+        list = createPackedList(elements.data(), len, byteSize, allocator);
     }
-    return ExternalVMValue(vm, Datatype::createListType(Datatype::createSimple(DatatypeCategory::byte)), startPtr);
+    return ExternalVMValue(vm, Datatype::createListType(Datatype::createSimple(DatatypeCategory::byte)), list);
+}
+ExternalVMValue ExternalVMValue::wrapBytes(VM& vm, const uint8_t* data, size_t len) {
+    return ExternalVMValue(vm, Datatype::createSimple(DatatypeCategory::bytes), createBytes(vm, data, len));
 }
 ExternalVMValue ExternalVMValue::wrapEnum(VM& vm, const Datatype& enumType, const std::string& fieldName, std::vector<ExternalVMValue>&& elements) {
     int32_t index = -1;
@@ -112,6 +105,11 @@ std::vector<uint8_t> ExternalVMValue::toStackValue(VM& vm) const {
             return std::vector<uint8_t>{ (uint8_t)(val >> 0), (uint8_t)(val >> 8), (uint8_t)(val >> 16), (uint8_t)(val >> 24), (uint8_t)(val >> 32), (uint8_t)(val >> 40), (uint8_t)(val >> 48), (uint8_t)(val >> 56) };
         }
     }
+    case DatatypeCategory::bytes: {
+        std::vector<uint8_t> bytes(sizeof(BytesValue));
+        memcpy(bytes.data(), &std::get<BytesValue>(mValue), sizeof(BytesValue));
+        return bytes;
+    }
     case DatatypeCategory::enum_: {
         const auto& enumValue = std::get<EnumValue>(mValue);
         const auto& selectedFieldType = mType.getEnumInfo().fields.at(enumValue.selectedFieldIndex);
@@ -187,14 +185,25 @@ std::string ExternalVMValue::dump() const {
         ret += "[";
         auto* current = std::get<const uint8_t*>(mValue);
         while(current != nullptr) {
-            ret += ExternalVMValue::wrapFromPtr(mType.getListContainedType(), *mVM, current + 8).dump();
-            current = *(uint8_t**)current;
+            ret += ExternalVMValue::wrapFromPtr(mType.getListContainedType(), *mVM, getListHead(current)).dump();
+            current = getListTail(current);
             if(current != nullptr)
                 ret += ", ";
         }
         ret += "]";
         break;
     }
+    case DatatypeCategory::bytes: {
+        ret += "bytes[";
+        const auto& bytes = std::get<BytesValue>(mValue);
+        for(int32_t i = 0; i < bytes.length; ++i) {
+            ret += std::to_string(bytes.data()[i]);
+            if(i < bytes.length - 1)
+                ret += ", ";
+        }
+        ret += "]";
+        break;
+    }
     case DatatypeCategory::pointer: {
         ret += "$";
         ret += ExternalVMValue::wrapFromPtr(mType.getPointerBaseType(), *mVM, std::get<const uint8_t*>(mValue)).dump();
@@ -306,6 +315,11 @@ ExternalVMValue ExternalVMValue::wrapFromPtr(Datatype type, VM& vm, const uint8_
     case DatatypeCategory::list: {
         return ExternalVMValue{ vm, type, *(uint8_t**)(ptr) };
     }
+    case DatatypeCategory::bytes: {
+        BytesValue bytes;
+        memcpy(&bytes, ptr, sizeof(BytesValue));
+        return ExternalVMValue{ vm, type, bytes };
+    }
     case DatatypeCategory::undetermined_identifier: {
         auto completedType = type.completeWithSavedTemplateParameters();
         if(completedType.getCategory() == DatatypeCategory::undetermined_identifier) {
@@ -328,13 +342,17 @@ std::string ExternalVMValue::toCPPString() const {
     auto* current = std::get<const uint8_t*>(mValue);
     while(current != nullptr) {
         int32_t charValue;
-        memcpy(&charValue, current + 8, 4);
+        memcpy(&charValue, getListHead(current), 4);
         ret += peg::encodeUTF8Codepoint(charValue);
-        current = *(uint8_t**)current;
+        current = getListTail(current);
     }
     return ret;
 }
 std::vector<uint8_t> ExternalVMValue::toByteBuffer() const {
+    if(mType.getCategory() == DatatypeCategory::bytes) {
+        const auto& bytes = std::get<BytesValue>(mValue);
+        return std::vector<uint8_t>(bytes.data(), bytes.data() + bytes.length);
+    }
     if(mType != Datatype::createListType(Datatype::createSimple(DatatypeCategory::byte))) {
         throw std::runtime_error{"This is not wrapping a byte buffer, it's wrapping a " + mType.toString() };
     }
@@ -342,9 +360,9 @@ std::vector<uint8_t> ExternalVMValue::toByteBuffer() const {
     auto* current = std::get<const uint8_t*>(mValue);
     while(current != nullptr) {
         uint8_t byteValue;
-        memcpy(&byteValue, current + 8, 1);
+        memcpy(&byteValue, getListHead(current), 1);
         ret.push_back(byteValue);
-        current = *(uint8_t**)current;
+        current = getListTail(current);
     }
     return ret;
 }
@@ -355,8 +373,8 @@ std::vector<ExternalVMValue> ExternalVMValue::toVector() const {
     std::vector<ExternalVMValue> ret;
     auto* current = std::get<const uint8_t*>(mValue);
     while(current != nullptr) {
-        ret.emplace_back(ExternalVMValue::wrapFromPtr(mType.getListContainedType(), *mVM, current + 8));
-        current = *(uint8_t**)current;
+        ret.emplace_back(ExternalVMValue::wrapFromPtr(mType.getListContainedType(), *mVM, getListHead(current)));
+        current = getListTail(current);
     }
     return ret;
 }
@@ -1,4 +1,6 @@
 #include "samal_lib/GC.hpp"
+#include "samal_lib/Bytes.hpp"
+#include "samal_lib/List.hpp"
 #include "samal_lib/Program.hpp"
 #include "samal_lib/VM.hpp"
 #include <algorithm>
@@ -12,17 +14,20 @@
 
 namespace samal {
 
+static inline size_t alignToWord(size_t len) {
+    return (len + 7) & ~static_cast<size_t>(7);
+}
 GC::Region::Region(size_t len) {
     if(len > 0) {
-        base = new uint8_t[len];
-        assert(base);
+        base = (uint8_t*)mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        assert(base != MAP_FAILED);
         size = len;
     }
     offset = 0;
 }
 GC::Region::~Region() {
     if(base) {
-        delete[] base;
+        munmap(base, size);
         base = nullptr;
     }
 }
@@ -31,7 +36,7 @@ GC::Region::Region(GC::Region&& other) noexcept {
 }
 GC::Region& GC::Region::operator=(GC::Region&& other) noexcept {
     if(base)
-        free(base);
+        munmap(base, size);
     base = other.base;
     size = other.size;
     offset = other.offset;
@@ -44,201 +49,655 @@ GC::Region& GC::Region::operator=(GC::Region&& other) noexcept {
 GC::GC(VM& vm, const VMParameters& params)
 : mVM(vm) {
     mConfigFunctionsCallsPerGCRun = params.functionsCallsPerGCRun;
+    mConfigTriggerRatio = params.gcTriggerRatio;
+    mConfigHeapGrowthThreshold = params.heapGrowthThreshold;
+    mConfigHeapGrowthFactor = params.heapGrowthFactor;
+    mPauseBudget = params.gcPauseBudget;
+    const auto threads = isIncremental() ? 1 : static_cast<size_t>(std::max(params.gcThreads, 1));
+    if(threads > 1) {
+        mAllocationAlignment = 8;
+    }
     mRegions[0] = Region{ static_cast<size_t>(params.initialHeapSize) };
     mRegions[1] = Region{ static_cast<size_t>(params.initialHeapSize) };
+    if(params.nurserySize > 0) {
+        mNursery = Region{ static_cast<size_t>(params.nurserySize) };
+    } else if(isIncremental()) {
+        mNursery = Region{ DEFAULT_INCREMENTAL_NURSERY_SIZE };
+    }
+    if(isIncremental()) {
+        const auto& pointerMaps = mVM.getProgram().pointerMaps;
+        mListNodeMaps.resize(pointerMaps.size());
+        for(size_t i = 0; i < pointerMaps.size(); ++i) {
+            // a node consists of the pointer to the next node followed by the element
+            auto& nodeMap = mListNodeMaps.at(i);
+            nodeMap.size = pointerMaps.at(i).size + 8;
+            nodeMap.entries.push_back(PointerMap::Entry{ .type = PointerMap::Entry::Type::List, .offset = 0, .target = static_cast<int32_t>(i) });
+            if(!pointerMaps.at(i).enumFieldMaps.empty()) {
+                nodeMap.entries.push_back(PointerMap::Entry{ .type = PointerMap::Entry::Type::Enum, .offset = 8, .target = static_cast<int32_t>(i) });
+            } else {
+                for(auto entry : pointerMaps.at(i).entries) {
+                    entry.offset += 8;
+                    nodeMap.entries.push_back(entry);
+                }
+            }
+        }
+    }
+    createConstantArea();
+    resetAllocationArea();
+    mWorkers.resize(threads);
+    for(size_t i = 1; i < threads; ++i) {
+        mWorkerThreads.emplace_back([this, i] { runWorkerThread(i); });
+    }
 }
-uint8_t* GC::alloc(int32_t size, size_t heapIndex) {
+void GC::createConstantArea() {
+    const auto& constantLists = mVM.getProgram().constantLists;
+    size_t size = 0;
+    for(auto& list : constantLists) {
+        // constant lists only contain scalars, so they are packed
+        const auto elementCount = list.elements.size() / list.elementSize;
+        const auto chunkCount = (elementCount + MAX_PACKED_LIST_CHUNK_ELEMENTS - 1) / MAX_PACKED_LIST_CHUNK_ELEMENTS;
+        // each chunk starts with the pointer to the next one and is padded to 8 bytes
+        size += list.elements.size() + chunkCount * 16;
+    }
+    mConstantArea = Region{ size };
+    for(auto& list : constantLists) {
+        mConstantLists.push_back(createPackedList(list.elements.data(), list.elements.size() / list.elementSize, list.elementSize, [this](size_t len) {
+            auto* ptr = mConstantArea.top();
+            mConstantArea.offset += alignToWord(len);
+            assert(mConstantArea.offset <= mConstantArea.size);
+            return ptr;
+        }));
+    }
+    // the constant area is never written to again
+    if(mConstantArea.base) {
+        mprotect(mConstantArea.base, mConstantArea.size, PROT_READ);
+    }
+}
+GC::~GC() {
+    {
+        std::lock_guard<std::mutex> lock{ mWorkerThreadsMutex };
+        mShutdown = true;
+    }
+    mCollectionStarted.notify_all();
+    for(auto& thread : mWorkerThreads) {
+        thread.join();
+    }
+}
+uint8_t* GC::alloc(int32_t size) {
 #ifdef x86_64_BIT_MODE
     assert(size % 8 == 0);
 #endif
-    // ensure that every memory allocation is divisible by 2 (used for pointer tagging for lambdas/functions)
-    if(size % 2 == 1) {
-        size += 1;
-    }
-    if(mRegions[heapIndex].offset + size >= mRegions[heapIndex].size) {
-        // not enough memory, add to temporary allocations
-        auto ptr = (uint8_t*)calloc(size, 1);
-        assert(ptr);
-        mTemporaryAllocations.emplace_back(TemporaryAllocation{{ptr, ArrayDeleter{}}, (size_t)size});
-        assert((uintptr_t)mTemporaryAllocations.back().data.get() % 8 == 0);
-        return ptr;
+    size = getAllocationSize(size);
+    if(mAllocationArea.top + size > mAllocationArea.end) {
+        return allocInNewChunk(size);
     }
-    auto ptr = mRegions[heapIndex].top();
-    mRegions[heapIndex].offset += size;
+    auto ptr = mAllocationArea.top;
+    mAllocationArea.top += size;
 
 #ifdef x86_64_BIT_MODE
     assert((uintptr_t)ptr % 8 == 0);
 #endif
     return ptr;
 }
-uint8_t* GC::alloc(int32_t size) {
-    return alloc(size, mActiveRegion);
+uint8_t* GC::allocInNewChunk(int32_t size) {
+    getCurrentAllocationRegion().offset = mAllocationArea.top - getCurrentAllocationRegion().base;
+    // each chunk is twice as large as the previous one
+    auto chunkSize = std::min(MIN_OVERFLOW_CHUNK_SIZE << std::min<size_t>(mOverflowChunks.size(), 6), MAX_OVERFLOW_CHUNK_SIZE);
+    mOverflowChunks.emplace_back(Region{ std::max(chunkSize, static_cast<size_t>(size)) });
+    mStatistics.overflowChunks++;
+    mAllocationArea.top = mOverflowChunks.back().base;
+    mAllocationArea.end = mOverflowChunks.back().base + mOverflowChunks.back().size;
+    auto ptr = mAllocationArea.top;
+    mAllocationArea.top += size;
+    return ptr;
+}
+GC::Region& GC::getCurrentAllocationRegion() {
+    return mOverflowChunks.empty() ? getAllocationRegion() : mOverflowChunks.back();
+}
+size_t GC::getOverflowChunksSize() const {
+    size_t sum = 0;
+    for(auto& chunk : mOverflowChunks) {
+        sum += chunk.offset;
+    }
+    return sum;
+}
+GC::Region& GC::getAllocationRegion() {
+    return isGenerational() ? mNursery : getActiveRegion();
+}
+void GC::resetAllocationArea() {
+    mAllocationArea.top = getAllocationRegion().top();
+    mAllocationArea.end = getAllocationRegion().base + getAllocationRegion().size;
+    mCollectionTrigger = mAllocationArea.top + static_cast<size_t>(static_cast<double>(mAllocationArea.end - mAllocationArea.top) * mConfigTriggerRatio);
+    mAllocationStartOffset = getAllocationRegion().offset;
 }
 void GC::performGarbageCollection() {
-    //Stopwatch stopwatch{"GC"};
-    //printf("Before size: %i\n", (int)mRegions[mActiveRegion].offset);
-    puts("Running GC");
+    const auto pauseStart = std::chrono::steady_clock::now();
+    getCurrentAllocationRegion().offset = mAllocationArea.top - getCurrentAllocationRegion().base;
+    const auto overflowChunksSize = getOverflowChunksSize();
+    const auto bytesAllocated = getAllocationRegion().offset - mAllocationStartOffset + overflowChunksSize;
+    mStatistics.peakHeapSize = std::max(mStatistics.peakHeapSize, getHeapSize());
+    mBytesCopied = 0;
+    auto type = GCStatistics::Collection::Type::Minor;
+    if(isIncremental()) {
+        auto youngSize = mNursery.offset + overflowChunksSize;
+        // the other region also needs to be able to take the rest of the active region that hasn't been copied yet
+        if(mIncrementalCollectionRunning && getOtherRegion().size - getOtherRegion().offset < youngSize + mIncrementalBytesLeft) {
+            abandonIncrementalCollection(youngSize);
+            type = GCStatistics::Collection::Type::Major;
+        } else {
+            if(mIncrementalCollectionRunning) {
+                collect(CollectionType::Minor, getOtherRegion());
+            } else if(getActiveRegion().size - getActiveRegion().offset >= youngSize) {
+                collect(CollectionType::Minor, getActiveRegion());
+            } else {
+                startIncrementalCollection(youngSize);
+            }
+            if(mIncrementalCollectionRunning) {
+                performIncrementalStep(pauseStart);
+                // the nursery has just been collected, so this is the only point at which the collection can finish
+                if(mIncrementalWorker.scanQueue.empty()) {
+                    finishIncrementalCollection();
+                }
+            }
+        }
+        mNursery.offset = 0;
+    } else if(isGenerational()) {
+        // a minor collection is only possible if the active region can take everything that might survive
+        auto youngSize = mNursery.offset + overflowChunksSize;
+        if(getActiveRegion().size - getActiveRegion().offset >= youngSize + getParallelCopyReserve(youngSize)) {
+            collect(CollectionType::Minor, getActiveRegion());
+        } else {
+            // make sure that at least the survivors of the next minor collection fit after this one
+            auto requiredSize = getActiveRegion().offset + youngSize + getParallelCopyReserve(getActiveRegion().offset + youngSize) + mNursery.size;
+            getOtherRegion().offset = 0;
+            if(getOtherRegion().size < requiredSize) {
+                getOtherRegion() = Region{ std::max(getActiveRegion().size, requiredSize) };
+            }
+            collect(CollectionType::Major, getOtherRegion());
+            mActiveRegion = !mActiveRegion;
+            growHeapIfNecessary();
+            type = GCStatistics::Collection::Type::Major;
+        }
+        mNursery.offset = 0;
+    } else {
+        getOtherRegion().offset = 0;
+        const auto requiredSize = getActiveRegion().size + overflowChunksSize + getParallelCopyReserve(getActiveRegion().offset + overflowChunksSize);
+        if(getOtherRegion().size < requiredSize) {
+            // our other region that we're copying into might be too small, so we resize it to prevent any potential problems
+            getOtherRegion() = Region{ requiredSize };
+        }
+        collect(CollectionType::Major, getOtherRegion());
+        mActiveRegion = !mActiveRegion;
+        growHeapIfNecessary();
+        type = GCStatistics::Collection::Type::Major;
+    }
+    mOverflowChunks.clear();
+    resetAllocationArea();
+    recordCollection(type, pauseStart, bytesAllocated);
+}
+size_t GC::getHeapSize() const {
+    size_t size = mRegions[0].size + mRegions[1].size + mNursery.size;
+    for(auto& chunk : mOverflowChunks) {
+        size += chunk.size;
+    }
+    return size;
+}
+void GC::recordCollection(GCStatistics::Collection::Type type, std::chrono::steady_clock::time_point pauseStart, size_t bytesAllocated) {
+    GCStatistics::Collection collection{
+        .type = type,
+        .pauseDuration = std::chrono::steady_clock::now() - pauseStart,
+        .bytesAllocated = bytesAllocated,
+        .bytesSurvived = mBytesCopied,
+        .heapSize = getHeapSize() };
+    switch(type) {
+    case GCStatistics::Collection::Type::Minor:
+        mStatistics.minorCollections++;
+        break;
+    case GCStatistics::Collection::Type::Major:
+        mStatistics.majorCollections++;
+        break;
+    case GCStatistics::Collection::Type::IncrementalStep:
+        mStatistics.incrementalSteps++;
+        break;
+    }
+    mStatistics.bytesAllocated += bytesAllocated;
+    mStatistics.peakHeapSize = std::max(mStatistics.peakHeapSize, collection.heapSize);
+    mStatistics.totalPauseDuration += collection.pauseDuration;
+    mStatistics.maxPauseDuration = std::max(mStatistics.maxPauseDuration, collection.pauseDuration);
+    if(mStatistics.recentCollections.size() == GCStatistics::MAX_RECENT_COLLECTIONS) {
+        mStatistics.recentCollections.pop_front();
+    }
+    mStatistics.recentCollections.push_back(collection);
+    if(mCollectionCallback) {
+        mCollectionCallback(collection);
+    }
+}
+void GC::startIncrementalCollection(size_t youngSize) {
+    // the other region has to take all objects of the active region and everything that's promoted in the meantime
+    auto requiredSize = 2 * (getActiveRegion().offset + youngSize) + mNursery.size;
     getOtherRegion().offset = 0;
-    if(!mTemporaryAllocations.empty() || getOtherRegion().size < getActiveRegion().size) {
-        // our other region that we're copying into might be too small, so we resize it to prevent any potential problems
-        size_t totalTemporarySize = 0;
-        for(auto& alloc: mTemporaryAllocations) {
-            totalTemporarySize += alloc.len;
+    if(getOtherRegion().size < requiredSize) {
+        getOtherRegion() = Region{ std::max(getActiveRegion().size, requiredSize) };
+    }
+    mForwardingTable = Region{ (getActiveRegion().size / 8 + 1) * 8 };
+    mIncrementalBytesLeft = getActiveRegion().offset;
+    mIncrementalCollectionRunning = true;
+    mFunctionCallsSinceLastIncrement = 0;
+    // the survivors of the nursery are promoted to the other region while the stack roots are copied
+    collect(CollectionType::Minor, getOtherRegion());
+}
+void GC::performIncrementalStep(std::chrono::steady_clock::time_point pauseStart) {
+    mCollectionType = CollectionType::Incremental;
+    mToRegion = &getOtherRegion();
+    mToRegionStart = getOtherRegion().offset;
+    auto& queue = mIncrementalWorker.scanQueue;
+    auto& head = mIncrementalWorker.scanQueueHead;
+    // the clock is only checked every few values; each of them is small as lists are scanned node by node
+    constexpr size_t VALUES_BETWEEN_CLOCK_CHECKS = 64;
+    size_t scannedValues = 0;
+    while(head < queue.size()) {
+        auto entry = queue[head++];
+        scanValue(mIncrementalWorker, entry.ptr, *entry.map);
+        if(++scannedValues % VALUES_BETWEEN_CLOCK_CHECKS == 0 && std::chrono::steady_clock::now() - pauseStart >= mPauseBudget) {
+            break;
         }
-        //printf("Resizing heap to %i\n", (int)(getActiveRegion().size + totalTemporarySize));
-        getOtherRegion() = Region{getActiveRegion().size + totalTemporarySize};
-        //printf("Resizing heap due to temporary allocations to %zu\n", getOtherRegion().size);
     }
-    mVM.generateStacktrace([this](const uint8_t* ptr, const Datatype& type, const std::string& name) {
-#ifdef x86_64_BIT_MODE
-        assert((uintptr_t)ptr % 8 == 0);
-#endif
-        searchForPtrs((uint8_t*)ptr, type, ScanningHeapOrStack::Stack);
-    }, {});
+    if(head == queue.size()) {
+        queue.clear();
+        head = 0;
+    } else if(head > queue.size() / 2) {
+        queue.erase(queue.begin(), queue.begin() + static_cast<ptrdiff_t>(head));
+        head = 0;
+    }
+    mBytesCopied += getOtherRegion().offset - mToRegionStart;
+    mToRegion = nullptr;
+}
+void GC::finishIncrementalCollection() {
+    mIncrementalCollectionRunning = false;
+    mForwardingTable = Region{};
     mActiveRegion = !mActiveRegion;
-    mTemporaryAllocations.clear();
-    //printf("After size: %i\n", (int)mRegions[mActiveRegion].offset);
+    growHeapIfNecessary();
+    mStatistics.completedIncrementalCollections++;
 }
-uint8_t* GC::copyToOther(uint8_t** ptr, size_t len) {
-    assert(ptr);
-    uint8_t* newPtr = getOtherRegion().top();
-    assert(getOtherRegion().size >= getOtherRegion().offset + len);
-    memcpy(newPtr, *ptr, len);
-    getOtherRegion().offset += len;
-    return newPtr;
+void GC::abandonIncrementalCollection(size_t youngSize) {
+    // Both regions contain live objects now, so they are copied into a new one. All pointers that aren't in the new
+    // region are copied, so it doesn't matter which objects have already been copied by the incremental collection.
+    mIncrementalCollectionRunning = false;
+    mForwardingTable = Region{};
+    mIncrementalWorker.scanQueue.clear();
+    mIncrementalWorker.scanQueueHead = 0;
+    auto requiredSize = getActiveRegion().offset + getOtherRegion().offset + youngSize + mNursery.size;
+    Region newRegion{ std::max(getActiveRegion().size, requiredSize) };
+    collect(CollectionType::Major, newRegion);
+    getActiveRegion() = std::move(newRegion);
+    getOtherRegion().offset = 0;
+    growHeapIfNecessary();
+    mStatistics.abandonedIncrementalCollections++;
 }
-
-void GC::searchForPtrs(uint8_t* ptr, const Datatype& type, ScanningHeapOrStack scanningHeapOrStack) {
-    switch(type.getCategory()) {
-    case DatatypeCategory::bool_:
-    case DatatypeCategory::i32:
-    case DatatypeCategory::i64:
-    case DatatypeCategory::f64:
-    case DatatypeCategory::char_:
-    case DatatypeCategory::byte:
-        break;
-    case DatatypeCategory::tuple: {
-        int32_t offset = type.getSizeOnStack();
-        for(auto& element : type.getTupleInfo()) {
-            offset -= element.getSizeOnStack();
-            searchForPtrs(ptr + offset, element, scanningHeapOrStack);
+bool GC::isInIncrementalFromSpace(uint8_t* ptr) {
+    return mIncrementalCollectionRunning && ptr >= getActiveRegion().base && ptr < getActiveRegion().base + getActiveRegion().size;
+}
+std::chrono::nanoseconds GCStatistics::getPausePercentile(double percentile) const {
+    if(recentCollections.empty()) {
+        return std::chrono::nanoseconds{ 0 };
+    }
+    std::vector<std::chrono::nanoseconds> sorted;
+    sorted.reserve(recentCollections.size());
+    for(auto& collection : recentCollections) {
+        sorted.push_back(collection.pauseDuration);
+    }
+    auto index = std::min(static_cast<size_t>(percentile * static_cast<double>(sorted.size())), sorted.size() - 1);
+    std::nth_element(sorted.begin(), sorted.begin() + static_cast<ptrdiff_t>(index), sorted.end());
+    return sorted.at(index);
+}
+void GC::growHeapIfNecessary() {
+    // the active region can't be resized as it contains the survivors, so the other one is grown and the active one
+    // will be replaced by it during the next collection of the whole heap
+    auto& activeRegion = getActiveRegion();
+    if(static_cast<double>(activeRegion.offset) > static_cast<double>(activeRegion.size) * mConfigHeapGrowthThreshold) {
+        auto newSize = static_cast<size_t>(static_cast<double>(activeRegion.size) * mConfigHeapGrowthFactor);
+        if(newSize > getOtherRegion().size) {
+            getOtherRegion() = Region{ newSize };
         }
-        break;
     }
-    case DatatypeCategory::list: {
-        auto** ptrToCurrent = (uint8_t**)ptr;
-        while(true) {
+}
+size_t GC::getParallelCopyReserve(size_t bytesToCopy) const {
+    if(!isParallel()) {
+        return 0;
+    }
+    // at most a quarter of each TLAB is left empty when a worker starts a new one, plus the unused end of the last ones
+    return bytesToCopy / 4 + mWorkers.size() * TLAB_SIZE;
+}
+void GC::collect(CollectionType type, Region& toRegion) {
+    mCollectionType = type;
+    mToRegion = &toRegion;
+    mToRegionStart = toRegion.offset;
+    mToSpaceOffset = toRegion.offset;
+    // the roots are distributed evenly between the workers
+    size_t nextWorker = 0;
+    mVM.forEachStackRoot([this, &nextWorker](uint8_t* ptr, int32_t pointerMapIndex) {
 #ifdef x86_64_BIT_MODE
-            assert((uintptr_t)*ptrToCurrent % 8 == 0);
+        assert((uintptr_t)ptr % 8 == 0);
 #endif
-            if(*ptrToCurrent == nullptr)
-                break;
-            if(isInOtherRegion(*ptrToCurrent)) {
-                break;
-            }
-            if(isInOtherRegion(**(uint8_t***)ptrToCurrent)) {
-                memcpy(ptrToCurrent, *ptrToCurrent, 8);
-                break;
+        enqueue(mWorkers[nextWorker], ptr, pointerMapIndex);
+        nextWorker = (nextWorker + 1) % mWorkers.size();
+    });
+    mIdleWorkers = 0;
+    if(isParallel()) {
+        {
+            std::lock_guard<std::mutex> lock{ mWorkerThreadsMutex };
+            mFinishedWorkerThreads = 0;
+            ++mCollectionCounter;
+        }
+        mCollectionStarted.notify_all();
+    }
+    processScanQueue(mWorkers[0]);
+    if(isParallel()) {
+        std::unique_lock<std::mutex> lock{ mWorkerThreadsMutex };
+        mWorkerFinished.wait(lock, [this] { return mFinishedWorkerThreads == mWorkerThreads.size(); });
+        // the unused ends of the TLABs are just left empty
+        toRegion.offset = mToSpaceOffset;
+        for(auto& worker : mWorkers) {
+            worker.tlabTop = nullptr;
+            worker.tlabEnd = nullptr;
+        }
+    }
+    mBytesCopied += toRegion.offset - mToRegionStart;
+    mToRegion = nullptr;
+}
+void GC::runWorkerThread(size_t index) {
+    uint64_t lastCollection = 0;
+    while(true) {
+        {
+            std::unique_lock<std::mutex> lock{ mWorkerThreadsMutex };
+            mCollectionStarted.wait(lock, [&] { return mShutdown || mCollectionCounter != lastCollection; });
+            if(mShutdown) {
+                return;
             }
-            auto containedTypeSize = type.getListContainedType().getSizeOnStack();
-            searchForPtrs(*ptrToCurrent + 8, type.getListContainedType(), ScanningHeapOrStack::Heap);
-            auto newPtr = copyToOther(ptrToCurrent, containedTypeSize + 8);
-            auto oldPtrToCurrent = *ptrToCurrent;
-            memcpy(ptrToCurrent, &newPtr, 8);
-
-            ptrToCurrent = *(uint8_t***)ptrToCurrent;
-            memcpy(oldPtrToCurrent, &newPtr, 8);
+            lastCollection = mCollectionCounter;
         }
-        break;
+        processScanQueue(mWorkers[index]);
+        {
+            std::lock_guard<std::mutex> lock{ mWorkerThreadsMutex };
+            ++mFinishedWorkerThreads;
+        }
+        mWorkerFinished.notify_one();
     }
-    case DatatypeCategory::function: {
-        int32_t firstHalf;
-        memcpy(&firstHalf, ptr, 4);
-        if(firstHalf % 2 != 0) {
-            // not lambda
-            break;
+}
+uint8_t* GC::allocInToSpace(Worker& worker, size_t len) {
+    if(!isParallel()) {
+        uint8_t* ptr = mToRegion->top();
+        assert(mToRegion->size >= mToRegion->offset + len);
+        mToRegion->offset += len;
+        return ptr;
+    }
+    len = alignToWord(len);
+    if(static_cast<size_t>(worker.tlabEnd - worker.tlabTop) < len) {
+        if(len > MAX_TLAB_OBJECT_SIZE) {
+            auto offset = mToSpaceOffset.fetch_add(len, std::memory_order_relaxed);
+            assert(mToRegion->size >= offset + len);
+            return mToRegion->base + offset;
         }
-        // it's a lambda
-        auto lambdaPtr = *(uint8_t**)ptr;
-        assert(lambdaPtr);
-
-        if(isInOtherRegion(*(uint8_t**)ptr)) {
-            break;
+        auto offset = mToSpaceOffset.fetch_add(TLAB_SIZE, std::memory_order_relaxed);
+        assert(mToRegion->size >= offset + TLAB_SIZE);
+        worker.tlabTop = mToRegion->base + offset;
+        worker.tlabEnd = worker.tlabTop + TLAB_SIZE;
+    }
+    auto ptr = worker.tlabTop;
+    worker.tlabTop += len;
+    return ptr;
+}
+template<typename SizeCallback>
+bool GC::evacuate(Worker& worker, uint8_t** slot, SizeCallback sizeOfObject) {
+    uint8_t* object = *slot;
+    if(isInIncrementalFromSpace(object)) {
+        // the program still uses the old copy, so the forwarding pointer can't be written into it
+        auto* forwardingPointer = (uint8_t**)mForwardingTable.base + (object - getActiveRegion().base) / 8;
+        if(*forwardingPointer) {
+            memcpy(slot, forwardingPointer, 8);
+            return false;
         }
-        if(isInOtherRegion(**(uint8_t***)ptr)) {
-            memcpy(ptr, *(uint8_t**)ptr, 8);
-            break;
+        uint8_t* firstWord;
+        memcpy(&firstWord, object, 8);
+        const size_t len = std::max<size_t>(sizeOfObject(firstWord), 8);
+        auto newPtr = allocInToSpace(worker, len);
+        memcpy(newPtr, object, len);
+        mIncrementalBytesLeft -= std::min(mIncrementalBytesLeft, len);
+        *forwardingPointer = newPtr;
+        memcpy(slot, &newPtr, 8);
+        return true;
+    }
+    uint8_t* firstWord;
+    if(isParallel()) {
+        firstWord = __atomic_load_n((uint8_t**)object, __ATOMIC_ACQUIRE);
+    } else {
+        memcpy(&firstWord, object, 8);
+    }
+    if(isInToSpace(firstWord)) {
+        memcpy(slot, &firstWord, 8);
+        return false;
+    }
+    const size_t len = std::max<size_t>(sizeOfObject(firstWord), 8);
+    auto newPtr = allocInToSpace(worker, len);
+    memcpy(newPtr, object, len);
+    memcpy(newPtr, &firstWord, 8);
+    if(isParallel()) {
+        // another worker might have copied the object in the meantime; in this case, firstWord is set to its copy
+        if(!__atomic_compare_exchange_n((uint8_t**)object, &firstWord, newPtr, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            if(newPtr + alignToWord(len) == worker.tlabTop) {
+                worker.tlabTop = newPtr;
+            }
+            memcpy(slot, &firstWord, 8);
+            return false;
         }
+    } else {
+        memcpy(object, &newPtr, 8);
+    }
+    memcpy(slot, &newPtr, 8);
+    return true;
+}
 
-        int32_t sizeOfLambda = -1;
-        memcpy(&sizeOfLambda, lambdaPtr, 4);
-        assert(sizeOfLambda >= 0);
-        sizeOfLambda += 16;
-
-        int32_t capturedLambdaTypesId;
-        memcpy(&capturedLambdaTypesId, lambdaPtr + 8, 4);
-
-        size_t offset = sizeOfLambda;
-        const auto& helperTuple = mVM.getProgram().auxiliaryDatatypes.at(capturedLambdaTypesId).getTupleInfo();
-        for(size_t i = 0; i < helperTuple.size(); ++i) {
-            offset -= helperTuple.at(i).getSizeOnStack();
-            searchForPtrs(lambdaPtr + offset, helperTuple.at(i), ScanningHeapOrStack::Heap);
-        }
-        auto newPtr = copyToOther((uint8_t**)ptr, sizeOfLambda);
-        memcpy(*(uint8_t**)ptr, &newPtr, 8);
-        memcpy(ptr, &newPtr, 8);
-        break;
+GC::Worker& GC::getWorkerForCopyOf(Worker& worker, uint8_t* object) {
+    return isInIncrementalFromSpace(object) ? mIncrementalWorker : worker;
+}
+void GC::enqueue(Worker& worker, uint8_t* ptr, int32_t pointerMapIndex) {
+    enqueue(worker, ptr, mVM.getProgram().pointerMaps[pointerMapIndex]);
+}
+void GC::enqueue(Worker& worker, uint8_t* ptr, const PointerMap& map) {
+    if(!map.containsPointers()) {
+        return;
     }
-    case DatatypeCategory::struct_: {
-        int32_t offset = type.getSizeOnStack();
-        for(auto& field : type.getStructInfo().fields) {
-            auto fieldType = field.type.completeWithSavedTemplateParameters();
-            offset -= fieldType.getSizeOnStack();
-            searchForPtrs(ptr + offset, fieldType, scanningHeapOrStack);
+    worker.scanQueue.emplace_back(ScanQueueEntry{ ptr, &map });
+}
+void GC::processScanQueue(Worker& worker) {
+    // Values are scanned in the order in which they were enqueued, so objects are scanned breadth-first in the order
+    // in which they were copied, like with Cheney's algorithm. This way the native stack doesn't grow with the depth
+    // of the data structures.
+    while(true) {
+        while(worker.scanQueueHead < worker.scanQueue.size()) {
+            auto entry = worker.scanQueue[worker.scanQueueHead++];
+            scanValue(worker, entry.ptr, *entry.map);
+            // the idle workers only need new work once they have taken everything that has been shared before
+            if(mIdleWorkers.load(std::memory_order_relaxed) > 0 && mSharedWorkSize.load(std::memory_order_relaxed) == 0) {
+                shareWork(worker);
+            }
         }
-        break;
+        worker.scanQueue.clear();
+        worker.scanQueueHead = 0;
+        if(!takeSharedWork(worker)) {
+            return;
+        }
+    }
+}
+void GC::shareWork(Worker& worker) {
+    const auto remaining = worker.scanQueue.size() - worker.scanQueueHead;
+    if(remaining < 2) {
+        return;
     }
-    case DatatypeCategory::enum_: {
+    {
+        std::lock_guard<std::mutex> lock{ mSharedWorkMutex };
+        auto firstShared = worker.scanQueue.end() - static_cast<ptrdiff_t>(remaining / 2);
+        mSharedWork.insert(mSharedWork.end(), firstShared, worker.scanQueue.end());
+        worker.scanQueue.erase(firstShared, worker.scanQueue.end());
+        mSharedWorkSize = mSharedWork.size();
+    }
+    mSharedWorkAvailable.notify_all();
+}
+bool GC::takeSharedWork(Worker& worker) {
+    std::unique_lock<std::mutex> lock{ mSharedWorkMutex };
+    ++mIdleWorkers;
+    mSharedWorkAvailable.wait(lock, [this] { return !mSharedWork.empty() || mIdleWorkers == mWorkers.size(); });
+    if(mSharedWork.empty()) {
+        // everyone is idle, so no new work can appear anymore
+        lock.unlock();
+        mSharedWorkAvailable.notify_all();
+        return false;
+    }
+    --mIdleWorkers;
+    // leave some work for the other idle workers
+    const auto count = (mSharedWork.size() + 1) / 2;
+    auto firstTaken = mSharedWork.end() - static_cast<ptrdiff_t>(count);
+    worker.scanQueue.insert(worker.scanQueue.end(), firstTaken, mSharedWork.end());
+    mSharedWork.erase(firstTaken, mSharedWork.end());
+    mSharedWorkSize = mSharedWork.size();
+    return true;
+}
+void GC::scanValue(Worker& worker, uint8_t* valuePtr, const PointerMap& map) {
+    const auto& pointerMaps = mVM.getProgram().pointerMaps;
+    if(!map.enumFieldMaps.empty()) {
 #ifdef x86_64_BIT_MODE
         int64_t selectedIndex;
-        memcpy(&selectedIndex, ptr, 8);
+        memcpy(&selectedIndex, valuePtr, 8);
 #else
         int32_t selectedIndex;
-        memcpy(&selectedIndex, ptr, 4);
+        memcpy(&selectedIndex, valuePtr, 4);
 #endif
-        auto &selectedField = type.getEnumInfo().fields.at(selectedIndex);
-        int32_t offset = type.getEnumInfo().getLargestFieldSizePlusIndex();
-        for(auto& element : selectedField.params) {
-            auto elementType = element.completeWithSavedTemplateParameters();
-            offset -= elementType.getSizeOnStack();
-            searchForPtrs(ptr + offset, elementType, scanningHeapOrStack);
-        }
-        break;
+        enqueue(worker, valuePtr, map.enumFieldMaps.at(selectedIndex));
+        return;
     }
-    case DatatypeCategory::pointer: {
-        if(isInOtherRegion(*(uint8_t**)ptr)) {
+    for(auto& entry : map.entries) {
+        uint8_t* ptr = valuePtr + entry.offset;
+        switch(entry.type) {
+        case PointerMap::Entry::Type::List: {
+            // the nodes of the list are copied one after another; their elements are enqueued and scanned later
+            auto** ptrToCurrent = (uint8_t**)ptr;
+            const auto nodeSize = pointerMaps[entry.target].size + 8;
+            while(true) {
+#ifdef x86_64_BIT_MODE
+                assert((uintptr_t)*ptrToCurrent % 8 == 0);
+#endif
+                if(*ptrToCurrent == nullptr)
+                    break;
+                if(isPackedList(*ptrToCurrent)) {
+                    // the elements of packed lists are scalars, so only the chunk needs to be copied and the pointer
+                    // to the next node at its start scanned; it's copied as a whole even if only its end is used
+                    uint8_t* chunk = getPackedListChunk(*ptrToCurrent);
+                    if(shouldSkip(chunk)) {
+                        break;
+                    }
+                    const bool incremental = isInIncrementalFromSpace(chunk);
+                    const auto chunkSize = getPackedListChunkSize(*ptrToCurrent);
+                    const bool copied = evacuate(worker, &chunk, [chunkSize](uint8_t*) { return chunkSize; });
+                    *ptrToCurrent = movePackedList(*ptrToCurrent, chunk);
+                    if(!copied) {
+                        break;
+                    }
+                    if(incremental) {
+                        enqueue(mIncrementalWorker, chunk, mListNodeMaps.at(entry.target));
+                        break;
+                    }
+                    ptrToCurrent = (uint8_t**)chunk;
+                    continue;
+                }
+                if(shouldSkip(*ptrToCurrent)) {
+                    break;
+                }
+                if(isInIncrementalFromSpace(*ptrToCurrent)) {
+                    // the rest of the list is scanned node by node during the next steps of the incremental collection
+                    if(evacuate(worker, ptrToCurrent, [nodeSize](uint8_t*) { return nodeSize; })) {
+                        enqueue(mIncrementalWorker, *ptrToCurrent, mListNodeMaps.at(entry.target));
+                    }
+                    break;
+                }
+                if(!evacuate(worker, ptrToCurrent, [nodeSize](uint8_t*) { return nodeSize; })) {
+                    // the rest of the list is handled by whoever copied this node
+                    break;
+                }
+                enqueue(worker, *ptrToCurrent + 8, entry.target);
+                // continue with the next pointer of the copied node
+                ptrToCurrent = *(uint8_t***)ptrToCurrent;
+            }
             break;
         }
-        if(isInOtherRegion(**(uint8_t***)ptr)) {
-            memcpy(ptr, *(uint8_t**)ptr, 8);
+        case PointerMap::Entry::Type::Function: {
+            int32_t firstHalf;
+            memcpy(&firstHalf, ptr, 4);
+            if(firstHalf % 2 != 0) {
+                // not lambda
+                break;
+            }
+            // it's a lambda
+            auto** lambdaPtr = (uint8_t**)ptr;
+            assert(*lambdaPtr);
+
+            if(shouldSkip(*lambdaPtr)) {
+                break;
+            }
+            auto& lambdaWorker = getWorkerForCopyOf(worker, *lambdaPtr);
+            const bool copied = evacuate(worker, lambdaPtr, [](uint8_t* header) {
+                // the first 4 bytes of the header contain the size of the captured values
+                int32_t sizeOfLambda = -1;
+                memcpy(&sizeOfLambda, &header, 4);
+                assert(sizeOfLambda >= 0);
+                return sizeOfLambda + 16;
+            });
+            if(copied) {
+                int32_t capturedLambdaTypesId;
+                memcpy(&capturedLambdaTypesId, *lambdaPtr + 8, 4);
+                // the captured values are laid out like the helper tuple behind the 16 byte header
+                enqueue(lambdaWorker, *lambdaPtr + 16, mVM.getProgram().auxiliaryDatatypePointerMaps.at(capturedLambdaTypesId));
+            }
             break;
         }
-        searchForPtrs(*(uint8_t**)ptr, type.getPointerBaseType(), ScanningHeapOrStack::Heap);
-        auto newPtr = copyToOther((uint8_t**)ptr, type.getPointerBaseType().getSizeOnStack());
-        memcpy(*(uint8_t**)ptr, &newPtr, 8);
-        memcpy(ptr, &newPtr, 8);
-        break;
-    }
-    case DatatypeCategory::undetermined_identifier:
-        assert(false);
-        return searchForPtrs(ptr, completeTypeUntilNoLongerUndefined(type), scanningHeapOrStack);
-    default:
-        assert(false);
+        case PointerMap::Entry::Type::Enum:
+            enqueue(worker, ptr, entry.target);
+            break;
+        case PointerMap::Entry::Type::Pointer: {
+            auto** pointer = (uint8_t**)ptr;
+            if(shouldSkip(*pointer)) {
+                break;
+            }
+            const auto size = pointerMaps[entry.target].size;
+            auto& pointerWorker = getWorkerForCopyOf(worker, *pointer);
+            if(evacuate(worker, pointer, [size](uint8_t*) { return size; })) {
+                enqueue(pointerWorker, *pointer, entry.target);
+            }
+            break;
+        }
+        case PointerMap::Entry::Type::Bytes: {
+            // slices share the buffer, so they all end up pointing to the same copy
+            auto** buffer = (uint8_t**)ptr;
+            if(*buffer == nullptr || shouldSkip(*buffer)) {
+                break;
+            }
+            evacuate(worker, buffer, [](uint8_t* header) { return getBytesBufferSize((const uint8_t*)&header); });
+            break;
+        }
+        }
     }
 }
 void GC::requestCollection() {
     mFunctionCallsSinceLastRun++;
-    if(mFunctionCallsSinceLastRun > mConfigFunctionsCallsPerGCRun) {
+    if(mIncrementalCollectionRunning && ++mFunctionCallsSinceLastIncrement >= FUNCTION_CALLS_PER_INCREMENT && !mIncrementalWorker.scanQueue.empty()) {
+        // finishing requires collecting the nursery, so that's left to the next regular collection
+        mFunctionCallsSinceLastIncrement = 0;
+        const auto pauseStart = std::chrono::steady_clock::now();
+        mBytesCopied = 0;
+        performIncrementalStep(pauseStart);
+        recordCollection(GCStatistics::Collection::Type::IncrementalStep, pauseStart, 0);
+    }
+    const bool enoughAllocated = mAllocationArea.top >= mCollectionTrigger || !mOverflowChunks.empty();
+    if(enoughAllocated || mFunctionCallsSinceLastRun > mConfigFunctionsCallsPerGCRun) {
         performGarbageCollection();
         mFunctionCallsSinceLastRun = 0;
     }
@@ -249,7 +708,21 @@ GC::Region& GC::getActiveRegion() {
 GC::Region& GC::getOtherRegion() {
     return mRegions[!mActiveRegion];
 }
-bool GC::isInOtherRegion(uint8_t* ptr) {
-    return ptr >= getOtherRegion().base && ptr < getOtherRegion().top() && (uintptr_t)ptr % 2 == 0;
+bool GC::isInToSpace(uint8_t* ptr) {
+    // in parallel collections, the other workers copy objects into the whole rest of the to-space
+    auto* end = isParallel() ? mToRegion->base + mToRegion->size : mToRegion->top();
+    return ptr >= mToRegion->base + mToRegionStart && ptr < end && (uintptr_t)ptr % 2 == 0;
+}
+bool GC::shouldSkip(uint8_t* ptr) {
+    if(isInConstantArea(ptr)) {
+        return true;
+    }
+    if(mCollectionType == CollectionType::Major) {
+        return isInToSpace(ptr);
+    }
+    // the region of the tenured objects also contains the survivors of this collection; while an incremental
+    // collection is running, this is the other region and the objects of the active region are copied to it
+    auto& tenuredRegion = mIncrementalCollectionRunning ? getOtherRegion() : getActiveRegion();
+    return ptr >= tenuredRegion.base && ptr < tenuredRegion.base + tenuredRegion.size;
 }
 }
@@ -0,0 +1,39 @@
+#include "samal_lib/NativeCallFrame.hpp"
+#include "samal_lib/ExternalVMValue.hpp"
+#include "samal_lib/Program.hpp"
+
+namespace samal {
+
+NativeCallFrame::NativeCallFrame(VM& vm, const NativeFunction& function, const int32_t* paramOffsets, const uint8_t* params, uint8_t* returnValue)
+: mVM(vm), mFunction(function), mParamOffsets(paramOffsets), mParams(params), mReturnValue(returnValue) {
+}
+size_t NativeCallFrame::getArgCount() const {
+    return mFunction.functionType.getFunctionTypeInfo().second.size();
+}
+const Datatype& NativeCallFrame::getArgType(size_t index) const {
+    return mFunction.functionType.getFunctionTypeInfo().second.at(index);
+}
+ExternalVMValue NativeCallFrame::argValue(size_t index) const {
+    return ExternalVMValue::wrapFromPtr(getArgType(index), mVM, getArgPtr(index));
+}
+const Datatype& NativeCallFrame::getReturnType() const {
+    return mFunction.functionType.getFunctionTypeInfo().first;
+}
+void NativeCallFrame::setReturn(const ExternalVMValue& value) {
+    assert(value.getDatatype() == getReturnType());
+    auto bytes = value.toStackValue(mVM);
+    if(!bytes.empty())
+        memcpy(mReturnValue, bytes.data(), bytes.size());
+}
+std::function<void(NativeCallFrame&)> NativeCallFrame::adapt(std::function<ExternalVMValue(VM&, const std::vector<ExternalVMValue>&)> callback) {
+    return [callback = std::move(callback)](NativeCallFrame& frame) {
+        std::vector<ExternalVMValue> params;
+        params.reserve(frame.getArgCount());
+        for(size_t i = 0; i < frame.getArgCount(); ++i) {
+            params.emplace_back(frame.argValue(i));
+        }
+        frame.setReturn(callback(frame.getVM(), params));
+    };
+}
+
+}
@@ -125,7 +125,7 @@ Parser::Parser() {
         }
         return IdentifierNode{ toRef(res), baseIdentifier->getNameSplit(),  std::move(templateParameters)};
     };
-    mPegParser["Datatype"] << "('fn' '(' DatatypeVector ')' '->' Datatype) | '[' Datatype ']' | 'i32' | 'i64' | 'bool' | 'byte' | 'char' | IdentifierWithTemplate | '(' Datatype ')' | '(' DatatypeVector ')' | ('$' Datatype)" >> [](peg::MatchInfo& res) -> peg::Any {
+    mPegParser["Datatype"] << "('fn' '(' DatatypeVector ')' '->' Datatype) | '[' Datatype ']' | 'i32' | 'i64' | 'bool' | 'bytes' | 'byte' | 'char' | IdentifierWithTemplate | '(' Datatype ')' | '(' DatatypeVector ')' | ('$' Datatype)" >> [](peg::MatchInfo& res) -> peg::Any {
         switch(*res.choice) {
         case 0:
             return Datatype::createFunctionType(res[0][5].result.moveValue<Datatype>(), res[0][2].result.moveValue<std::vector<Datatype>>());
@@ -138,18 +138,20 @@ Parser::Parser() {
         case 4:
             return Datatype::createSimple(DatatypeCategory::bool_);
         case 5:
-            return Datatype::createSimple(DatatypeCategory::byte);
+            return Datatype::createSimple(DatatypeCategory::bytes);
         case 6:
+            return Datatype::createSimple(DatatypeCategory::byte);
+        case 7:
             return Datatype::createSimple(DatatypeCategory::char_);
-        case 7: {
+        case 8: {
             up<IdentifierNode> identifier{ res[0].result.move<IdentifierNode*>() };
             return Datatype::createUndeterminedIdentifierType(*identifier);
         }
-        case 8:
-            return res[0][1].result.moveValue<Datatype>();
         case 9:
-            return Datatype::createTupleType(res[0][1].result.moveValue<std::vector<Datatype>>());
+            return res[0][1].result.moveValue<Datatype>();
         case 10:
+            return Datatype::createTupleType(res[0][1].result.moveValue<std::vector<Datatype>>());
+        case 11:
             return Datatype::createPointerType(res[0][1].result.moveValue<Datatype>());
         default:
             assert(false);
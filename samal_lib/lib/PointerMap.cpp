@@ -0,0 +1,108 @@
+#include "samal_lib/PointerMap.hpp"
+#include "samal_lib/EnumField.hpp"
+
+namespace samal {
+
+PointerMapBuilder::PointerMapBuilder(std::vector<PointerMap>& maps)
+: mMaps(maps) {
+}
+int32_t PointerMapBuilder::findInCache(const std::vector<std::pair<Datatype, int32_t>>& cache, const Datatype& type) {
+    for(auto& [cachedType, index] : cache) {
+        if(cachedType == type) {
+            return index;
+        }
+    }
+    return -1;
+}
+int32_t PointerMapBuilder::getIndex(const Datatype& type) {
+    if(type.getCategory() == DatatypeCategory::undetermined_identifier) {
+        return getIndex(completeTypeUntilNoLongerUndefined(type));
+    }
+    auto cached = findInCache(mCache, type);
+    if(cached >= 0) {
+        return cached;
+    }
+    // the index is reserved before flattening as types can contain themselves through lists and pointers
+    auto index = static_cast<int32_t>(mMaps.size());
+    mMaps.emplace_back();
+    mCache.emplace_back(type, index);
+    std::vector<PointerMap::Entry> entries;
+    flatten(type, 0, entries);
+    mMaps.at(index).size = type.getSizeOnStack();
+    mMaps.at(index).entries = std::move(entries);
+    return index;
+}
+int32_t PointerMapBuilder::getEnumIndex(const Datatype& type) {
+    auto cached = findInCache(mEnumCache, type);
+    if(cached >= 0) {
+        return cached;
+    }
+    auto index = static_cast<int32_t>(mMaps.size());
+    mMaps.emplace_back();
+    mEnumCache.emplace_back(type, index);
+    std::vector<int32_t> enumFieldMaps;
+    for(auto& field : type.getEnumInfo().fields) {
+        std::vector<PointerMap::Entry> entries;
+        int32_t offset = type.getEnumInfo().getLargestFieldSizePlusIndex();
+        for(auto& param : field.params) {
+            auto paramType = param.completeWithSavedTemplateParameters();
+            offset -= paramType.getSizeOnStack();
+            flatten(paramType, offset, entries);
+        }
+        enumFieldMaps.push_back(static_cast<int32_t>(mMaps.size()));
+        mMaps.emplace_back(PointerMap{ .size = 0, .entries = std::move(entries) });
+    }
+    mMaps.at(index).size = type.getSizeOnStack();
+    mMaps.at(index).enumFieldMaps = std::move(enumFieldMaps);
+    return index;
+}
+void PointerMapBuilder::flatten(const Datatype& type, int32_t offset, std::vector<PointerMap::Entry>& entries) {
+    switch(type.getCategory()) {
+    case DatatypeCategory::bool_:
+    case DatatypeCategory::i32:
+    case DatatypeCategory::i64:
+    case DatatypeCategory::f64:
+    case DatatypeCategory::char_:
+    case DatatypeCategory::byte:
+        break;
+    case DatatypeCategory::tuple: {
+        int32_t elementOffset = offset + type.getSizeOnStack();
+        for(auto& element : type.getTupleInfo()) {
+            elementOffset -= element.getSizeOnStack();
+            flatten(element, elementOffset, entries);
+        }
+        break;
+    }
+    case DatatypeCategory::struct_: {
+        int32_t fieldOffset = offset + type.getSizeOnStack();
+        for(auto& field : type.getStructInfo().fields) {
+            auto fieldType = field.type.completeWithSavedTemplateParameters();
+            fieldOffset -= fieldType.getSizeOnStack();
+            flatten(fieldType, fieldOffset, entries);
+        }
+        break;
+    }
+    case DatatypeCategory::list:
+        entries.push_back(PointerMap::Entry{ .type = PointerMap::Entry::Type::List, .offset = offset, .target = getIndex(type.getListContainedType()) });
+        break;
+    case DatatypeCategory::pointer:
+        entries.push_back(PointerMap::Entry{ .type = PointerMap::Entry::Type::Pointer, .offset = offset, .target = getIndex(type.getPointerBaseType()) });
+        break;
+    case DatatypeCategory::function:
+        entries.push_back(PointerMap::Entry{ .type = PointerMap::Entry::Type::Function, .offset = offset });
+        break;
+    case DatatypeCategory::bytes:
+        entries.push_back(PointerMap::Entry{ .type = PointerMap::Entry::Type::Bytes, .offset = offset });
+        break;
+    case DatatypeCategory::enum_:
+        entries.push_back(PointerMap::Entry{ .type = PointerMap::Entry::Type::Enum, .offset = offset, .target = getEnumIndex(type) });
+        break;
+    case DatatypeCategory::undetermined_identifier:
+        flatten(completeTypeUntilNoLongerUndefined(type), offset, entries);
+        break;
+    default:
+        todo();
+    }
+}
+
+}
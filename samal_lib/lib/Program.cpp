@@ -1,6 +1,7 @@
 #include "samal_lib/Program.hpp"
 #include "samal_lib/Instruction.hpp"
 #include "samal_lib/StackInformationTree.hpp"
+#include <algorithm>
 
 namespace samal {
 
@@ -35,6 +36,10 @@ std::string Program::disassemble() const {
                 ret += " ";
                 ret += std::to_string(*reinterpret_cast<const int32_t*>(&code.at(offset + 5)));
             }
+            if(width >= 13) {
+                ret += " ";
+                ret += std::to_string(*reinterpret_cast<const int32_t*>(&code.at(offset + 9)));
+            }
             ret += "\n";
             offset += width;
         }
@@ -46,4 +51,13 @@ std::string Program::disassemble() const {
     ret += "\n";
     return ret;
 }
+const StackMap* Program::findStackMap(int32_t ip) const {
+    auto it = std::lower_bound(stackMaps.cbegin(), stackMaps.cend(), ip, [](const StackMap& map, int32_t ip) {
+        return map.ip < ip;
+    });
+    if(it == stackMaps.cend() || it->ip != ip) {
+        return nullptr;
+    }
+    return &*it;
+}
 }
\ No newline at end of file
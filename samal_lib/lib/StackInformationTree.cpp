@@ -4,8 +4,8 @@ namespace samal {
 StackInformationTree::StackInformationTree(int32_t startIp, int32_t totalStackSize, IsAtPopInstruction isAtPop)
 : mStartIp(startIp), mTotalStackSize(totalStackSize), mIsAtPopInstruction(isAtPop) {
 }
-StackInformationTree::StackInformationTree(int32_t startIp, int32_t totalStackSize, std::string name, Datatype datatype, StorageType storageType)
-: mStartIp(startIp), mTotalStackSize(totalStackSize), mVariable(VariableEntry{ .name = std::move(name), .datatype = std::move(datatype), .storageType = storageType }) {
+StackInformationTree::StackInformationTree(int32_t startIp, int32_t totalStackSize, std::string name, Datatype datatype, int32_t pointerMapIndex, StorageType storageType)
+: mStartIp(startIp), mTotalStackSize(totalStackSize), mVariable(VariableEntry{ .name = std::move(name), .datatype = std::move(datatype), .pointerMapIndex = pointerMapIndex, .storageType = storageType }) {
 }
 StackInformationTree* StackInformationTree::addChild(up<StackInformationTree> child) {
     if(!mChildren.empty()) {
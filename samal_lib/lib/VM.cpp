@@ -1,15 +1,48 @@
 #include "samal_lib/VM.hpp"
 #include "samal_lib/ExternalVMValue.hpp"
 #include "samal_lib/Instruction.hpp"
+#include "samal_lib/List.hpp"
+#include "samal_lib/NativeCallFrame.hpp"
 #include "samal_lib/StackInformationTree.hpp"
 #include "samal_lib/Util.hpp"
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstddef>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
+#include <limits>
 
 namespace samal {
 
+static bool isRawNativeCallbackScalar(const Datatype& type) {
+    switch(type.getCategory()) {
+    case DatatypeCategory::i32:
+    case DatatypeCategory::i64:
+    case DatatypeCategory::f64:
+    case DatatypeCategory::char_:
+    case DatatypeCategory::bool_:
+    case DatatypeCategory::byte:
+        return true;
+    default:
+        return false;
+    }
+}
+// see RawNativeCallback
+static bool canUseRawNativeCallback(const Datatype& functionType) {
+    const auto& [returnType, paramTypes] = functionType.getFunctionTypeInfo();
+    if(paramTypes.size() > NativeFunction::MAX_RAW_CALLBACK_PARAMS) {
+        return false;
+    }
+    for(auto& param : paramTypes) {
+        if(!isRawNativeCallbackScalar(param)) {
+            return false;
+        }
+    }
+    return isRawNativeCallbackScalar(returnType) || returnType == Datatype::createEmptyTuple();
+}
+
 #ifdef SAMAL_ENABLE_JIT
 struct JitReturn {
     int32_t ip;                   // lower 4 bytes of rax
@@ -17,10 +50,98 @@ struct JitReturn {
     int32_t nativeFunctionToCall; // lower 4 bytes of rdx
 };
 
+// Called by the JIT if the inline bump allocation fails because the active region is full
+static uint8_t* jitAllocSlowPath(GC* gc, int32_t size) {
+    return gc->alloc(size);
+}
+// Called by the JIT for COMPARE_COMPLEX_EQUALITY, returns a full 64 bit bool
+static int64_t jitCompareComplexEquality(const EqualityComparator* comparator, const uint8_t* lhs, const uint8_t* rhs) {
+    return comparator->equals(lhs, rhs);
+}
+
+// Returns whether the JIT can compile the instruction; all other instructions exit the native code
+static bool isInstructionJittable(Instruction ins) {
+    switch(ins) {
+    case Instruction::PUSH_8:
+    case Instruction::LOAD_CONSTANT_LIST:
+    case Instruction::POP_N_BELOW:
+    case Instruction::ADD_I32:
+    case Instruction::SUB_I32:
+    case Instruction::MUL_I32:
+    case Instruction::DIV_I32:
+    case Instruction::MODULO_I32:
+    case Instruction::COMPARE_LESS_THAN_I32:
+    case Instruction::COMPARE_MORE_THAN_I32:
+    case Instruction::COMPARE_LESS_EQUAL_THAN_I32:
+    case Instruction::COMPARE_MORE_EQUAL_THAN_I32:
+    case Instruction::COMPARE_EQUALS_I32:
+    case Instruction::COMPARE_NOT_EQUALS_I32:
+    case Instruction::ADD_I64:
+    case Instruction::SUB_I64:
+    case Instruction::MUL_I64:
+    case Instruction::DIV_I64:
+    case Instruction::MODULO_I64:
+    case Instruction::COMPARE_LESS_THAN_I64:
+    case Instruction::COMPARE_MORE_THAN_I64:
+    case Instruction::COMPARE_LESS_EQUAL_THAN_I64:
+    case Instruction::COMPARE_MORE_EQUAL_THAN_I64:
+    case Instruction::COMPARE_EQUALS_I64:
+    case Instruction::COMPARE_NOT_EQUALS_I64:
+    case Instruction::LOGICAL_OR:
+    case Instruction::LOGICAL_NOT:
+    case Instruction::LOGICAL_AND:
+    case Instruction::JUMP_IF_FALSE:
+    case Instruction::JUMP:
+    case Instruction::REPUSH_FROM_N:
+    case Instruction::RETURN:
+    case Instruction::CALL:
+    case Instruction::LOAD_FROM_PTR:
+    case Instruction::LIST_GET_TAIL:
+    case Instruction::IS_LIST_EMPTY:
+    case Instruction::RUN_GC:
+    case Instruction::NOOP:
+    case Instruction::ADD_I32_CONSTANT:
+    case Instruction::SUB_I32_CONSTANT:
+    case Instruction::MUL_I32_CONSTANT:
+    case Instruction::DIV_I32_CONSTANT:
+    case Instruction::ADD_I64_CONSTANT:
+    case Instruction::SUB_I64_CONSTANT:
+    case Instruction::MUL_I64_CONSTANT:
+    case Instruction::DIV_I64_CONSTANT:
+    case Instruction::COMPARE_LESS_THAN_I32_AND_JUMP_IF_FALSE:
+    case Instruction::COMPARE_MORE_THAN_I32_AND_JUMP_IF_FALSE:
+    case Instruction::COMPARE_LESS_EQUAL_THAN_I32_AND_JUMP_IF_FALSE:
+    case Instruction::COMPARE_MORE_EQUAL_THAN_I32_AND_JUMP_IF_FALSE:
+    case Instruction::COMPARE_EQUALS_I32_AND_JUMP_IF_FALSE:
+    case Instruction::COMPARE_NOT_EQUALS_I32_AND_JUMP_IF_FALSE:
+    case Instruction::COMPARE_LESS_THAN_I64_AND_JUMP_IF_FALSE:
+    case Instruction::COMPARE_MORE_THAN_I64_AND_JUMP_IF_FALSE:
+    case Instruction::COMPARE_LESS_EQUAL_THAN_I64_AND_JUMP_IF_FALSE:
+    case Instruction::COMPARE_MORE_EQUAL_THAN_I64_AND_JUMP_IF_FALSE:
+    case Instruction::COMPARE_EQUALS_I64_AND_JUMP_IF_FALSE:
+    case Instruction::COMPARE_NOT_EQUALS_I64_AND_JUMP_IF_FALSE:
+    case Instruction::IS_LIST_EMPTY_AND_JUMP_IF_FALSE:
+    case Instruction::REPUSH_AND_LOAD_FROM_PTR:
+    case Instruction::CREATE_LIST:
+    case Instruction::LIST_PREPEND:
+    case Instruction::CREATE_STRUCT_OR_ENUM:
+    case Instruction::CREATE_LAMBDA:
+    case Instruction::COMPARE_COMPLEX_EQUALITY:
+        return true;
+    default:
+        break;
+    }
+    return false;
+}
+
+// Native code for the instructions in [beginIp, endIp) of the program, either the whole program or a single function.
+// Leaving this range (e.g. by calling or returning to another function) exits the code like an unjittable instruction.
 class JitCode : public Xbyak::CodeGenerator {
 public:
-    explicit JitCode(const std::vector<uint8_t>& instructions)
+    explicit JitCode(const Program& program, int32_t beginIp, int32_t endIp, bool registerAllocation, GC& gc, const std::vector<up<EqualityComparator>>& equalityComparators)
     : Xbyak::CodeGenerator(4096 * 4, Xbyak::AutoGrow) {
+        const auto& instructions = program.code;
+        const bool coversWholeProgram = beginIp == 0 && endIp == static_cast<int32_t>(instructions.size());
         setDefaultJmpNEAR(true);
         // prelude
         push(rbx);
@@ -63,109 +184,643 @@ public:
         std::vector<std::pair<int32_t, Xbyak::Label>> instructionLocationLabels;
         std::vector<std::pair<up<Xbyak::Label>, int32_t>> directJumpLocationLabels;
         auto jumpWithIp = [&] {
-            jmp(ptr[tableRegister + ip * sizeof(void*)]);
+            if(!coversWholeProgram) {
+                // the jump table only contains [beginIp, endIp]
+                cmp(ip, beginIp);
+                jl("AfterJumpTable");
+                cmp(ip, endIp);
+                jg("AfterJumpTable");
+            }
+            jmp(ptr[tableRegister + ip * sizeof(void*) - beginIp * static_cast<int32_t>(sizeof(void*))]);
         };
         auto isInstructionAtIpJittable = [&](int32_t ip) -> bool {
-            auto ins = static_cast<Instruction>(instructions.at(ip));
+            if(ip < beginIp || ip >= endIp) {
+                return false;
+            }
+            return isInstructionJittable(static_cast<Instruction>(instructions.at(ip)));
+        };
+        // Jumps to newIp if the condition is met by the flags of the last cmp/test; clobbers rbx
+        auto jumpToIpIf = [&](Condition condition, int32_t newIp) {
+            mov(rbx, newIp);
+            switch(condition) {
+            case Condition::Equal:
+                cmove(ip, rbx);
+                break;
+            case Condition::NotEqual:
+                cmovne(ip, rbx);
+                break;
+            case Condition::Less:
+                cmovl(ip, rbx);
+                break;
+            case Condition::LessEqual:
+                cmovle(ip, rbx);
+                break;
+            case Condition::Greater:
+                cmovg(ip, rbx);
+                break;
+            case Condition::GreaterEqual:
+                cmovge(ip, rbx);
+                break;
+            }
+            auto conditionalJump = [&](const auto& target) {
+                switch(condition) {
+                case Condition::Equal:
+                    je(target);
+                    break;
+                case Condition::NotEqual:
+                    jne(target);
+                    break;
+                case Condition::Less:
+                    jl(target);
+                    break;
+                case Condition::LessEqual:
+                    jle(target);
+                    break;
+                case Condition::Greater:
+                    jg(target);
+                    break;
+                case Condition::GreaterEqual:
+                    jge(target);
+                    break;
+                }
+            };
+            // If the instruction at the desired ip is jittable, then we can just jump to it directly without using the jump table.
+            // If it is not jittable, it's even easier as we can just pass execution back to the interpreter
+            if(isInstructionAtIpJittable(newIp)) {
+                // try to find the label in already compiled code
+                for(auto& instructionJumpLabel: instructionLocationLabels) {
+                    if(instructionJumpLabel.first == newIp) {
+                        conditionalJump(instructionJumpLabel.second);
+                        return;
+                    }
+                }
+
+                // create a new label and assign it as soon as we compile the code
+                auto label = std::make_unique<Xbyak::Label>();
+                conditionalJump(*label);
+                directJumpLocationLabels.emplace_back(std::make_pair(std::move(label), newIp));
+            } else {
+                conditionalJump("AfterJumpTable");
+            }
+        };
+        // Jumps to newIp unconditionally; ip needs to be set already
+        auto jumpToIp = [&](int32_t newIp) {
+            if(!isInstructionAtIpJittable(newIp)) {
+                jmp("AfterJumpTable");
+                return;
+            }
+            // try to find the label in already compiled code
+            for(auto& instructionJumpLabel: instructionLocationLabels) {
+                if(instructionJumpLabel.first == newIp) {
+                    jmp(instructionJumpLabel.second);
+                    return;
+                }
+            }
+
+            // create a new label and assign it as soon as we compile the instruction
+            auto label = std::make_unique<Xbyak::Label>();
+            jmp(*label);
+            directJumpLocationLabels.emplace_back(std::make_pair(std::move(label), newIp));
+        };
+        // condition under which COMPARE_*_AND_JUMP_IF_FALSE jumps after comparing lhs with rhs
+        auto getJumpIfFalseCondition = [](Instruction ins) {
+            switch(ins) {
+            case Instruction::COMPARE_LESS_THAN_I32_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_LESS_THAN_I64_AND_JUMP_IF_FALSE:
+                return Condition::GreaterEqual;
+            case Instruction::COMPARE_MORE_THAN_I32_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_MORE_THAN_I64_AND_JUMP_IF_FALSE:
+                return Condition::LessEqual;
+            case Instruction::COMPARE_LESS_EQUAL_THAN_I32_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_LESS_EQUAL_THAN_I64_AND_JUMP_IF_FALSE:
+                return Condition::Greater;
+            case Instruction::COMPARE_MORE_EQUAL_THAN_I32_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_MORE_EQUAL_THAN_I64_AND_JUMP_IF_FALSE:
+                return Condition::Less;
+            case Instruction::COMPARE_EQUALS_I32_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_EQUALS_I64_AND_JUMP_IF_FALSE:
+                return Condition::NotEqual;
+            default:
+                return Condition::Equal;
+            }
+        };
+
+        // size of r8-r11, which emitCall pushes before loadArguments runs
+        constexpr int32_t EMIT_CALL_SAVED_BYTES = 4 * 8;
+        // Calls a C++ function with the arguments that are already in rdi, rsi and rdx or are loaded by loadArguments,
+        // which runs after r8-r11 have been pushed; the result is in rax.
+        // Clobbers rbx and all caller-saved registers except for the ones we need to keep (r8-r11).
+        // This includes rsi, rdi and rcx, which hold cached stack slots with register allocation (see
+        // allocatableRegisters), so every caller must call flushCachedSlots() before emitting a call.
+        auto emitCall = [&](size_t function, const std::function<void()>& loadArguments = nullptr) {
+            push(r8);
+            push(r9);
+            push(r10);
+            push(r11);
+            if(loadArguments) {
+                loadArguments();
+            }
+            // rbx is callee-saved, so we can use it to restore the unaligned stack pointer
+            mov(rbx, rsp);
+            and_(rsp, -16);
+            mov(rax, function);
+            call(rax);
+            mov(rsp, rbx);
+            pop(r11);
+            pop(r10);
+            pop(r9);
+            pop(r8);
+        };
+        // Replaces the non-empty list in reg by a pointer that has the head at offset 8, see getListNode(); clobbers rbx
+        auto emitGetListNode = [&](const Xbyak::Reg64& reg) {
+            Xbyak::Label regularNode;
+            mov(rbx, reg);
+            shr(rbx, 48);
+            test(rbx, rbx);
+            je(regularNode);
+            // remove the tag of the packed list
+            shl(reg, 16);
+            shr(reg, 16);
+            sub(reg, 8);
+            L(regularNode);
+        };
+        // Replaces the non-empty list in reg by its tail, see getListTail(); clobbers rax and rbx.
+        // All elements of packed lists are 8 bytes as every stack slot is.
+        auto emitGetListTail = [&](const Xbyak::Reg64& reg) {
+            assert(reg.getIdx() != rax.getIdx() && reg.getIdx() != rbx.getIdx());
+            Xbyak::Label regularNode, lastInChunk, done;
+            mov(rbx, reg);
+            shr(rbx, 48);
+            test(rbx, rbx);
+            je(regularNode);
+            // more than one element left in the chunk: increment the index and decrement the remaining elements
+            test(ebx, 126 << 7);
+            je(lastInChunk);
+            mov(rax, 8 + (uint64_t{ 1 } << 48) - (uint64_t{ 1 } << 55));
+            add(reg, rax);
+            jmp(done);
+            L(lastInChunk);
+            // the pointer to the next node is at the start of the chunk
+            and_(ebx, 127);
+            shl(rbx, 3);
+            shl(reg, 16);
+            shr(reg, 16);
+            sub(reg, rbx);
+            mov(reg, qword[reg - 8]);
+            jmp(done);
+            L(regularNode);
+            mov(reg, qword[reg]);
+            L(done);
+        };
+        // Allocates size bytes on the heap and puts the pointer into rax; clobbers the same registers as emitCall().
+        // The fast path bumps the top pointer of the allocation area inline, only if it's full we call into
+        // GC::alloc() which then continues in a new overflow chunk.
+        auto emitAlloc = [&](int32_t size) {
+            // same rounding as GC::alloc()
+            size = gc.getAllocationSize(size);
+            Xbyak::Label slowPath, done;
+            mov(rdx, (size_t)gc.getAllocationArea());
+            mov(rax, qword[rdx + offsetof(GC::AllocationArea, top)]);
+            lea(rbx, qword[rax + size]);
+            cmp(rbx, qword[rdx + offsetof(GC::AllocationArea, end)]);
+            ja(slowPath);
+            mov(qword[rdx + offsetof(GC::AllocationArea, top)], rbx);
+            jmp(done);
+
+            L(slowPath);
+            mov(rdi, (size_t)&gc);
+            mov(esi, size);
+            emitCall((size_t)&jitAllocSlowPath);
+            L(done);
+        };
+        // Copies len bytes from the stack (starting at rsp + stackOffset) to the allocation in rax; clobbers rbx
+        auto emitCopyFromStack = [&](int32_t heapOffset, int32_t stackOffset, int32_t len) {
+            assert(len % 8 == 0);
+            for(int32_t j = 0; j < len; j += 8) {
+                mov(rbx, qword[rsp + (stackOffset + j)]);
+                mov(qword[rax + (heapOffset + j)], rbx);
+            }
+        };
+
+        // If register allocation is enabled, the topmost slots of the samal stack are kept in registers within a basic block
+        // instead of being pushed onto the real stack. cachedSlots.back() holds the topmost slot, the slots below
+        // cachedSlots.front() are on the real stack. Everything that needs the real stack to be complete (block boundaries,
+        // calls, the GC, exits to the interpreter) pushes the cached slots with flushCachedSlots() first.
+        // Only the start of a basic block gets an entry in the jump table, as we can only enter the code where nothing is cached.
+        // All callee-saved registers except rbp are already taken (rbx is the scratch register, r12-r15 hold the state of
+        // the VM), so rsi, rdi and rcx are caller-saved. They are only safe because nothing is cached across emitCall().
+        const Xbyak::Reg64 allocatableRegisters[] = { rbp, rsi, rdi, rcx };
+        std::vector<Xbyak::Reg64> cachedSlots;
+        auto findFreeRegister = [&]() -> const Xbyak::Reg64* {
+            for(auto& reg : allocatableRegisters) {
+                bool used = false;
+                for(auto& cached : cachedSlots) {
+                    if(cached.getIdx() == reg.getIdx()) {
+                        used = true;
+                        break;
+                    }
+                }
+                if(!used) {
+                    return &reg;
+                }
+            }
+            return nullptr;
+        };
+        // pushes all cached slots onto the real stack without changing cachedSlots, e.g. for exits that are only taken conditionally
+        auto emitPushCachedSlots = [&] {
+            for(auto& reg : cachedSlots) {
+                push(reg);
+            }
+        };
+        auto flushCachedSlots = [&] {
+            emitPushCachedSlots();
+            cachedSlots.clear();
+        };
+        // returns the register for a new topmost slot; if no register is free, the deepest cached slot is spilled
+        auto allocateSlot = [&]() -> Xbyak::Reg64 {
+            if(auto* reg = findFreeRegister()) {
+                cachedSlots.push_back(*reg);
+                return *reg;
+            }
+            auto reg = cachedSlots.front();
+            push(reg);
+            cachedSlots.erase(cachedSlots.begin());
+            cachedSlots.push_back(reg);
+            return reg;
+        };
+        // makes sure that the topmost count slots are in registers
+        auto loadSlotsIntoRegisters = [&](size_t count) {
+            assert(count <= sizeof(allocatableRegisters) / sizeof(allocatableRegisters[0]));
+            while(cachedSlots.size() < count) {
+                auto reg = *findFreeRegister();
+                pop(reg);
+                cachedSlots.insert(cachedSlots.begin(), reg);
+            }
+        };
+        auto loadSlot = [&](const Xbyak::Reg64& destination, int32_t offsetFromTop) {
+            assert(offsetFromTop % 8 == 0);
+            auto slotIndex = static_cast<size_t>(offsetFromTop / 8);
+            if(slotIndex < cachedSlots.size()) {
+                mov(destination, cachedSlots.at(cachedSlots.size() - 1 - slotIndex));
+            } else {
+                mov(destination, qword[rsp + (offsetFromTop - 8 * static_cast<int32_t>(cachedSlots.size()))]);
+            }
+        };
+        // pops the topmost two slots (rhs) and returns them together with the slot below, which receives the result (lhs)
+        auto binaryOperands = [&]() -> std::pair<Xbyak::Reg64, Xbyak::Reg64> {
+            loadSlotsIntoRegisters(2);
+            auto rhs = cachedSlots.back();
+            cachedSlots.pop_back();
+            return { cachedSlots.back(), rhs };
+        };
+        auto topSlot = [&]() -> Xbyak::Reg64 {
+            loadSlotsIntoRegisters(1);
+            return cachedSlots.back();
+        };
+        // emits the instruction using cachedSlots; returns false if the instruction needs the real stack
+        auto emitWithRegisters = [&](Instruction ins, int32_t i) -> bool {
             switch(ins) {
             case Instruction::PUSH_8:
-            case Instruction::POP_N_BELOW:
-            case Instruction::ADD_I32:
-            case Instruction::SUB_I32:
-            case Instruction::MUL_I32:
+                mov(allocateSlot(), *(uint64_t*)&instructions.at(i + 1));
+                return true;
+            case Instruction::LOAD_CONSTANT_LIST:
+                mov(allocateSlot(), (uint64_t)gc.getConstantList(*(int32_t*)&instructions.at(i + 1)));
+                return true;
+            case Instruction::REPUSH_FROM_N: {
+                int32_t repushLen = *(int32_t*)&instructions.at(i + 1);
+                int32_t repushOffset = *(int32_t*)&instructions.at(i + 5);
+                if(repushLen != 8) {
+                    return false;
+                }
+                auto reg = allocateSlot();
+                // the slot we want to copy is now one further down
+                loadSlot(reg, repushOffset + 8);
+                return true;
+            }
+            case Instruction::POP_N_BELOW: {
+                int32_t popLen = *(int32_t*)&instructions.at(i + 1);
+                int32_t popOffset = *(int32_t*)&instructions.at(i + 5);
+                if(static_cast<size_t>((popOffset + popLen) / 8) > cachedSlots.size()) {
+                    return false;
+                }
+                // the slots are only in registers, so we just forget about them
+                auto end = cachedSlots.end() - popOffset / 8;
+                cachedSlots.erase(end - popLen / 8, end);
+                return true;
+            }
+            case Instruction::ADD_I32: {
+                auto [lhs, rhs] = binaryOperands();
+                add(lhs.cvt32(), rhs.cvt32());
+                return true;
+            }
+            case Instruction::SUB_I32: {
+                auto [lhs, rhs] = binaryOperands();
+                sub(lhs.cvt32(), rhs.cvt32());
+                return true;
+            }
+            case Instruction::MUL_I32: {
+                auto [lhs, rhs] = binaryOperands();
+                imul(lhs.cvt32(), rhs.cvt32());
+                return true;
+            }
             case Instruction::DIV_I32:
-            case Instruction::MODULO_I32:
+            case Instruction::MODULO_I32: {
+                auto [lhs, rhs] = binaryOperands();
+                mov(eax, lhs.cvt32());
+                cdq();
+                idiv(rhs.cvt32());
+                mov(lhs.cvt32(), ins == Instruction::DIV_I32 ? eax : edx);
+                return true;
+            }
+            case Instruction::ADD_I64: {
+                auto [lhs, rhs] = binaryOperands();
+                add(lhs, rhs);
+                return true;
+            }
+            case Instruction::SUB_I64: {
+                auto [lhs, rhs] = binaryOperands();
+                sub(lhs, rhs);
+                return true;
+            }
+            case Instruction::MUL_I64: {
+                auto [lhs, rhs] = binaryOperands();
+                imul(lhs, rhs);
+                return true;
+            }
+            case Instruction::DIV_I64:
+            case Instruction::MODULO_I64: {
+                auto [lhs, rhs] = binaryOperands();
+                mov(rax, lhs);
+                cqo();
+                idiv(rhs);
+                mov(lhs, ins == Instruction::DIV_I64 ? rax : rdx);
+                return true;
+            }
             case Instruction::COMPARE_LESS_THAN_I32:
             case Instruction::COMPARE_MORE_THAN_I32:
             case Instruction::COMPARE_LESS_EQUAL_THAN_I32:
             case Instruction::COMPARE_MORE_EQUAL_THAN_I32:
             case Instruction::COMPARE_EQUALS_I32:
             case Instruction::COMPARE_NOT_EQUALS_I32:
-            case Instruction::ADD_I64:
-            case Instruction::SUB_I64:
-            case Instruction::MUL_I64:
-            case Instruction::DIV_I64:
-            case Instruction::MODULO_I64:
             case Instruction::COMPARE_LESS_THAN_I64:
             case Instruction::COMPARE_MORE_THAN_I64:
             case Instruction::COMPARE_LESS_EQUAL_THAN_I64:
             case Instruction::COMPARE_MORE_EQUAL_THAN_I64:
             case Instruction::COMPARE_EQUALS_I64:
-            case Instruction::COMPARE_NOT_EQUALS_I64:
-            case Instruction::LOGICAL_OR:
+            case Instruction::COMPARE_NOT_EQUALS_I64: {
+                auto [lhs, rhs] = binaryOperands();
+                if(ins <= Instruction::COMPARE_NOT_EQUALS_I32) {
+                    cmp(lhs.cvt32(), rhs.cvt32());
+                } else {
+                    cmp(lhs, rhs);
+                }
+                switch(ins) {
+                case Instruction::COMPARE_LESS_THAN_I32:
+                case Instruction::COMPARE_LESS_THAN_I64:
+                    setl(al);
+                    break;
+                case Instruction::COMPARE_MORE_THAN_I32:
+                case Instruction::COMPARE_MORE_THAN_I64:
+                    setg(al);
+                    break;
+                case Instruction::COMPARE_LESS_EQUAL_THAN_I32:
+                case Instruction::COMPARE_LESS_EQUAL_THAN_I64:
+                    setle(al);
+                    break;
+                case Instruction::COMPARE_MORE_EQUAL_THAN_I32:
+                case Instruction::COMPARE_MORE_EQUAL_THAN_I64:
+                    setge(al);
+                    break;
+                case Instruction::COMPARE_EQUALS_I32:
+                case Instruction::COMPARE_EQUALS_I64:
+                    sete(al);
+                    break;
+                default:
+                    setne(al);
+                    break;
+                }
+                movzx(lhs.cvt32(), al);
+                return true;
+            }
+            case Instruction::LOGICAL_OR: {
+                auto [lhs, rhs] = binaryOperands();
+                or_(lhs, rhs);
+                return true;
+            }
+            case Instruction::LOGICAL_AND: {
+                auto [lhs, rhs] = binaryOperands();
+                and_(lhs, rhs);
+                return true;
+            }
             case Instruction::LOGICAL_NOT:
-            case Instruction::LOGICAL_AND:
-            case Instruction::JUMP_IF_FALSE:
-            case Instruction::JUMP:
-            case Instruction::REPUSH_FROM_N:
-            case Instruction::RETURN:
-            case Instruction::CALL:
-            case Instruction::LOAD_FROM_PTR:
-            case Instruction::LIST_GET_TAIL:
-            case Instruction::IS_LIST_EMPTY:
-            case Instruction::RUN_GC:
+            case Instruction::IS_LIST_EMPTY: {
+                auto reg = topSlot();
+                test(reg, reg);
+                sete(al);
+                movzx(reg.cvt32(), al);
+                return true;
+            }
+            case Instruction::LIST_GET_TAIL: {
+                auto reg = topSlot();
+                Xbyak::Label after;
+                test(reg, reg);
+                je(after);
+                emitGetListTail(reg);
+                L(after);
+                return true;
+            }
+            case Instruction::ADD_I32_CONSTANT:
+                add(topSlot().cvt32(), *(int32_t*)&instructions.at(i + 1));
+                return true;
+            case Instruction::SUB_I32_CONSTANT:
+                sub(topSlot().cvt32(), *(int32_t*)&instructions.at(i + 1));
+                return true;
+            case Instruction::MUL_I32_CONSTANT: {
+                auto reg = topSlot();
+                imul(reg.cvt32(), reg.cvt32(), *(int32_t*)&instructions.at(i + 1));
+                return true;
+            }
+            case Instruction::DIV_I32_CONSTANT: {
+                auto reg = topSlot();
+                mov(eax, reg.cvt32());
+                cdq();
+                mov(ebx, *(int32_t*)&instructions.at(i + 1));
+                idiv(ebx);
+                mov(reg.cvt32(), eax);
+                return true;
+            }
+            case Instruction::ADD_I64_CONSTANT:
+                mov(rbx, *(uint64_t*)&instructions.at(i + 1));
+                add(topSlot(), rbx);
+                return true;
+            case Instruction::SUB_I64_CONSTANT:
+                mov(rbx, *(uint64_t*)&instructions.at(i + 1));
+                sub(topSlot(), rbx);
+                return true;
+            case Instruction::MUL_I64_CONSTANT:
+                mov(rbx, *(uint64_t*)&instructions.at(i + 1));
+                imul(topSlot(), rbx);
+                return true;
+            case Instruction::DIV_I64_CONSTANT: {
+                auto reg = topSlot();
+                mov(rax, reg);
+                cqo();
+                mov(rbx, *(uint64_t*)&instructions.at(i + 1));
+                idiv(rbx);
+                mov(reg, rax);
+                return true;
+            }
+            case Instruction::JUMP_IF_FALSE: {
+                auto reg = topSlot();
+                cachedSlots.pop_back();
+                test(reg, reg);
+                // push doesn't modify the flags
+                flushCachedSlots();
+                jumpToIpIf(Condition::Equal, *(int32_t*)&instructions.at(i + 1));
+                return true;
+            }
+            case Instruction::IS_LIST_EMPTY_AND_JUMP_IF_FALSE: {
+                auto reg = topSlot();
+                cachedSlots.pop_back();
+                test(reg, reg);
+                flushCachedSlots();
+                jumpToIpIf(Condition::NotEqual, *(int32_t*)&instructions.at(i + 1));
+                return true;
+            }
+            case Instruction::COMPARE_LESS_THAN_I32_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_MORE_THAN_I32_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_LESS_EQUAL_THAN_I32_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_MORE_EQUAL_THAN_I32_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_EQUALS_I32_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_NOT_EQUALS_I32_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_LESS_THAN_I64_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_MORE_THAN_I64_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_LESS_EQUAL_THAN_I64_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_MORE_EQUAL_THAN_I64_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_EQUALS_I64_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_NOT_EQUALS_I64_AND_JUMP_IF_FALSE: {
+                auto [lhs, rhs] = binaryOperands();
+                cachedSlots.pop_back();
+                if(ins <= Instruction::COMPARE_NOT_EQUALS_I32_AND_JUMP_IF_FALSE) {
+                    cmp(lhs.cvt32(), rhs.cvt32());
+                } else {
+                    cmp(lhs, rhs);
+                }
+                flushCachedSlots();
+                jumpToIpIf(getJumpIfFalseCondition(ins), *(int32_t*)&instructions.at(i + 1));
+                return true;
+            }
+            case Instruction::LOAD_FROM_PTR: {
+                int32_t sizeOfElement = *(int32_t*)&instructions.at(i + 1);
+                int32_t offset = *(int32_t*)&instructions.at(i + 5);
+                assert(sizeOfElement % 8 == 0);
+                auto reg = topSlot();
+                // let the interpreter throw the exception if the list is empty
+                Xbyak::Label notEmpty;
+                test(reg, reg);
+                jne(notEmpty);
+                emitPushCachedSlots();
+                jmp("AfterJumpTable");
+                L(notEmpty);
+                mov(rax, reg);
+                emitGetListNode(rax);
+                cachedSlots.pop_back();
+                for(int32_t j = sizeOfElement / 8 - 1; j >= 0; --j) {
+                    mov(allocateSlot(), qword[rax + (8 * j + offset)]);
+                }
+                return true;
+            }
+            case Instruction::REPUSH_AND_LOAD_FROM_PTR: {
+                int32_t ptrOffset = *(int32_t*)&instructions.at(i + 1);
+                int32_t sizeOfElement = *(int32_t*)&instructions.at(i + 5);
+                int32_t offset = *(int32_t*)&instructions.at(i + 9);
+                assert(sizeOfElement % 8 == 0);
+                loadSlot(rax, ptrOffset);
+                Xbyak::Label notEmpty;
+                test(rax, rax);
+                jne(notEmpty);
+                emitPushCachedSlots();
+                jmp("AfterJumpTable");
+                L(notEmpty);
+                emitGetListNode(rax);
+                for(int32_t j = sizeOfElement / 8 - 1; j >= 0; --j) {
+                    mov(allocateSlot(), qword[rax + (8 * j + offset)]);
+                }
+                return true;
+            }
             case Instruction::NOOP:
-                    return true;
+                return true;
+            default:
+                return false;
             }
-            return false;
         };
+        // With register allocation, only instructions at which we can start executing get a label:
+        // function starts, jump targets, return addresses and everything after an instruction that the interpreter handles.
+        std::vector<bool> isBlockStart(instructions.size() + 1, !registerAllocation);
+        isBlockStart.at(beginIp) = true;
+        for(auto& function : program.functions) {
+            if(function.offset >= beginIp && function.offset < endIp) {
+                isBlockStart.at(function.offset) = true;
+            }
+        }
+        for(int32_t i = beginIp; i < endIp;) {
+            auto ins = static_cast<Instruction>(instructions.at(i));
+            auto nextIp = i + static_cast<int32_t>(instructionToWidth(ins));
+            if(isJumpInstruction(ins)) {
+                isBlockStart.at(*(int32_t*)&instructions.at(i + 1)) = true;
+            }
+            if(ins == Instruction::CALL && program.staticCallTargets.count(i) > 0) {
+                isBlockStart.at(program.staticCallTargets.at(i)) = true;
+            }
+            if(ins == Instruction::RETURN || ins == Instruction::JUMP || ins == Instruction::CALL || !isInstructionAtIpJittable(i)) {
+                isBlockStart.at(nextIp) = true;
+            }
+            if(ins == Instruction::RUN_GC && !coversWholeProgram) {
+                // the interpreter executes the RUN_GC of a function that just got hot and then enters the code after it
+                isBlockStart.at(nextIp) = true;
+            }
+            i = nextIp;
+        }
+
         jumpWithIp();
 
         // Start executing some Code!
-        for(int32_t i = 0; i < static_cast<int32_t>(instructions.size());) {
+        for(int32_t i = beginIp; i < endIp;) {
             auto ins = static_cast<Instruction>(instructions.at(i));
             if(!isInstructionAtIpJittable(i)) {
                 // we hit an instruction that we don't know, so exit the jit
+                flushCachedSlots();
                 jmp("AfterJumpTable");
                 i += instructionToWidth(ins);
                 continue;
             }
-            auto nextInstruction = [&] {
-                return static_cast<Instruction>(instructions.at(i + instructionToWidth(ins)));
-            };
-            auto nextInstructionWidth = [&] {
-                return instructionToWidth(nextInstruction());
-            };
-            bool shouldAutoIncrement = true;
-
-            for(auto it = directJumpLocationLabels.begin(); it != directJumpLocationLabels.end();) {
-                if(it->second == i) {
-                    L(*it->first);
-                    directJumpLocationLabels.erase(it);
-                } else {
-                    it++;
+            if(isBlockStart.at(i)) {
+                flushCachedSlots();
+                for(auto it = directJumpLocationLabels.begin(); it != directJumpLocationLabels.end();) {
+                    if(it->second == i) {
+                        L(*it->first);
+                        it = directJumpLocationLabels.erase(it);
+                    } else {
+                        it++;
+                    }
                 }
+                instructionLocationLabels.emplace_back(std::make_pair((uint32_t)i, L()));
             }
-            instructionLocationLabels.emplace_back(std::make_pair((uint32_t)i, L()));
+            if(registerAllocation && emitWithRegisters(ins, i)) {
+                i += instructionToWidth(ins);
+                add(ip, instructionToWidth(ins));
+                continue;
+            }
+            flushCachedSlots();
             switch(ins) {
-            case Instruction::PUSH_8: {
-                auto amount = *(int64_t*)&instructions.at(i + 1);
-                if(nextInstruction() == Instruction::SUB_I32) {
-                    sub(qword[rsp], amount);
-                    add(ip, instructionToWidth(ins) + nextInstructionWidth());
-                    i += instructionToWidth(ins) + nextInstructionWidth();
-                    shouldAutoIncrement = false;
-                } else if(nextInstruction() == Instruction::ADD_I32) {
-                    add(qword[rsp], amount);
-                    add(ip, instructionToWidth(ins) + nextInstructionWidth());
-                    i += instructionToWidth(ins) + nextInstructionWidth();
-                    shouldAutoIncrement = false;
-                } else if(nextInstruction() == Instruction::DIV_I32) {
-                    pop(rax);
-                    mov(rbx, amount);
-                    cdq();
-                    idiv(ebx);
-                    push(rax);
-                    add(ip, instructionToWidth(ins) + nextInstructionWidth());
-                    i += instructionToWidth(ins) + nextInstructionWidth();
-                    shouldAutoIncrement = false;
-                    // TODO optimize MUL_I32, DIV_I64 and MUL_I64 as well
-                } else {
-                    mov(rax, *(uint64_t*)&instructions.at(i + 1));
-                    push(rax);
-                }
+            case Instruction::PUSH_8:
+                mov(rax, *(uint64_t*)&instructions.at(i + 1));
+                push(rax);
+                break;
+            case Instruction::LOAD_CONSTANT_LIST:
+                mov(rax, (uint64_t)gc.getConstantList(*(int32_t*)&instructions.at(i + 1)));
+                push(rax);
                 break;
-            }
             case Instruction::ADD_I32:
                 pop(rax);
                 add(dword[rsp], eax);
@@ -340,62 +995,48 @@ public:
             case Instruction::JUMP: {
                 auto newIp = *(int32_t*)&instructions.at(i + 1);
                 mov(ip, newIp);
-                if(isInstructionAtIpJittable(newIp)) {
-                    // try to find the label in already compiled code
-                    bool found = false;
-                    for(auto& instructionJumpLabel: instructionLocationLabels) {
-                        if(instructionJumpLabel.first == newIp) {
-                            jmp(instructionJumpLabel.second);
-                            found = true;
-                            break;
-                        }
-                    }
-                    if(found) {
-                        break;
-                    }
-
-                    // create a new label and assign it as soon as we compile the instruction
-                    Xbyak::Label label;
-                    jmp(label);
-                    directJumpLocationLabels.emplace_back(std::make_pair(std::make_unique<Xbyak::Label>(std::move(label)), newIp));
-                } else {
-                    jmp("AfterJumpTable");
-                }
+                jumpToIp(newIp);
                 break;
             }
             case Instruction::JUMP_IF_FALSE: {
                 auto newIp = *(int32_t*)&instructions.at(i + 1);
                 pop(rax);
-                mov(rbx, newIp);
                 test(rax, rax);
-                cmovz(ip, rbx);
-                // If the instruction at the desired ip is jittable, then we can just jump to it directly without using the jump table.
-                // If it is not jittable, it's even easier as we can just pass execution back to the interpreter
-                if(isInstructionAtIpJittable(newIp)) {
-                    // try to find the label in already compiled code
-                    bool found = false;
-                    for(auto& instructionJumpLabel: instructionLocationLabels) {
-                        if(instructionJumpLabel.first == newIp) {
-                            jz(instructionJumpLabel.second);
-                            found = true;
-                            break;
-                        }
-                    }
-                    if(found) {
-                        break;
-                    }
-
-                    // create a new label and assign it as soon as we compile the code
-                    Xbyak::Label label;
-                    jz(label);
-                    directJumpLocationLabels.emplace_back(std::make_pair(std::make_unique<Xbyak::Label>(std::move(label)), newIp));
-                } else {
-                    jz("AfterJumpTable");
-                }
+                jumpToIpIf(Condition::Equal, newIp);
                 break;
             }
             case Instruction::CALL: {
                 auto callInfoOffset = *(int32_t*)&instructions.at(i + 1);
+                auto staticNativeCallTarget = program.staticNativeCallTargets.find(i);
+                if(staticNativeCallTarget != program.staticNativeCallTargets.end() && program.nativeFunctions.at(staticNativeCallTarget->second).rawCallback) {
+                    // call the native function directly without leaving the native code, see RawNativeCallback
+                    const auto& nativeFunction = program.nativeFunctions.at(staticNativeCallTarget->second);
+                    const auto& functionTypeInfo = nativeFunction.functionType.getFunctionTypeInfo();
+                    const auto paramCount = static_cast<int32_t>(functionTypeInfo.second.size());
+                    emitCall((size_t)nativeFunction.rawCallback, [&] {
+                        const Xbyak::Reg64 argumentRegisters[] = { rsi, rdx, rcx, r8, r9 };
+                        mov(rdi, gcPointer);
+                        // every parameter is a scalar, so it takes 8 bytes; the first one is the deepest
+                        for(int32_t j = 0; j < paramCount; ++j) {
+                            mov(argumentRegisters[j], qword[rsp + (EMIT_CALL_SAVED_BYTES + 8 * (paramCount - 1 - j))]);
+                        }
+                    });
+                    // pop the parameters and the function id
+                    add(rsp, callInfoOffset + 8);
+                    if(functionTypeInfo.first.getSizeOnStack() > 0) {
+                        push(rax);
+                    }
+                    break;
+                }
+                auto staticCallTarget = program.staticCallTargets.find(i);
+                if(staticCallTarget != program.staticCallTargets.end()) {
+                    // the callee is known, so we don't need to check the function id and can jump directly to its code
+                    add(ip, instructionToWidth(ins));
+                    mov(dword[rsp + (callInfoOffset + 4)], ip32);
+                    mov(ip, staticCallTarget->second);
+                    jumpToIp(staticCallTarget->second);
+                    break;
+                }
                 mov(rax, rsp);
                 add(rax, callInfoOffset);
                 // rax points to the location of the function id/ptr
@@ -471,9 +1112,9 @@ public:
                 cmp(qword[rsp], 0);
                 Xbyak::Label after;
                 je(after);
-                mov(rax, qword[rsp]);
-                mov(rax, qword[rax]);
-                mov(qword[rsp], rax);
+                mov(rdx, qword[rsp]);
+                emitGetListTail(rdx);
+                mov(qword[rsp], rdx);
                 L(after);
                 break;
             }
@@ -487,6 +1128,7 @@ public:
                 je("AfterJumpTable");
 
                 pop(rax);
+                emitGetListNode(rax);
                 assert(sizeOfElement % 8 == 0);
                 for(int32_t i = sizeOfElement / 8 - 1; i >= 0; --i) {
                     mov(rbx, qword[rax + (8 * i + offset)]);
@@ -534,21 +1176,175 @@ public:
                 break;
             case Instruction::NOOP:
                 break;
+            case Instruction::ADD_I32_CONSTANT:
+                add(dword[rsp], *(int32_t*)&instructions.at(i + 1));
+                break;
+            case Instruction::SUB_I32_CONSTANT:
+                sub(dword[rsp], *(int32_t*)&instructions.at(i + 1));
+                break;
+            case Instruction::MUL_I32_CONSTANT:
+                imul(ebx, dword[rsp], *(int32_t*)&instructions.at(i + 1));
+                mov(qword[rsp], rbx);
+                break;
+            case Instruction::DIV_I32_CONSTANT:
+                pop(rax);
+                mov(rbx, *(int32_t*)&instructions.at(i + 1));
+                cdq();
+                idiv(ebx);
+                push(rax);
+                break;
+            case Instruction::ADD_I64_CONSTANT:
+                mov(rax, *(uint64_t*)&instructions.at(i + 1));
+                add(qword[rsp], rax);
+                break;
+            case Instruction::SUB_I64_CONSTANT:
+                mov(rax, *(uint64_t*)&instructions.at(i + 1));
+                sub(qword[rsp], rax);
+                break;
+            case Instruction::MUL_I64_CONSTANT:
+                mov(rbx, *(uint64_t*)&instructions.at(i + 1));
+                imul(rbx, qword[rsp]);
+                mov(qword[rsp], rbx);
+                break;
+            case Instruction::DIV_I64_CONSTANT:
+                pop(rax);
+                mov(rbx, *(uint64_t*)&instructions.at(i + 1));
+                cqo();
+                idiv(rbx);
+                push(rax);
+                break;
+            case Instruction::COMPARE_LESS_THAN_I32_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_MORE_THAN_I32_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_LESS_EQUAL_THAN_I32_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_MORE_EQUAL_THAN_I32_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_EQUALS_I32_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_NOT_EQUALS_I32_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_LESS_THAN_I64_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_MORE_THAN_I64_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_LESS_EQUAL_THAN_I64_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_MORE_EQUAL_THAN_I64_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_EQUALS_I64_AND_JUMP_IF_FALSE:
+            case Instruction::COMPARE_NOT_EQUALS_I64_AND_JUMP_IF_FALSE: {
+                // compare the values and jump directly if the comparison is false without creating a bool first
+                auto newIp = *(int32_t*)&instructions.at(i + 1);
+                pop(rax);
+                pop(rbx);
+                if(ins <= Instruction::COMPARE_NOT_EQUALS_I32_AND_JUMP_IF_FALSE) {
+                    cmp(ebx, eax);
+                } else {
+                    cmp(rbx, rax);
+                }
+                jumpToIpIf(getJumpIfFalseCondition(ins), newIp);
+                break;
+            }
+            case Instruction::IS_LIST_EMPTY_AND_JUMP_IF_FALSE: {
+                // jump if the list is not empty
+                auto newIp = *(int32_t*)&instructions.at(i + 1);
+                pop(rax);
+                test(rax, rax);
+                jumpToIpIf(Condition::NotEqual, newIp);
+                break;
+            }
+            case Instruction::REPUSH_AND_LOAD_FROM_PTR: {
+                int32_t ptrOffset = *(int32_t*)&instructions.at(i + 1);
+                int32_t sizeOfElement = *(int32_t*)&instructions.at(i + 5);
+                int32_t offset = *(int32_t*)&instructions.at(i + 9);
+
+                // let the interpreter throw the exception
+                cmp(qword[rsp + ptrOffset], 0);
+                je("AfterJumpTable");
+
+                mov(rax, qword[rsp + ptrOffset]);
+                emitGetListNode(rax);
+                assert(sizeOfElement % 8 == 0);
+                for(int32_t j = sizeOfElement / 8 - 1; j >= 0; --j) {
+                    mov(rbx, qword[rax + (8 * j + offset)]);
+                    push(rbx);
+                }
+                break;
+            }
+            case Instruction::CREATE_STRUCT_OR_ENUM: {
+                int32_t sizeOfData = *(int32_t*)&instructions.at(i + 1);
+                emitAlloc(sizeOfData);
+                emitCopyFromStack(0, 0, sizeOfData);
+                add(rsp, sizeOfData);
+                push(rax);
+                break;
+            }
+            case Instruction::LIST_PREPEND: {
+                // the new head is the pointer to the old list followed by the element, which is exactly the layout on the stack
+                int32_t datatypeLength = *(int32_t*)&instructions.at(i + 1);
+                emitAlloc(datatypeLength + 8);
+                emitCopyFromStack(0, 0, datatypeLength + 8);
+                add(rsp, datatypeLength + 8);
+                push(rax);
+                break;
+            }
+            case Instruction::CREATE_LIST: {
+                int32_t elementSize = *(int32_t*)&instructions.at(i + 1);
+                int32_t elementCount = *(int32_t*)&instructions.at(i + 5);
+                if(elementCount == 0) {
+                    push(0);
+                    break;
+                }
+                // allocate all elements at once; they are still separate objects for the GC as each one is traced individually
+                int32_t sizeOfNode = elementSize + 8;
+                emitAlloc(sizeOfNode * elementCount);
+                for(int32_t j = 0; j < elementCount; ++j) {
+                    if(j == elementCount - 1) {
+                        mov(qword[rax + j * sizeOfNode], 0);
+                    } else {
+                        lea(rbx, qword[rax + (j + 1) * sizeOfNode]);
+                        mov(qword[rax + j * sizeOfNode], rbx);
+                    }
+                    emitCopyFromStack(j * sizeOfNode + 8, (elementCount - j - 1) * elementSize, elementSize);
+                }
+                add(rsp, elementSize * elementCount);
+                push(rax);
+                break;
+            }
+            case Instruction::CREATE_LAMBDA: {
+                int32_t capturedDataSize = *(int32_t*)&instructions.at(i + 1);
+                int32_t auxTypeId = *(int32_t*)&instructions.at(i + 5);
+                emitAlloc(capturedDataSize + 16);
+                // header: length of the captured data, ip of the function, type id of the captured data and 1
+                mov(dword[rax], capturedDataSize);
+                mov(ebx, dword[rsp + capturedDataSize]);
+                mov(dword[rax + 4], ebx);
+                mov(dword[rax + 8], auxTypeId);
+                mov(dword[rax + 12], 1);
+                emitCopyFromStack(16, 0, capturedDataSize);
+                add(rsp, capturedDataSize + 8);
+                push(rax);
+                break;
+            }
+            case Instruction::COMPARE_COMPLEX_EQUALITY: {
+                const auto& comparator = *equalityComparators.at(*(int32_t*)&instructions.at(i + 1));
+                int32_t datatypeSize = comparator.getSizeOnStack();
+                mov(rdi, (size_t)&comparator);
+                mov(rsi, rsp);
+                lea(rdx, qword[rsp + datatypeSize]);
+                emitCall((size_t)&jitCompareComplexEquality);
+                add(rsp, datatypeSize * 2);
+                push(rax);
+                break;
+            }
             default:
                 assert(false);
                 break;
             }
-            if(shouldAutoIncrement) {
-                i += instructionToWidth(ins);
-                add(ip, instructionToWidth(ins));
-            }
+            i += instructionToWidth(ins);
+            add(ip, instructionToWidth(ins));
         }
         assert(directJumpLocationLabels.empty());
 
+        flushCachedSlots();
         jmp("AfterJumpTable");
 
         L("JumpTable");
-        for(size_t i = 0; i <= instructions.size(); ++i) {
+        mBeginIp = beginIp;
+        mHasEntry.resize(endIp - beginIp + 1, false);
+        for(int32_t i = beginIp; i <= endIp; ++i) {
             bool labelExists = false;
             for(auto& label : instructionLocationLabels) {
                 if(label.first == i) {
@@ -560,6 +1356,7 @@ public:
             if(!labelExists) {
                 putL("AfterJumpTable");
             }
+            mHasEntry.at(i - beginIp) = labelExists;
         }
         L("AfterJumpTable");
 
@@ -598,6 +1395,25 @@ public:
 
         readyRE();
     }
+
+    // Whether the jump table contains a label for this ip; entering anywhere else would exit immediately
+    bool hasEntry(int32_t ip) const {
+        return ip >= mBeginIp && ip - mBeginIp < static_cast<int32_t>(mHasEntry.size()) && mHasEntry.at(ip - mBeginIp);
+    }
+
+private:
+    int32_t mBeginIp{ 0 };
+    std::vector<bool> mHasEntry;
+
+    // conditions for conditional jumps, see jumpToIpIf
+    enum class Condition {
+        Equal,
+        NotEqual,
+        Less,
+        LessEqual,
+        Greater,
+        GreaterEqual
+    };
 };
 #else
 class JitCode {
@@ -605,11 +1421,190 @@ class JitCode {
 #endif
 
 VM::VM(Program program, VMParameters params)
-: mProgram(std::move(program)), mGC(*this, params) {
+: mProgram(std::move(program)), mJitTierUpThreshold(params.jitTierUpThreshold), mJitRegisterAllocation(params.jitRegisterAllocation), mGC(*this, params), mInterpreterMode(params.interpreterMode) {
+    for(auto& nativeFunction : mProgram.nativeFunctions) {
+        if(nativeFunction.rawCallback && !canUseRawNativeCallback(nativeFunction.functionType)) {
+            throw std::runtime_error{ "Native function " + nativeFunction.fullName + " of type " + nativeFunction.functionType.toString() + " can't use a raw callback" };
+        }
+        if(!nativeFunction.rawCallback && !nativeFunction.frameCallback) {
+            nativeFunction.frameCallback = NativeCallFrame::adapt(std::move(nativeFunction.callback));
+        }
+        const auto& [returnType, paramTypes] = nativeFunction.functionType.getFunctionTypeInfo();
+        NativeFunctionLayout layout;
+        for(auto& paramType : paramTypes) {
+            layout.paramSizes.push_back(paramType.getSizeOnStack());
+            layout.sumOfParamSizes += paramType.getSizeOnStack();
+        }
+        // the first parameter is the deepest one on the stack
+        int32_t offset = layout.sumOfParamSizes;
+        for(auto paramSize : layout.paramSizes) {
+            offset -= paramSize;
+            layout.paramOffsets.push_back(offset);
+        }
+        layout.returnTypeSize = returnType.getSizeOnStack();
+        if(static_cast<size_t>(layout.returnTypeSize) > mNativeReturnValue.size()) {
+            mNativeReturnValue.resize(layout.returnTypeSize);
+        }
+        mNativeFunctionLayouts.emplace_back(std::move(layout));
+    }
+    createEqualityComparators();
+#ifdef SAMAL_ENABLE_JIT
+    for(size_t i = 0; i < mProgram.functions.size(); ++i) {
+        mFunctionOffsets.emplace_back(mProgram.functions.at(i).offset, static_cast<int32_t>(i));
+    }
+    std::sort(mFunctionOffsets.begin(), mFunctionOffsets.end());
+    mJitStatistics.transitionsPerFunction.resize(mProgram.functions.size());
+    if(mJitTierUpThreshold > 0) {
+        mCompiledFunctions.resize(mProgram.functions.size());
+        mFunctionHotness.resize(mProgram.functions.size(), 0);
+    } else {
+        mCompiledCode = std::make_unique<JitCode>(mProgram, 0, static_cast<int32_t>(mProgram.code.size()), mJitRegisterAllocation, mGC, mEqualityComparators);
+    }
+#else
+    if(mInterpreterMode == InterpreterMode::Threaded) {
+        decodeProgram();
+    }
+#endif
+}
+JitCode* VM::getCompiledCode() {
+    if(mCompiledCode) {
+        return mCompiledCode.get();
+    }
+    auto functionIndex = findFunctionIndex(mIp);
+    if(functionIndex < 0) {
+        return nullptr;
+    }
+    return mCompiledFunctions.at(functionIndex).get();
+}
+bool VM::canEnterCompiledCode() {
 #ifdef SAMAL_ENABLE_JIT
-    mCompiledCode = std::make_unique<JitCode>(mProgram.code);
+    // with register allocation, only block starts can be entered
+    auto* compiledCode = getCompiledCode();
+    return compiledCode && compiledCode->hasEntry(mIp);
+#else
+    return false;
+#endif
+}
+void VM::countJitTransition(int64_t JitStatistics::Transitions::*counter) {
+    auto functionIndex = findFunctionIndex(mIp);
+    if(functionIndex >= 0) {
+        mJitStatistics.transitionsPerFunction.at(functionIndex).*counter += 1;
+    }
+}
+void VM::countJitHotness() {
+#ifdef SAMAL_ENABLE_JIT
+    if(mJitTierUpThreshold <= 0 || mIp >= static_cast<int32_t>(mProgram.code.size())) {
+        return;
+    }
+    // every function starts with RUN_GC, so we count calls and backward jumps (tail calls to self)
+    auto ins = static_cast<Instruction>(mProgram.code.at(mIp));
+    if(ins != Instruction::RUN_GC && !(isJumpInstruction(ins) && *(int32_t*)&mProgram.code.at(mIp + 1) < mIp)) {
+        return;
+    }
+    auto functionIndex = findFunctionIndex(mIp);
+    if(functionIndex < 0 || mCompiledFunctions.at(functionIndex)) {
+        return;
+    }
+    auto hotness = ++mFunctionHotness.at(functionIndex);
+    if(hotness < mJitTierUpThreshold) {
+        return;
+    }
+    // the instruction is still interpreted, the compiled code is used from the next one on
+    auto& function = mProgram.functions.at(functionIndex);
+    auto start = std::chrono::high_resolution_clock::now();
+    mCompiledFunctions.at(functionIndex) = std::make_unique<JitCode>(mProgram, function.offset, function.offset + function.len, mJitRegisterAllocation, mGC, mEqualityComparators);
+    mJitStatistics.tierUpEvents.emplace_back(JitStatistics::TierUpEvent{
+        .functionName = function.name,
+        .hotness = hotness,
+        .compileTime = std::chrono::high_resolution_clock::now() - start });
 #endif
 }
+int32_t VM::findFunctionIndex(int32_t ip) const {
+    auto it = std::upper_bound(mFunctionOffsets.cbegin(), mFunctionOffsets.cend(), std::make_pair(ip, std::numeric_limits<int32_t>::max()));
+    if(it == mFunctionOffsets.cbegin()) {
+        return -1;
+    }
+    --it;
+    const auto& function = mProgram.functions.at(it->second);
+    if(ip >= function.offset + function.len) {
+        return -1;
+    }
+    return it->second;
+}
+void VM::createEqualityComparators() {
+    mEqualityComparators.resize(mProgram.auxiliaryDatatypes.size());
+    for(size_t ip = 0; ip < mProgram.code.size();) {
+        auto ins = static_cast<Instruction>(mProgram.code.at(ip));
+        if(ins == Instruction::COMPARE_COMPLEX_EQUALITY) {
+            auto datatypeIndex = *(int32_t*)&mProgram.code.at(ip + 1);
+            if(!mEqualityComparators.at(datatypeIndex)) {
+                mEqualityComparators.at(datatypeIndex) = std::make_unique<EqualityComparator>(mProgram.auxiliaryDatatypes.at(datatypeIndex));
+            }
+        }
+        ip += instructionToWidth(ins);
+    }
+}
+void VM::decodeProgram() {
+    const auto codeSize = static_cast<int32_t>(mProgram.code.size());
+    mDecodedCode.clear();
+    mIpToDecodedIndex.assign(codeSize + 1, -1);
+    for(int32_t ip = 0; ip < codeSize;) {
+        DecodedInstruction decoded;
+        decoded.ins = static_cast<Instruction>(mProgram.code.at(ip));
+        decoded.ip = ip;
+        auto width = static_cast<int32_t>(instructionToWidth(decoded.ins));
+        switch(decoded.ins) {
+        case Instruction::PUSH_1:
+        case Instruction::PUSH_4:
+        case Instruction::PUSH_8:
+            memcpy(&decoded.immediate, &mProgram.code.at(ip + 1), width - 1);
+            break;
+        case Instruction::LOAD_CONSTANT_LIST:
+            decoded.immediate = (int64_t)mGC.getConstantList(*(int32_t*)&mProgram.code.at(ip + 1));
+            break;
+        case Instruction::ADD_I32_CONSTANT:
+        case Instruction::SUB_I32_CONSTANT:
+        case Instruction::MUL_I32_CONSTANT:
+        case Instruction::DIV_I32_CONSTANT:
+            decoded.immediate = *(int32_t*)&mProgram.code.at(ip + 1);
+            break;
+        case Instruction::ADD_I64_CONSTANT:
+        case Instruction::SUB_I64_CONSTANT:
+        case Instruction::MUL_I64_CONSTANT:
+        case Instruction::DIV_I64_CONSTANT:
+            decoded.immediate = *(int64_t*)&mProgram.code.at(ip + 1);
+            break;
+        case Instruction::REPUSH_AND_LOAD_FROM_PTR:
+            decoded.param1 = *(int32_t*)&mProgram.code.at(ip + 1);
+            decoded.param2 = *(int32_t*)&mProgram.code.at(ip + 5);
+            decoded.param3 = *(int32_t*)&mProgram.code.at(ip + 9);
+            break;
+        default:
+            if(width >= 5)
+                decoded.param1 = *(int32_t*)&mProgram.code.at(ip + 1);
+            if(width >= 9)
+                decoded.param2 = *(int32_t*)&mProgram.code.at(ip + 5);
+            break;
+        }
+        mIpToDecodedIndex.at(ip) = static_cast<int32_t>(mDecodedCode.size());
+        mDecodedCode.push_back(decoded);
+        ip += width;
+    }
+    // Returning to the end of the code means that the program has finished; the sentinel makes sure that
+    // the instruction after the last one still has a valid ip.
+    DecodedInstruction end;
+    end.ip = codeSize;
+    mIpToDecodedIndex.at(codeSize) = static_cast<int32_t>(mDecodedCode.size());
+    mDecodedCode.push_back(end);
+
+    // resolve jump targets to indices
+    for(auto& decoded : mDecodedCode) {
+        if(isJumpInstruction(decoded.ins)) {
+            decoded.param1 = mIpToDecodedIndex.at(decoded.param1);
+            assert(decoded.param1 >= 0);
+        }
+    }
+}
 ExternalVMValue VM::run(const std::string& functionName, std::vector<uint8_t> initialStack) {
     mStack.clear();
     mStack.push(initialStack);
@@ -631,11 +1626,12 @@ ExternalVMValue VM::run(const std::string& functionName, std::vector<uint8_t> in
     while(true) {
 #ifdef SAMAL_ENABLE_JIT
         // first try to jit as many instructions as possible
-        {
+        if(auto* compiledCode = getCompiledCode()) {
 #    ifdef _DEBUG
             printf("Executing jit...\n");
 #    endif
-            JitReturn ret = mCompiledCode->getCode<JitReturn (*)(int32_t, uint8_t*, int32_t, VM*, void(VM::*)(int64_t, int64_t))>()(mIp, mStack.getTopPtr(), mStack.getSize(), this, &VM::jitRequestGCCollection);
+            countJitTransition(&JitStatistics::Transitions::entries);
+            JitReturn ret = compiledCode->getCode<JitReturn (*)(int32_t, uint8_t*, int32_t, VM*, void(VM::*)(int64_t, int64_t))>()(mIp, mStack.getTopPtr(), mStack.getSize(), this, &VM::jitRequestGCCollection);
             mStack.setSize(ret.stackSize);
             mIp = ret.ip;
             if(mIp == static_cast<int32_t>(mProgram.code.size())) {
@@ -650,6 +1646,7 @@ ExternalVMValue VM::run(const std::string& functionName, std::vector<uint8_t> in
             printf("New ip: %u\n", mIp);
             printf("Dump:\n%s\n", dump.c_str());
 #    endif
+            countJitTransition(&JitStatistics::Transitions::exits);
             if(ret.nativeFunctionToCall) {
                 auto newIp = mIp;
                 mIp -= instructionToWidth(Instruction::CALL);
@@ -658,10 +1655,21 @@ ExternalVMValue VM::run(const std::string& functionName, std::vector<uint8_t> in
                 continue;
             }
         }
-#endif
+        // then interpret everything up to the next instruction the native code can execute; this is at least one
+        // instruction, as the native code only exits if it can't execute the current one
+        bool ret;
+        do {
+            countJitHotness();
+            ret = interpretInstruction();
+        } while(ret && !canEnterCompiledCode());
+#else
+        if(mInterpreterMode == InterpreterMode::Threaded) {
+            interpretInstructionsThreaded();
+            return ExternalVMValue::wrapStackedValue(returnType, *this, 0);
+        }
         // then run one through the interpreter
-        // TODO run multiple instructions at once if multiple instructions in a row can't be jitted
         auto ret = interpretInstruction();
+#endif
 #ifdef _DEBUG
         auto stackDump = mStack.dump();
         printf("Stack:\n%s\n", stackDump.c_str());
@@ -701,6 +1709,11 @@ bool VM::interpretInstruction() {
     case Instruction::PUSH_8:
         mStack.push(&mProgram.code.at(mIp + 1), 8);
         break;
+    case Instruction::LOAD_CONSTANT_LIST: {
+        auto* list = mGC.getConstantList(*(int32_t*)&mProgram.code.at(mIp + 1));
+        mStack.push(&list, 8);
+        break;
+    }
     case Instruction::REPUSH_FROM_N:
         mStack.repush(*(int32_t*)&mProgram.code.at(mIp + 5), *(int32_t*)&mProgram.code.at(mIp + 1));
         break;
@@ -1096,17 +2109,7 @@ bool VM::interpretInstruction() {
         break;
     }
     case Instruction::CREATE_LAMBDA: {
-        auto functionIpOffset = *(int32_t*)&mProgram.code.at(mIp + 1);
-        auto lambdaCapturedTypesId = *(int32_t*)&mProgram.code.at(mIp + 5);
-        auto* dataOnHeap = (uint8_t*)mGC.alloc(functionIpOffset + 16);
-        // store length of buffer & ip of the function on the stack
-        ((int32_t*)dataOnHeap)[0] = functionIpOffset;
-        ((int32_t*)dataOnHeap)[1] = *(int32_t*)mStack.get(functionIpOffset);
-        ((int32_t*)dataOnHeap)[2] = lambdaCapturedTypesId;
-        ((int32_t*)dataOnHeap)[3] = 1;
-        memcpy(dataOnHeap + 16, mStack.get(0), functionIpOffset);
-        mStack.pop(functionIpOffset + 8);
-        mStack.push(&dataOnHeap, 8);
+        execCreateLambda(*(int32_t*)&mProgram.code.at(mIp + 1), *(int32_t*)&mProgram.code.at(mIp + 5));
         break;
     }
     case Instruction::CREATE_STRUCT_OR_ENUM: {
@@ -1118,32 +2121,12 @@ bool VM::interpretInstruction() {
         break;
     }
     case Instruction::CREATE_LIST: {
-        auto elementSize = *(int32_t*)&mProgram.code.at(mIp + 1);
-        auto elementCount = *(int32_t*)&mProgram.code.at(mIp + 5);
-        uint8_t* firstPtr = nullptr;
-        uint8_t* ptrToPreviousElement = nullptr;
-        for(int i = 0; i < elementCount; ++i) {
-            int32_t elementOffset = (elementCount - i - 1) * elementSize;
-            auto* dataOnHeap = (uint8_t*)mGC.alloc(elementSize + 8);
-            if(firstPtr == nullptr)
-                firstPtr = dataOnHeap;
-
-            memcpy(dataOnHeap + 8, mStack.get(elementOffset), elementSize);
-            if(ptrToPreviousElement) {
-                memcpy(ptrToPreviousElement, &dataOnHeap, 8);
-            }
-            ptrToPreviousElement = dataOnHeap;
-        }
-        // let the last element point to nullptr
-        if(ptrToPreviousElement)
-            memset(ptrToPreviousElement, 0, 8);
-        mStack.pop(elementSize * elementCount);
-        mStack.push(&firstPtr, 8);
+        execCreateList(*(int32_t*)&mProgram.code.at(mIp + 1), *(int32_t*)&mProgram.code.at(mIp + 5));
         break;
     }
     case Instruction::LIST_GET_TAIL: {
         if(*(void**)mStack.get(0) != nullptr) {
-            *(uint8_t**)mStack.get(0) = **(uint8_t***)mStack.get(0);
+            *(uint8_t**)mStack.get(0) = getListTail(*(uint8_t**)mStack.get(0));
         }
         break;
     }
@@ -1155,6 +2138,7 @@ bool VM::interpretInstruction() {
             // TODO throw some kind of language-internal exception
             throw std::runtime_error{ "Trying to access :head of empty list" };
         }
+        ptr = getListNode(ptr);
         mStack.pop(8);
         char buffer[size];
         memcpy(buffer, ptr + offset, size);
@@ -1162,41 +2146,7 @@ bool VM::interpretInstruction() {
         break;
     }
     case Instruction::COMPARE_COMPLEX_EQUALITY: {
-        auto datatypeIndex = *(int32_t*)&mProgram.code.at(mIp + 1);
-        auto& datatype = mProgram.auxiliaryDatatypes.at(datatypeIndex);
-        auto datatypeSize = datatype.getSizeOnStack();
-        std::function<bool(const Datatype&, uint8_t*, uint8_t*)> isEqual = [&](const Datatype& type, uint8_t* a, uint8_t* b) -> bool {
-            switch(type.getCategory()) {
-            case DatatypeCategory::list: {
-                uint8_t* lhsPtr = *(uint8_t**)a;
-                uint8_t* rhsPtr = *(uint8_t**)b;
-                while(true) {
-                    if(!lhsPtr && !rhsPtr) {
-                        return true;
-                    }
-                    if(!lhsPtr && rhsPtr) {
-                        return false;
-                    }
-                    if(lhsPtr && !rhsPtr) {
-                        return false;
-                    }
-                    if(!isEqual(type.getListContainedType(), lhsPtr + 8, rhsPtr + 8)) {
-                        return false;
-                    }
-                    lhsPtr = *(uint8_t**)lhsPtr;
-                    rhsPtr = *(uint8_t**)rhsPtr;
-                }
-            }
-            case DatatypeCategory::char_:
-            case DatatypeCategory::i32:
-                return *(int32_t*)a == *(int32_t*)b;
-            default:
-                todo();
-            }
-        };
-        int64_t result = isEqual(datatype, (uint8_t*)mStack.get(0), (uint8_t*)mStack.get(datatypeSize));
-        mStack.pop(datatypeSize * 2);
-        mStack.push(&result, BOOL_SIZE);
+        execCompareComplexEquality(*(int32_t*)&mProgram.code.at(mIp + 1));
         break;
     }
     case Instruction::LIST_PREPEND: {
@@ -1238,6 +2188,107 @@ bool VM::interpretInstruction() {
 #endif
         break;
     }
+#ifdef x86_64_BIT_MODE
+#    define I32_CONSTANT_ARITHMETIC(ins, op)                                          \
+    case Instruction::ins: {                                                          \
+        auto lhs = *(int32_t*)mStack.get(0);                                          \
+        auto rhs = *(int32_t*)&mProgram.code.at(mIp + 1);                             \
+        *(int64_t*)mStack.get(0) = static_cast<int32_t>(lhs op rhs);                  \
+        break;                                                                        \
+    }
+#    define I32_COMPARE_AND_JUMP_IF_FALSE(ins, op)                                    \
+    case Instruction::ins: {                                                          \
+        auto lhs = *(int32_t*)mStack.get(8);                                          \
+        auto rhs = *(int32_t*)mStack.get(0);                                          \
+        mStack.pop(16);                                                               \
+        if(!(lhs op rhs)) {                                                           \
+            mIp = *(int32_t*)&mProgram.code.at(mIp + 1);                              \
+            incIp = false;                                                            \
+        }                                                                             \
+        break;                                                                        \
+    }
+#else
+#    define I32_CONSTANT_ARITHMETIC(ins, op)                                          \
+    case Instruction::ins: {                                                          \
+        auto lhs = *(int32_t*)mStack.get(0);                                          \
+        auto rhs = *(int32_t*)&mProgram.code.at(mIp + 1);                             \
+        *(int32_t*)mStack.get(0) = lhs op rhs;                                        \
+        break;                                                                        \
+    }
+#    define I32_COMPARE_AND_JUMP_IF_FALSE(ins, op)                                    \
+    case Instruction::ins: {                                                          \
+        auto lhs = *(int32_t*)mStack.get(4);                                          \
+        auto rhs = *(int32_t*)mStack.get(0);                                          \
+        mStack.pop(8);                                                                \
+        if(!(lhs op rhs)) {                                                           \
+            mIp = *(int32_t*)&mProgram.code.at(mIp + 1);                              \
+            incIp = false;                                                            \
+        }                                                                             \
+        break;                                                                        \
+    }
+#endif
+#define I64_CONSTANT_ARITHMETIC(ins, op)                                              \
+    case Instruction::ins: {                                                          \
+        auto lhs = *(int64_t*)mStack.get(0);                                          \
+        auto rhs = *(int64_t*)&mProgram.code.at(mIp + 1);                             \
+        *(int64_t*)mStack.get(0) = lhs op rhs;                                        \
+        break;                                                                        \
+    }
+#define I64_COMPARE_AND_JUMP_IF_FALSE(ins, op)                                        \
+    case Instruction::ins: {                                                          \
+        auto lhs = *(int64_t*)mStack.get(8);                                          \
+        auto rhs = *(int64_t*)mStack.get(0);                                          \
+        mStack.pop(16);                                                               \
+        if(!(lhs op rhs)) {                                                           \
+            mIp = *(int32_t*)&mProgram.code.at(mIp + 1);                              \
+            incIp = false;                                                            \
+        }                                                                             \
+        break;                                                                        \
+    }
+    I32_CONSTANT_ARITHMETIC(ADD_I32_CONSTANT, +)
+    I32_CONSTANT_ARITHMETIC(SUB_I32_CONSTANT, -)
+    I32_CONSTANT_ARITHMETIC(MUL_I32_CONSTANT, *)
+    I32_CONSTANT_ARITHMETIC(DIV_I32_CONSTANT, /)
+    I64_CONSTANT_ARITHMETIC(ADD_I64_CONSTANT, +)
+    I64_CONSTANT_ARITHMETIC(SUB_I64_CONSTANT, -)
+    I64_CONSTANT_ARITHMETIC(MUL_I64_CONSTANT, *)
+    I64_CONSTANT_ARITHMETIC(DIV_I64_CONSTANT, /)
+    I32_COMPARE_AND_JUMP_IF_FALSE(COMPARE_LESS_THAN_I32_AND_JUMP_IF_FALSE, <)
+    I32_COMPARE_AND_JUMP_IF_FALSE(COMPARE_MORE_THAN_I32_AND_JUMP_IF_FALSE, >)
+    I32_COMPARE_AND_JUMP_IF_FALSE(COMPARE_LESS_EQUAL_THAN_I32_AND_JUMP_IF_FALSE, <=)
+    I32_COMPARE_AND_JUMP_IF_FALSE(COMPARE_MORE_EQUAL_THAN_I32_AND_JUMP_IF_FALSE, >=)
+    I32_COMPARE_AND_JUMP_IF_FALSE(COMPARE_EQUALS_I32_AND_JUMP_IF_FALSE, ==)
+    I32_COMPARE_AND_JUMP_IF_FALSE(COMPARE_NOT_EQUALS_I32_AND_JUMP_IF_FALSE, !=)
+    I64_COMPARE_AND_JUMP_IF_FALSE(COMPARE_LESS_THAN_I64_AND_JUMP_IF_FALSE, <)
+    I64_COMPARE_AND_JUMP_IF_FALSE(COMPARE_MORE_THAN_I64_AND_JUMP_IF_FALSE, >)
+    I64_COMPARE_AND_JUMP_IF_FALSE(COMPARE_LESS_EQUAL_THAN_I64_AND_JUMP_IF_FALSE, <=)
+    I64_COMPARE_AND_JUMP_IF_FALSE(COMPARE_MORE_EQUAL_THAN_I64_AND_JUMP_IF_FALSE, >=)
+    I64_COMPARE_AND_JUMP_IF_FALSE(COMPARE_EQUALS_I64_AND_JUMP_IF_FALSE, ==)
+    I64_COMPARE_AND_JUMP_IF_FALSE(COMPARE_NOT_EQUALS_I64_AND_JUMP_IF_FALSE, !=)
+#undef I32_CONSTANT_ARITHMETIC
+#undef I32_COMPARE_AND_JUMP_IF_FALSE
+#undef I64_CONSTANT_ARITHMETIC
+#undef I64_COMPARE_AND_JUMP_IF_FALSE
+    case Instruction::IS_LIST_EMPTY_AND_JUMP_IF_FALSE: {
+        auto isEmpty = *(void**)mStack.get(0) == nullptr;
+        mStack.pop(8);
+        if(!isEmpty) {
+            mIp = *(int32_t*)&mProgram.code.at(mIp + 1);
+            incIp = false;
+        }
+        break;
+    }
+    case Instruction::REPUSH_AND_LOAD_FROM_PTR: {
+        auto ptrOffset = *(int32_t*)&mProgram.code.at(mIp + 1);
+        auto size = *(int32_t*)&mProgram.code.at(mIp + 5);
+        auto offset = *(int32_t*)&mProgram.code.at(mIp + 9);
+        auto ptr = *(uint8_t**)mStack.get(ptrOffset);
+        if(ptr == nullptr) {
+            throw std::runtime_error{ "Trying to access :head of empty list" };
+        }
+        mStack.push(getListNode(ptr) + offset, size);
+        break;
+    }
     default:
         fprintf(stderr, "Unhandled instruction %i: %s\n", static_cast<int>(ins), instructionToString(ins));
         assert(false);
@@ -1245,6 +2296,501 @@ bool VM::interpretInstruction() {
     mIp += instructionToWidth(ins) * incIp;
     return true;
 }
+void VM::interpretInstructionsThreaded() {
+    // Every instruction jumps directly to the handler of the next instruction (labels as values), so we don't
+    // have to go through a switch and return to VM::run after each instruction like interpretInstruction() does.
+    // The order of the table is the same as in ENUMERATE_INSTRUCTIONS, so we can index it with the opcode.
+    static const void* const dispatchTable[] = {
+#define INSTRUCTION(name, width) &&handle_##name,
+        ENUMERATE_INSTRUCTIONS
+#undef INSTRUCTION
+    };
+    const DecodedInstruction* const code = mDecodedCode.data();
+    const auto codeSize = static_cast<int32_t>(mProgram.code.size());
+    const DecodedInstruction* pc = code + mIpToDecodedIndex.at(mIp);
+
+#define DISPATCH() goto* dispatchTable[static_cast<uint8_t>(pc->ins)]
+#define NEXT(ins)   \
+    do {            \
+        ++pc;       \
+        DISPATCH(); \
+    } while(0)
+#define SYNC_IP() mIp = pc->ip
+#ifdef x86_64_BIT_MODE
+    // All stack slots are 8 bytes wide, so we can keep the topmost slot in a local variable (and thus in a
+    // register) instead of in mStack. The memory of the topmost slot is stale while it's cached; every
+    // instruction that touches the stack in any other way (calls, the GC, native functions, allocations,
+    // stack traces) needs to write it back with FLUSH_TOS() first and reload it afterwards with RELOAD_TOS().
+    // There are always at least 8 bytes on the stack while we run (the function id/return ip of the
+    // outermost function), so the top slot always exists.
+    int64_t tos = *(int64_t*)mStack.get(0);
+#    define FLUSH_TOS() *(int64_t*)mStack.get(0) = tos
+#    define RELOAD_TOS() tos = *(int64_t*)mStack.get(0)
+#    define PUSH_TOS(value)              \
+        do {                             \
+            int64_t newTos = (value);    \
+            FLUSH_TOS();                 \
+            mStack.push(&newTos, 8);     \
+            tos = newTos;                \
+        } while(0)
+#    define POP_TOS()      \
+        do {               \
+            mStack.pop(8); \
+            RELOAD_TOS();  \
+        } while(0)
+#    define ARITHMETIC_I32(ins, op)                                                           \
+    handle_##ins : {                                                                          \
+        auto lhs = *(int32_t*)mStack.get(8);                                                  \
+        mStack.pop(8);                                                                        \
+        tos = static_cast<int64_t>(static_cast<int32_t>(lhs op static_cast<int32_t>(tos)));   \
+        NEXT(ins);                                                                            \
+    }
+#    define COMPARE_I32(ins, op)                                 \
+    handle_##ins : {                                             \
+        auto lhs = *(int32_t*)mStack.get(8);                     \
+        mStack.pop(8);                                           \
+        tos = static_cast<int64_t>(lhs op static_cast<int32_t>(tos)); \
+        NEXT(ins);                                               \
+    }
+#    define LOGICAL_BINARY(ins, op)                  \
+    handle_##ins : {                                 \
+        auto lhs = *(int64_t*)mStack.get(8);         \
+        mStack.pop(8);                               \
+        tos = static_cast<int64_t>(lhs op tos);      \
+        NEXT(ins);                                   \
+    }
+#    define ARITHMETIC_I64(ins, op)          \
+    handle_##ins : {                         \
+        auto lhs = *(int64_t*)mStack.get(8); \
+        mStack.pop(8);                       \
+        tos = lhs op tos;                    \
+        NEXT(ins);                           \
+    }
+#    define COMPARE_I64(ins, op)                    \
+    handle_##ins : {                                \
+        auto lhs = *(int64_t*)mStack.get(8);        \
+        mStack.pop(8);                              \
+        tos = static_cast<int64_t>(lhs op tos);     \
+        NEXT(ins);                                  \
+    }
+#else
+    // Slots have different sizes, so we can't cache the topmost one; binary operations still write their
+    // result in-place instead of popping both operands and pushing the result.
+    // This build deliberately doesn't cache the top of the stack: the value in mStack is always current, and
+    // FLUSH_TOS()/RELOAD_TOS() are no-ops so the shared handlers can call them unconditionally.
+#    define FLUSH_TOS()
+#    define RELOAD_TOS()
+#    define ARITHMETIC_I32(ins, op)                \
+    handle_##ins : {                               \
+        auto lhs = *(int32_t*)mStack.get(4);       \
+        auto rhs = *(int32_t*)mStack.get(0);       \
+        mStack.pop(4);                             \
+        *(int32_t*)mStack.get(0) = lhs op rhs;     \
+        NEXT(ins);                                 \
+    }
+#    define COMPARE_I32(ins, op)                   \
+    handle_##ins : {                               \
+        auto lhs = *(int32_t*)mStack.get(4);       \
+        auto rhs = *(int32_t*)mStack.get(0);       \
+        mStack.pop(7);                             \
+        *(bool*)mStack.get(0) = lhs op rhs;        \
+        NEXT(ins);                                 \
+    }
+#    define LOGICAL_BINARY(ins, op)                \
+    handle_##ins : {                               \
+        auto lhs = *(bool*)mStack.get(1);          \
+        auto rhs = *(bool*)mStack.get(0);          \
+        mStack.pop(1);                             \
+        *(bool*)mStack.get(0) = lhs op rhs;        \
+        NEXT(ins);                                 \
+    }
+#    define ARITHMETIC_I64(ins, op)                \
+    handle_##ins : {                               \
+        auto lhs = *(int64_t*)mStack.get(8);       \
+        auto rhs = *(int64_t*)mStack.get(0);       \
+        mStack.pop(8);                             \
+        *(int64_t*)mStack.get(0) = lhs op rhs;     \
+        NEXT(ins);                                 \
+    }
+#    define COMPARE_I64(ins, op)                   \
+    handle_##ins : {                               \
+        auto lhs = *(int64_t*)mStack.get(8);       \
+        auto rhs = *(int64_t*)mStack.get(0);       \
+        mStack.pop(15);                            \
+        *(bool*)mStack.get(0) = lhs op rhs;        \
+        NEXT(ins);                                 \
+    }
+#endif
+
+    DISPATCH();
+
+handle_INVALID:
+    FLUSH_TOS();
+    SYNC_IP();
+    fprintf(stderr, "Unhandled instruction %i: %s\n", static_cast<int>(pc->ins), instructionToString(pc->ins));
+    assert(false);
+    return;
+handle_PUSH_1:
+#ifdef x86_64_BIT_MODE
+    assert(false);
+#endif
+    mStack.push(&pc->immediate, 1);
+    NEXT(PUSH_1);
+handle_PUSH_4:
+#ifdef x86_64_BIT_MODE
+    assert(false);
+#endif
+    mStack.push(&pc->immediate, 4);
+    NEXT(PUSH_4);
+handle_PUSH_8:
+#ifdef x86_64_BIT_MODE
+    PUSH_TOS(pc->immediate);
+#else
+    mStack.push(&pc->immediate, 8);
+#endif
+    NEXT(PUSH_8);
+handle_LOAD_CONSTANT_LIST:
+#ifdef x86_64_BIT_MODE
+    PUSH_TOS(pc->immediate);
+#else
+    mStack.push(&pc->immediate, 8);
+#endif
+    NEXT(LOAD_CONSTANT_LIST);
+handle_POP_N_BELOW:
+    FLUSH_TOS();
+    mStack.popBelow(pc->param2, pc->param1);
+    RELOAD_TOS();
+    NEXT(POP_N_BELOW);
+    ARITHMETIC_I32(ADD_I32, +)
+    ARITHMETIC_I32(SUB_I32, -)
+    ARITHMETIC_I32(MUL_I32, *)
+    ARITHMETIC_I32(DIV_I32, /)
+    ARITHMETIC_I32(MODULO_I32, %)
+    COMPARE_I32(COMPARE_LESS_THAN_I32, <)
+    COMPARE_I32(COMPARE_MORE_THAN_I32, >)
+    COMPARE_I32(COMPARE_LESS_EQUAL_THAN_I32, <=)
+    COMPARE_I32(COMPARE_MORE_EQUAL_THAN_I32, >=)
+    COMPARE_I32(COMPARE_EQUALS_I32, ==)
+    COMPARE_I32(COMPARE_NOT_EQUALS_I32, !=)
+    ARITHMETIC_I64(ADD_I64, +)
+    ARITHMETIC_I64(SUB_I64, -)
+    ARITHMETIC_I64(MUL_I64, *)
+    ARITHMETIC_I64(DIV_I64, /)
+    ARITHMETIC_I64(MODULO_I64, %)
+    COMPARE_I64(COMPARE_LESS_THAN_I64, <)
+    COMPARE_I64(COMPARE_MORE_THAN_I64, >)
+    COMPARE_I64(COMPARE_LESS_EQUAL_THAN_I64, <=)
+    COMPARE_I64(COMPARE_MORE_EQUAL_THAN_I64, >=)
+    COMPARE_I64(COMPARE_EQUALS_I64, ==)
+    COMPARE_I64(COMPARE_NOT_EQUALS_I64, !=)
+    LOGICAL_BINARY(LOGICAL_OR, ||)
+    LOGICAL_BINARY(LOGICAL_AND, &&)
+handle_LOGICAL_NOT:
+#ifdef x86_64_BIT_MODE
+    tos = !tos;
+#else
+    *(bool*)mStack.get(0) = !*(bool*)mStack.get(0);
+#endif
+    NEXT(LOGICAL_NOT);
+handle_JUMP_IF_FALSE : {
+#ifdef x86_64_BIT_MODE
+    bool val = tos;
+    POP_TOS();
+#else
+    auto val = *(bool*)mStack.get(0);
+    mStack.pop(1);
+#endif
+    if(!val) {
+        pc = code + pc->param1;
+        DISPATCH();
+    }
+    NEXT(JUMP_IF_FALSE);
+}
+handle_JUMP:
+    pc = code + pc->param1;
+    DISPATCH();
+handle_REPUSH_FROM_N:
+#ifdef x86_64_BIT_MODE
+    if(pc->param1 == 8) {
+        // the common case of repushing a single slot doesn't need to touch the whole stack
+        PUSH_TOS(pc->param2 == 0 ? tos : *(int64_t*)mStack.get(pc->param2));
+        NEXT(REPUSH_FROM_N);
+    }
+#endif
+    FLUSH_TOS();
+    mStack.repush(pc->param2, pc->param1);
+    RELOAD_TOS();
+    NEXT(REPUSH_FROM_N);
+handle_RETURN : {
+    FLUSH_TOS();
+    auto offset = pc->param1;
+    auto returnIp = *(int32_t*)mStack.get(offset + 4);
+    mStack.popBelow(offset, 8);
+    if(returnIp == codeSize) {
+        mIp = returnIp;
+        return;
+    }
+    RELOAD_TOS();
+    pc = code + mIpToDecodedIndex[returnIp];
+    DISPATCH();
+}
+handle_CALL : {
+    FLUSH_TOS();
+    auto offset = pc->param1;
+    auto returnIp = pc[1].ip;
+    auto firstHalfOfParam = *(int32_t*)mStack.get(offset);
+    if(firstHalfOfParam % 2 == 0) {
+        // it's a lambda function call
+        auto* lambdaParams = *(uint8_t**)mStack.get(offset);
+        auto lambdaParamsLen = ((int32_t*)lambdaParams)[0];
+        auto newIp = ((int32_t*)lambdaParams)[1];
+
+        // save old values to stack
+        *(int32_t*)mStack.get(offset + 4) = returnIp;
+        *(int32_t*)mStack.get(offset) = 0;
+
+        assert(lambdaParamsLen >= 0);
+        if(lambdaParamsLen > 0) {
+            mStack.push(lambdaParams + 16, lambdaParamsLen);
+        }
+        pc = code + mIpToDecodedIndex[newIp];
+    } else if(firstHalfOfParam == 3) {
+        // native function call; the native function might inspect the stack, so we need a valid ip
+        SYNC_IP();
+        execNativeFunction(*(int32_t*)mStack.get(offset + 4));
+        ++pc;
+    } else {
+        // default function call
+        auto newIp = *(int32_t*)mStack.get(offset + 4);
+        *(int32_t*)mStack.get(offset + 4) = returnIp;
+        *(int32_t*)mStack.get(offset) = 0;
+        pc = code + mIpToDecodedIndex[newIp];
+    }
+    RELOAD_TOS();
+    DISPATCH();
+}
+handle_CREATE_LAMBDA:
+    FLUSH_TOS();
+    execCreateLambda(pc->param1, pc->param2);
+    RELOAD_TOS();
+    NEXT(CREATE_LAMBDA);
+handle_CREATE_LIST:
+    FLUSH_TOS();
+    execCreateList(pc->param1, pc->param2);
+    RELOAD_TOS();
+    NEXT(CREATE_LIST);
+handle_LOAD_FROM_PTR : {
+    auto size = pc->param1;
+    auto offset = pc->param2;
+#ifdef x86_64_BIT_MODE
+    auto ptr = (uint8_t*)tos;
+#else
+    auto ptr = *(uint8_t**)mStack.get(0);
+#endif
+    if(ptr == nullptr) {
+        FLUSH_TOS();
+        SYNC_IP();
+        throw std::runtime_error{ "Trying to access :head of empty list" };
+    }
+    ptr = getListNode(ptr);
+#ifdef x86_64_BIT_MODE
+    if(size == 8) {
+        tos = *(int64_t*)(ptr + offset);
+        NEXT(LOAD_FROM_PTR);
+    }
+#endif
+    mStack.pop(8);
+    mStack.push(ptr + offset, size);
+    RELOAD_TOS();
+    NEXT(LOAD_FROM_PTR);
+}
+handle_LIST_GET_TAIL:
+#ifdef x86_64_BIT_MODE
+    if(tos != 0) {
+        tos = (int64_t)getListTail((uint8_t*)tos);
+    }
+#else
+    if(*(void**)mStack.get(0) != nullptr) {
+        *(uint8_t**)mStack.get(0) = getListTail(*(uint8_t**)mStack.get(0));
+    }
+#endif
+    NEXT(LIST_GET_TAIL);
+handle_COMPARE_COMPLEX_EQUALITY:
+    FLUSH_TOS();
+    execCompareComplexEquality(pc->param1);
+    RELOAD_TOS();
+    NEXT(COMPARE_COMPLEX_EQUALITY);
+handle_LIST_PREPEND : {
+    FLUSH_TOS();
+    auto datatypeLength = pc->param1;
+    uint8_t* allocation = mGC.alloc(datatypeLength + 8);
+    memcpy(allocation, mStack.get(0), 8);
+    memcpy(allocation + 8, mStack.get(8), datatypeLength);
+    mStack.pop(datatypeLength + 8);
+    mStack.push(&allocation, 8);
+    RELOAD_TOS();
+    NEXT(LIST_PREPEND);
+}
+handle_IS_LIST_EMPTY:
+#ifdef x86_64_BIT_MODE
+    tos = tos == 0;
+#else
+    *(bool*)mStack.get(7) = *(void**)mStack.get(0) == nullptr;
+    mStack.pop(7);
+#endif
+    NEXT(IS_LIST_EMPTY);
+handle_CREATE_STRUCT_OR_ENUM : {
+    FLUSH_TOS();
+    auto sizeOfData = pc->param1;
+    auto* dataOnHeap = mGC.alloc(sizeOfData);
+    memcpy(dataOnHeap, mStack.get(0), sizeOfData);
+    mStack.pop(sizeOfData);
+    mStack.push(&dataOnHeap, 8);
+    RELOAD_TOS();
+    NEXT(CREATE_STRUCT_OR_ENUM);
+}
+handle_RUN_GC:
+    // the GC walks the stack using the current ip and may move the object the topmost slot points to
+    FLUSH_TOS();
+    SYNC_IP();
+    mGC.requestCollection();
+    RELOAD_TOS();
+    NEXT(RUN_GC);
+handle_INCREASE_STACK_SIZE : {
+    FLUSH_TOS();
+    auto amount = pc->param1;
+    mStack.setSize(mStack.getSize() + amount);
+#ifdef _DEBUG
+    memset(mStack.getTopPtr(), 0, amount);
+#endif
+    RELOAD_TOS();
+    NEXT(INCREASE_STACK_SIZE);
+}
+handle_NOOP:
+    NEXT(NOOP);
+
+#ifdef x86_64_BIT_MODE
+#    define I32_CONSTANT_ARITHMETIC(ins, op)                                                          \
+    handle_##ins:                                                                                     \
+    tos = static_cast<int32_t>(static_cast<int32_t>(tos) op static_cast<int32_t>(pc->immediate)); \
+    NEXT(ins);
+#    define I64_CONSTANT_ARITHMETIC(ins, op) \
+    handle_##ins:                            \
+    tos = tos op pc->immediate;              \
+    NEXT(ins);
+#    define COMPARE_AND_JUMP_IF_FALSE(ins, type, op)  \
+    handle_##ins : {                                  \
+        auto lhs = *(type*)mStack.get(8);             \
+        bool val = lhs op static_cast<type>(tos);     \
+        mStack.pop(16);                               \
+        RELOAD_TOS();                                 \
+        if(!val) {                                    \
+            pc = code + pc->param1;                   \
+            DISPATCH();                               \
+        }                                             \
+        NEXT(ins);                                    \
+    }
+#else
+#    define I32_CONSTANT_ARITHMETIC(ins, op)                                                    \
+    handle_##ins:                                                                               \
+    *(int32_t*)mStack.get(0) = *(int32_t*)mStack.get(0) op static_cast<int32_t>(pc->immediate); \
+    NEXT(ins);
+#    define I64_CONSTANT_ARITHMETIC(ins, op)                                \
+    handle_##ins:                                                           \
+    *(int64_t*)mStack.get(0) = *(int64_t*)mStack.get(0) op pc->immediate; \
+    NEXT(ins);
+#    define COMPARE_AND_JUMP_IF_FALSE(ins, type, op) \
+    handle_##ins : {                                 \
+        auto lhs = *(type*)mStack.get(sizeof(type)); \
+        auto rhs = *(type*)mStack.get(0);            \
+        mStack.pop(2 * sizeof(type));                \
+        if(!(lhs op rhs)) {                          \
+            pc = code + pc->param1;                  \
+            DISPATCH();                              \
+        }                                            \
+        NEXT(ins);                                   \
+    }
+#endif
+#define I32_COMPARE_AND_JUMP_IF_FALSE(ins, op) COMPARE_AND_JUMP_IF_FALSE(ins, int32_t, op)
+    I32_CONSTANT_ARITHMETIC(ADD_I32_CONSTANT, +)
+    I32_CONSTANT_ARITHMETIC(SUB_I32_CONSTANT, -)
+    I32_CONSTANT_ARITHMETIC(MUL_I32_CONSTANT, *)
+    I32_CONSTANT_ARITHMETIC(DIV_I32_CONSTANT, /)
+    I64_CONSTANT_ARITHMETIC(ADD_I64_CONSTANT, +)
+    I64_CONSTANT_ARITHMETIC(SUB_I64_CONSTANT, -)
+    I64_CONSTANT_ARITHMETIC(MUL_I64_CONSTANT, *)
+    I64_CONSTANT_ARITHMETIC(DIV_I64_CONSTANT, /)
+    I32_COMPARE_AND_JUMP_IF_FALSE(COMPARE_LESS_THAN_I32_AND_JUMP_IF_FALSE, <)
+    I32_COMPARE_AND_JUMP_IF_FALSE(COMPARE_MORE_THAN_I32_AND_JUMP_IF_FALSE, >)
+    I32_COMPARE_AND_JUMP_IF_FALSE(COMPARE_LESS_EQUAL_THAN_I32_AND_JUMP_IF_FALSE, <=)
+    I32_COMPARE_AND_JUMP_IF_FALSE(COMPARE_MORE_EQUAL_THAN_I32_AND_JUMP_IF_FALSE, >=)
+    I32_COMPARE_AND_JUMP_IF_FALSE(COMPARE_EQUALS_I32_AND_JUMP_IF_FALSE, ==)
+    I32_COMPARE_AND_JUMP_IF_FALSE(COMPARE_NOT_EQUALS_I32_AND_JUMP_IF_FALSE, !=)
+    COMPARE_AND_JUMP_IF_FALSE(COMPARE_LESS_THAN_I64_AND_JUMP_IF_FALSE, int64_t, <)
+    COMPARE_AND_JUMP_IF_FALSE(COMPARE_MORE_THAN_I64_AND_JUMP_IF_FALSE, int64_t, >)
+    COMPARE_AND_JUMP_IF_FALSE(COMPARE_LESS_EQUAL_THAN_I64_AND_JUMP_IF_FALSE, int64_t, <=)
+    COMPARE_AND_JUMP_IF_FALSE(COMPARE_MORE_EQUAL_THAN_I64_AND_JUMP_IF_FALSE, int64_t, >=)
+    COMPARE_AND_JUMP_IF_FALSE(COMPARE_EQUALS_I64_AND_JUMP_IF_FALSE, int64_t, ==)
+    COMPARE_AND_JUMP_IF_FALSE(COMPARE_NOT_EQUALS_I64_AND_JUMP_IF_FALSE, int64_t, !=)
+handle_IS_LIST_EMPTY_AND_JUMP_IF_FALSE : {
+#ifdef x86_64_BIT_MODE
+    bool isEmpty = tos == 0;
+    POP_TOS();
+#else
+    bool isEmpty = *(void**)mStack.get(0) == nullptr;
+    mStack.pop(8);
+#endif
+    if(!isEmpty) {
+        pc = code + pc->param1;
+        DISPATCH();
+    }
+    NEXT(IS_LIST_EMPTY_AND_JUMP_IF_FALSE);
+}
+handle_REPUSH_AND_LOAD_FROM_PTR : {
+    auto size = pc->param2;
+    auto offset = pc->param3;
+#ifdef x86_64_BIT_MODE
+    auto ptr = (uint8_t*)(pc->param1 == 0 ? tos : *(int64_t*)mStack.get(pc->param1));
+#else
+    auto ptr = *(uint8_t**)mStack.get(pc->param1);
+#endif
+    if(ptr == nullptr) {
+        FLUSH_TOS();
+        SYNC_IP();
+        throw std::runtime_error{ "Trying to access :head of empty list" };
+    }
+    ptr = getListNode(ptr);
+#ifdef x86_64_BIT_MODE
+    if(size == 8) {
+        PUSH_TOS(*(int64_t*)(ptr + offset));
+        NEXT(REPUSH_AND_LOAD_FROM_PTR);
+    }
+#endif
+    FLUSH_TOS();
+    mStack.push(ptr + offset, size);
+    RELOAD_TOS();
+    NEXT(REPUSH_AND_LOAD_FROM_PTR);
+}
+#undef I32_CONSTANT_ARITHMETIC
+#undef I64_CONSTANT_ARITHMETIC
+#undef COMPARE_AND_JUMP_IF_FALSE
+#undef I32_COMPARE_AND_JUMP_IF_FALSE
+
+#undef DISPATCH
+#undef NEXT
+#undef SYNC_IP
+#undef FLUSH_TOS
+#undef RELOAD_TOS
+#ifdef x86_64_BIT_MODE
+#    undef PUSH_TOS
+#    undef POP_TOS
+#endif
+#undef ARITHMETIC_I32
+#undef COMPARE_I32
+#undef LOGICAL_BINARY
+#undef ARITHMETIC_I64
+#undef COMPARE_I64
+}
 ExternalVMValue VM::run(const std::string& functionName, const std::vector<ExternalVMValue>& params) {
     std::vector<uint8_t> stack(8);
     auto returnValueIP = static_cast<uint32_t>(mProgram.code.size());
@@ -1266,6 +2812,35 @@ std::string VM::dumpVariablesOnStack() {
     return ret;
 }
 void VM::generateStacktrace(const std::function<void(const uint8_t* ptr, const Datatype&, const std::string& name)>& variableCallback, const std::function<void(const std::string&)>& functionCallback) const {
+    walkStack([&](const uint8_t* ptr, const StackInformationTree& node) {
+        if(variableCallback)
+            variableCallback(ptr, node.getVarEntry()->datatype, node.getVarEntry()->name);
+    }, functionCallback);
+}
+void VM::forEachStackRoot(const std::function<void(uint8_t* ptr, int32_t pointerMapIndex)>& callback) const {
+    int32_t ip = mIp;
+    int32_t offsetFromTop = 0;
+    while(true) {
+        const auto* map = mProgram.findStackMap(ip);
+        if(!map) {
+            // every frame is either at a RUN_GC or at the return address of a CALL, so missing roots would corrupt the heap
+            throw std::runtime_error{ "No stack map for ip " + std::to_string(ip) };
+        }
+        auto* frame = mStack.getTopPtr() + offsetFromTop;
+        for(int32_t i = map->firstRoot; i < map->firstRoot + map->rootCount; ++i) {
+            const auto& root = mProgram.stackMapRoots[i];
+            callback(const_cast<uint8_t*>(frame + root.offset), root.pointerMapIndex);
+        }
+        int32_t prevIp;
+        memcpy(&prevIp, frame + map->frameSize + 4, 4);
+        if(prevIp == static_cast<int32_t>(mProgram.code.size())) {
+            break;
+        }
+        offsetFromTop += map->frameSize - map->returnValueSize + 8;
+        ip = prevIp;
+    }
+}
+void VM::walkStack(const std::function<void(const uint8_t* ptr, const StackInformationTree& node)>& variableCallback, const std::function<void(const std::string&)>& functionCallback) const {
     int32_t ip = mIp;
     int32_t offsetFromTop = 0;
     bool firstIteration = true;
@@ -1300,8 +2875,7 @@ void VM::generateStacktrace(const std::function<void(const uint8_t* ptr, const D
                     // check that the variable isn't assigned to the return value of the function;
                     // this would not be valid because the function actually hasn't returned yet
                     if(!(!firstIteration && stackInfo->getIp() == ip)) {
-                        if(variableCallback)
-                            variableCallback(mStack.getTopPtr() + virtualStackSize - stackInfo->getStackSize() + offsetFromTop, variable->datatype, variable->name);
+                        variableCallback(mStack.getTopPtr() + virtualStackSize - stackInfo->getStackSize() + offsetFromTop, *stackInfo);
                     }
                 }
             }
@@ -1328,29 +2902,76 @@ void VM::generateStacktrace(const std::function<void(const uint8_t* ptr, const D
 }
 void VM::execNativeFunction(int32_t nativeFuncId) {
     auto& nativeFunc = mProgram.nativeFunctions.at(nativeFuncId);
-    const auto& functionTypeInfo = nativeFunc.functionType.getFunctionTypeInfo();
-    auto returnTypeSize = functionTypeInfo.first.getSizeOnStack();
+    const auto& layout = mNativeFunctionLayouts.at(nativeFuncId);
+    const auto returnTypeSize = layout.returnTypeSize;
+    const auto* params = static_cast<const uint8_t*>(mStack.get(0));
 
-    size_t sumOfParamSizes = 0;
-    for(auto& param: functionTypeInfo.second) {
-        sumOfParamSizes += param.getSizeOnStack();
-    }
-    std::vector<ExternalVMValue> params;
-    params.reserve(functionTypeInfo.second.size());
-    size_t offset = 0;
-    for(auto& paramType : functionTypeInfo.second) {
-        offset += paramType.getSizeOnStack();
-        params.emplace_back(ExternalVMValue::wrapStackedValue(paramType, *this, sumOfParamSizes - offset));
+    // the parameters stay on the stack until the callback returns so that stack traces are still correct
+    if(nativeFunc.rawCallback) {
+        int64_t args[NativeFunction::MAX_RAW_CALLBACK_PARAMS]{};
+        for(size_t i = 0; i < layout.paramOffsets.size(); ++i) {
+            memcpy(&args[i], params + layout.paramOffsets.at(i), layout.paramSizes.at(i));
+        }
+        int64_t returnValue = nativeFunc.rawCallback(*this, args[0], args[1], args[2], args[3], args[4]);
+        mStack.pop(layout.sumOfParamSizes);
+        if(returnTypeSize > 0)
+            mStack.push(&returnValue, returnTypeSize);
+        mStack.popBelow(returnTypeSize, 8);
+        return;
     }
-
-    mStack.pop(offset);
-    auto returnValue = nativeFunc.callback(*this, params);
-    assert(returnValue.getDatatype() == functionTypeInfo.first);
-    auto returnValueBytes = returnValue.toStackValue(*this);
-    if(!returnValueBytes.empty())
-        mStack.push(returnValueBytes.data(), returnValueBytes.size());
+    if(returnTypeSize > 0)
+        memset(mNativeReturnValue.data(), 0, returnTypeSize);
+    NativeCallFrame frame{ *this, nativeFunc, layout.paramOffsets.data(), params, mNativeReturnValue.data() };
+    nativeFunc.frameCallback(frame);
+    mStack.pop(layout.sumOfParamSizes);
+    if(returnTypeSize > 0)
+        mStack.push(mNativeReturnValue.data(), returnTypeSize);
     mStack.popBelow(returnTypeSize, 8);
 }
+void VM::execCreateLambda(int32_t capturedDataSize, int32_t lambdaCapturedTypesId) {
+    auto* dataOnHeap = (uint8_t*)mGC.alloc(capturedDataSize + 16);
+    // store length of buffer & ip of the function on the stack
+    ((int32_t*)dataOnHeap)[0] = capturedDataSize;
+    ((int32_t*)dataOnHeap)[1] = *(int32_t*)mStack.get(capturedDataSize);
+    ((int32_t*)dataOnHeap)[2] = lambdaCapturedTypesId;
+    ((int32_t*)dataOnHeap)[3] = 1;
+    memcpy(dataOnHeap + 16, mStack.get(0), capturedDataSize);
+    mStack.pop(capturedDataSize + 8);
+    mStack.push(&dataOnHeap, 8);
+}
+void VM::execCreateList(int32_t elementSize, int32_t elementCount) {
+    uint8_t* firstPtr = nullptr;
+    uint8_t* ptrToPreviousElement = nullptr;
+    for(int i = 0; i < elementCount; ++i) {
+        int32_t elementOffset = (elementCount - i - 1) * elementSize;
+        auto* dataOnHeap = (uint8_t*)mGC.alloc(elementSize + 8);
+        if(firstPtr == nullptr)
+            firstPtr = dataOnHeap;
+
+        memcpy(dataOnHeap + 8, mStack.get(elementOffset), elementSize);
+        if(ptrToPreviousElement) {
+            memcpy(ptrToPreviousElement, &dataOnHeap, 8);
+        }
+        ptrToPreviousElement = dataOnHeap;
+    }
+    // let the last element point to nullptr
+    if(ptrToPreviousElement)
+        memset(ptrToPreviousElement, 0, 8);
+    mStack.pop(elementSize * elementCount);
+    mStack.push(&firstPtr, 8);
+}
+void VM::execCompareComplexEquality(int32_t datatypeIndex) {
+#ifdef x86_64_BIT_MODE
+    constexpr int32_t BOOL_SIZE = 8;
+#else
+    constexpr int32_t BOOL_SIZE = 1;
+#endif
+    const auto& comparator = *mEqualityComparators[datatypeIndex];
+    auto datatypeSize = comparator.getSizeOnStack();
+    int64_t result = comparator.equals((uint8_t*)mStack.get(0), (uint8_t*)mStack.get(datatypeSize));
+    mStack.pop(datatypeSize * 2);
+    mStack.push(&result, BOOL_SIZE);
+}
 int32_t VM::getIp() const {
     return mIp;
 }
@@ -1,13 +1,27 @@
 #define CATCH_CONFIG_ENABLE_BENCHMARKING
 #include "samal_lib/AST.hpp"
+#include "samal_lib/Bytes.hpp"
 #include "samal_lib/Compiler.hpp"
 #include "samal_lib/ExternalVMValue.hpp"
+#include "samal_lib/NativeCallFrame.hpp"
 #include "samal_lib/Parser.hpp"
+#include "samal_lib/Pipeline.hpp"
 #include "samal_lib/VM.hpp"
+#include <algorithm>
 #include <catch2/catch.hpp>
 #include <charconv>
+#include <cstdlib>
 #include <iostream>
 
+// In JIT builds, ctest runs the suite a second time with SAMAL_TEST_JIT_REGISTER_ALLOCATION set, which turns on the
+// register allocation of the JIT in every VM created by the tests (see tests/CMakeLists.txt)
+samal::VMParameters testParameters(samal::VMParameters params = {}) {
+    if(std::getenv("SAMAL_TEST_JIT_REGISTER_ALLOCATION")) {
+        params.jitRegisterAllocation = true;
+    }
+    return params;
+}
+
 samal::VM compileSimple(const char* code, samal::VMParameters params = {}) {
     samal::Parser parser;
     auto ast = parser.parse("Main", code);
@@ -18,7 +32,28 @@ samal::VM compileSimple(const char* code, samal::VMParameters params = {}) {
     auto program = comp.compile();
     auto disassembly = program.disassemble();
     printf("Code: %s\n", disassembly.c_str());
-    return samal::VM{ std::move(program), params };
+    return samal::VM{ std::move(program), testParameters(params) };
+}
+
+// A small heap collected in each mode of the GC: plain copying, generational, parallel and incremental
+std::vector<samal::VMParameters> allGCConfigurations(int32_t callsPerGCRun) {
+    return {
+        samal::VMParameters{ .functionsCallsPerGCRun = callsPerGCRun, .initialHeapSize = 1024 },
+        samal::VMParameters{ .functionsCallsPerGCRun = callsPerGCRun, .initialHeapSize = 1024, .nurserySize = 4096 },
+        samal::VMParameters{ .functionsCallsPerGCRun = callsPerGCRun, .initialHeapSize = 1024, .gcThreads = 4 },
+        samal::VMParameters{ .functionsCallsPerGCRun = callsPerGCRun, .initialHeapSize = 1024, .nurserySize = 4096, .gcPauseBudget = std::chrono::microseconds{ 1 } }
+    };
+}
+
+// compiles the code as the module Main together with samal_code/lib/Bytes.samal and the native functions it declares
+samal::VM compileWithBytes(const char* code, samal::VMParameters params = {}) {
+    samal::Pipeline pl;
+    pl.addFile(SAMAL_LIB_DIR "/Bytes.samal");
+    pl.addFileFromMemory("Main", code);
+    for(auto& function : samal::createBytesNativeFunctions()) {
+        pl.addNativeFunction(std::move(function));
+    }
+    return pl.compile(testParameters(params));
 }
 
 TEST_CASE("Ensure that fib64 works", "[samal_whole_system]") {
@@ -486,7 +521,1229 @@ fn test() -> [bool] {
     REQUIRE(vmRet.dump() == R"([true, true, true, true, false, true, true])");
 }
 
+TEST_CASE("== for tuples, structs, enums and nested lists", "[samal_whole_system]") {
+    auto vm = compileSimple(R"(
+struct Request {
+    url : [char],
+    id : i32,
+    keepAlive : bool
+}
+enum Tree {
+    Branch{$Tree, i64, $Tree},
+    Leaf{}
+}
+fn test() -> [bool] {
+    r = Request{url : "/index", id : 5, keepAlive : true}
+    t = Tree::Branch{$Tree::Leaf{}, 5i64, $Tree::Branch{$Tree::Leaf{}, 3i64, $Tree::Leaf{}}}
+    t2 = Tree::Branch{$Tree::Leaf{}, 5i64, $Tree::Branch{$Tree::Leaf{}, 4i64, $Tree::Leaf{}}}
+    [
+        (1, 'a', 2i64) == (1, 'a', 2i64),
+        (1, 'a', 2i64) == (1, 'b', 2i64),
+        r == Request{url : "/index", id : 5, keepAlive : true},
+        r == Request{url : "/index2", id : 5, keepAlive : true},
+        r != Request{url : "/index", id : 5, keepAlive : false},
+        t == Tree::Branch{$Tree::Leaf{}, 5i64, $Tree::Branch{$Tree::Leaf{}, 3i64, $Tree::Leaf{}}},
+        t == t2,
+        t == Tree::Leaf{},
+        [[1, 2], [:i32], [3]] == [[1, 2], [:i32], [3]],
+        [[1, 2], [:i32], [3]] == [[1, 2], [3], [:i32]],
+        ["ab", "c"] == ["ab", "c"]
+    ]
+}
+)");
+    auto vmRet = vm.run("Main.test", std::vector<samal::ExternalVMValue>{ });
+    REQUIRE(vmRet.dump() == R"([true, false, true, false, true, true, false, false, true, false, true])");
+}
+
+TEST_CASE("== is rejected for values containing functions", "[samal_whole_system]") {
+    REQUIRE_THROWS(compileSimple(R"(
+fn test() -> bool {
+    a = fn(x : i32) -> i32 {
+        x + 1
+    }
+    b = fn(x : i32) -> i32 {
+        x + 2
+    }
+    (1, a) == (1, b)
+})"));
+    // also inside lists in recursive types
+    REQUIRE_THROWS(compileSimple(R"(
+struct Handler {
+    callback : fn(i32) -> i32,
+    children : [Handler]
+}
+fn test(h : Handler) -> bool {
+    h:children != h:children
+})"));
+}
+
+TEST_CASE("Switch and threaded interpreter return the same results", "[samal_whole_system]") {
+    const char* code = R"(
+fn fib32(n : i32) -> i32 {
+    if n < 2 {
+        n
+    } else {
+        fib32(n - 1) + fib32(n - 2)
+    }
+}
+fn concat<T>(l1 : [T], l2 : [T]) -> [T] {
+    if l1 == [] {
+        l2
+    } else {
+        l1:head + concat<T>(l1:tail, l2)
+    }
+}
+fn test() -> ([char], bool) {
+    greeting = concat("Hallo", "Welt")
+    (greeting, greeting == "HalloWelt")
+})";
+    for(auto mode : { samal::InterpreterMode::Switch, samal::InterpreterMode::Threaded }) {
+        auto vm = compileSimple(code, samal::VMParameters{ .interpreterMode = mode });
+        REQUIRE(vm.run("Main.fib32", { samal::ExternalVMValue::wrapInt32(vm, 15) }).dump() == "610");
+        REQUIRE(vm.run("Main.test", std::vector<samal::ExternalVMValue>{}).dump() == R"(("HalloWelt", true))");
+    }
+}
+
+TEST_CASE("The threaded interpreter decodes operands and maps return addresses back", "[samal_whole_system]") {
+    // big uses 64 bit operands that don't fit into 32 bits, trace walks the return addresses on the stack, which stay
+    // offsets into Program::code even though the threaded interpreter runs on the decoded instructions
+    const char* code = R"(
+native fn trace() -> i32
+fn big(a : i64) -> i64 {
+    a * 3i64 + 5000000000i64 - (0i64 - 7000000000i64)
+}
+fn inner(n : i32) -> i32 {
+    if n == 0 {
+        trace()
+    } else {
+        inner(n - 1) + 1
+    }
+}
+fn outer(f : fn(i32) -> i32) -> i32 {
+    f(3)
+}
+fn test() -> (i64, i32) {
+    (big(4000000000i64), outer(inner))
+})";
+    for(auto mode : { samal::InterpreterMode::Switch, samal::InterpreterMode::Threaded }) {
+        samal::Parser parser;
+        auto ast = parser.parse("Main", code);
+        REQUIRE(ast.first);
+        std::vector<samal::up<samal::ModuleRootNode>> modules;
+        modules.emplace_back(std::move(ast.first));
+        using samal::Datatype;
+        using samal::DatatypeCategory;
+        std::vector<std::string> functions;
+        std::vector<samal::NativeFunction> natives;
+        natives.emplace_back(samal::NativeFunction{
+            "Main.trace",
+            Datatype::createFunctionType(Datatype::createSimple(DatatypeCategory::i32), {}),
+            {},
+            nullptr,
+            [&functions](samal::NativeCallFrame& frame) {
+                frame.getVM().generateStacktrace(nullptr, [&functions](const std::string& name) {
+                    functions.push_back(name);
+                });
+                frame.setReturn(int32_t{ 0 });
+            } });
+        samal::Compiler comp{ modules, std::move(natives) };
+        samal::VM vm{ comp.compile(), testParameters(samal::VMParameters{ .interpreterMode = mode }) };
+        REQUIRE(vm.run("Main.test", std::vector<samal::ExternalVMValue>{}).dump() == "(24000000000i64, 3)");
+        REQUIRE(functions == std::vector<std::string>{ "Main.inner", "Main.inner", "Main.inner", "Main.inner", "Main.outer", "Main.test" });
+    }
+}
+
+// the interpreter ignores jitRegisterAllocation, so this also checks the expected results
+TEST_CASE("JIT register allocation returns the same results", "[samal_whole_system]") {
+    // deep keeps more slots alive than there are registers for them, acrossCalls keeps values in registers while
+    // calling and sumLoop jumps back to the start of a block
+    const char* code = R"(
+fn fib64(n : i64) -> i64 {
+    if n < 2i64 {
+        n
+    } else {
+        fib64(n - 1i64) + fib64(n - 2i64)
+    }
+}
+fn poly(a : i32, b : i32) -> i32 {
+    (a * a + 3 * b) / (a - b) % 7
+}
+fn len(l : [i64]) -> i32 {
+    if l == [] {
+        0
+    } else {
+        1 + len(l:tail)
+    }
+}
+fn lenTest() -> i32 {
+    len([1i64, 2i64, 3i64])
+}
+fn deep(a : i64, b : i64, c : i64, d : i64, e : i64) -> i64 {
+    a + (b * (c - (d + (e * (a - (b + (c * d)))))))
+}
+fn twice(n : i32) -> i32 {
+    n * 2
+}
+fn acrossCalls(n : i32) -> i32 {
+    n * 3 + twice(n + 1) * (n - twice(n - 2))
+}
+fn sumLoop(n : i32, acc : i64) -> i64 {
+    if n == 0 {
+        acc
+    } else {
+        @tail_call_self(n - 1, acc + deep(1i64, 2i64, 3i64, 4i64, 5i64))
+    }
+})";
+    for(bool registerAllocation : { false, true }) {
+        auto vm = compileSimple(code, samal::VMParameters{ .jitRegisterAllocation = registerAllocation });
+        REQUIRE(vm.run("Main.fib64", { samal::ExternalVMValue::wrapInt64(vm, 15) }).dump() == "610i64");
+        REQUIRE(vm.run("Main.poly", { samal::ExternalVMValue::wrapInt32(vm, 9), samal::ExternalVMValue::wrapInt32(vm, 4) }).dump() == "4");
+        REQUIRE(vm.run("Main.lenTest", std::vector<samal::ExternalVMValue>{}).dump() == "3");
+        REQUIRE(vm.run("Main.deep", { samal::ExternalVMValue::wrapInt64(vm, 1), samal::ExternalVMValue::wrapInt64(vm, 2), samal::ExternalVMValue::wrapInt64(vm, 3), samal::ExternalVMValue::wrapInt64(vm, 4), samal::ExternalVMValue::wrapInt64(vm, 5) }).dump() == "129i64");
+        REQUIRE(vm.run("Main.acrossCalls", { samal::ExternalVMValue::wrapInt32(vm, 10) }).dump() == "-102");
+        REQUIRE(vm.run("Main.sumLoop", { samal::ExternalVMValue::wrapInt32(vm, 100), samal::ExternalVMValue::wrapInt64(vm, 0) }).dump() == "12900i64");
+#ifdef SAMAL_ENABLE_JIT
+        // every instruction is jittable, so the native code is only left by returning
+        for(auto& transitions : vm.getJitStatistics().transitionsPerFunction) {
+            REQUIRE(transitions.exits == 0);
+        }
+#endif
+    }
+}
+
+// the interpreter ignores the JIT parameters, so this also checks the expected results
+TEST_CASE("Tiered JIT returns the same results", "[samal_whole_system]") {
+    // fib64 uses a fused compare-and-branch and statically linked calls, test calls a raw native callback
+    const char* code = R"(
+native fn offset(n : i64) -> i64
+fn fib64(n : i64) -> i64 {
+    if n < 2i64 {
+        n
+    } else {
+        fib64(n - 1i64) + fib64(n - 2i64)
+    }
+}
+fn countdown(n : i32) -> i32 {
+    if n > 0 {
+        @tail_call_self(n - 1)
+    } else {
+        42
+    }
+}
+fn test(n : i64) -> i64 {
+    offset(fib64(n))
+})";
+    for(bool registerAllocation : { false, true }) {
+        for(int32_t threshold : { 0, 1, 10, 1000 }) {
+            samal::Parser parser;
+            auto ast = parser.parse("Main", code);
+            REQUIRE(ast.first);
+            std::vector<samal::up<samal::ModuleRootNode>> modules;
+            modules.emplace_back(std::move(ast.first));
+            using samal::Datatype;
+            using samal::DatatypeCategory;
+            const auto i64Type = Datatype::createSimple(DatatypeCategory::i64);
+            std::vector<samal::NativeFunction> natives;
+            natives.emplace_back(samal::NativeFunction{
+                "Main.offset",
+                Datatype::createFunctionType(i64Type, { i64Type }),
+                {},
+                [](samal::VM&, int64_t n, int64_t, int64_t, int64_t, int64_t) -> int64_t {
+                    return n + 1;
+                } });
+            samal::Compiler comp{ modules, std::move(natives) };
+            samal::VM vm{ comp.compile(), testParameters(samal::VMParameters{ .jitRegisterAllocation = registerAllocation, .jitTierUpThreshold = threshold }) };
+            REQUIRE(vm.run("Main.test", { samal::ExternalVMValue::wrapInt64(vm, 15) }).dump() == "611i64");
+            REQUIRE(vm.run("Main.countdown", { samal::ExternalVMValue::wrapInt32(vm, 100) }).dump() == "42");
+#ifdef SAMAL_ENABLE_JIT
+            const auto& statistics = vm.getJitStatistics();
+            if(threshold == 0) {
+                // the whole program is compiled up front and every instruction in it is jittable, so the native code
+                // is only left by returning from the called function
+                REQUIRE(statistics.tierUpEvents.empty());
+                for(auto& transitions : statistics.transitionsPerFunction) {
+                    REQUIRE(transitions.exits == 0);
+                }
+                continue;
+            }
+            // fib64(15) is called almost 2000 times, countdown(100) only jumps backwards 100 times
+            auto fib64TierUp = std::find_if(statistics.tierUpEvents.cbegin(), statistics.tierUpEvents.cend(), [](auto& event) {
+                return event.functionName == "Main.fib64";
+            });
+            REQUIRE(fib64TierUp != statistics.tierUpEvents.cend());
+            REQUIRE(fib64TierUp->hotness == threshold);
+            for(auto& event : statistics.tierUpEvents) {
+                REQUIRE(event.hotness >= threshold);
+                REQUIRE((threshold < 100 || event.functionName != "Main.countdown"));
+            }
+#endif
+        }
+    }
+}
+
+TEST_CASE("The JIT is only left for instructions it can't execute", "[samal_whole_system]") {
+    // creating a Circle needs an INCREASE_STACK_SIZE, which is always interpreted
+    const char* code = R"(
+enum Shape {
+    Circle{i32},
+    Rectangle{i32, i32}
+}
+fn radius(shape : Shape) -> i32 {
+    match shape {
+        Circle{r} -> r,
+        Rectangle{w, h} -> w
+    }
+}
+fn sumRadii(n : i32) -> i32 {
+    if n > 0 {
+        radius(Shape::Circle{n}) + sumRadii(n - 1)
+    } else {
+        0
+    }
+})";
+    for(bool registerAllocation : { false, true }) {
+        for(int32_t threshold : { 0, 1 }) {
+            auto vm = compileSimple(code, samal::VMParameters{ .jitRegisterAllocation = registerAllocation, .jitTierUpThreshold = threshold });
+            REQUIRE(vm.getProgram().disassemble().find("INCREASE_STACK_SIZE") != std::string::npos);
+            REQUIRE(vm.run("Main.sumRadii", { samal::ExternalVMValue::wrapInt32(vm, 50) }).dump() == "1275");
+#ifdef SAMAL_ENABLE_JIT
+            samal::JitStatistics::Transitions total;
+            for(auto& transitions : vm.getJitStatistics().transitionsPerFunction) {
+                total.entries += transitions.entries;
+                total.exits += transitions.exits;
+            }
+            if(threshold == 0) {
+                // every exit is followed by exactly one interpreted instruction after which the native code is entered
+                // again, even with register allocation where only block starts can be entered
+                REQUIRE(total.exits == 50);
+                REQUIRE(total.entries == 51);
+            } else {
+                // calls between the separately compiled functions leave the native code as well, but every entry still
+                // ends with an exit or with returning from sumRadii
+                REQUIRE_FALSE(vm.getJitStatistics().tierUpEvents.empty());
+                REQUIRE(total.exits >= 50);
+                REQUIRE(total.entries >= total.exits);
+                REQUIRE(total.entries <= total.exits + 1);
+            }
+#endif
+        }
+    }
+}
+
+TEST_CASE("Statically known callees are linked", "[samal_whole_system]") {
+    auto vm = compileSimple(R"(
+fn fib64(n : i64) -> i64 {
+    if n < 2i64 {
+        n
+    } else {
+        fib64(n - 1i64) + fib64(n - 2i64)
+    }
+}
+fn apply(f : fn(i64) -> i64, n : i64) -> i64 {
+    f(n)
+}
+fn test() -> i64 {
+    apply(fib64, 10i64)
+})");
+    // both calls in fib64 and the call of apply, but not the call of the parameter f
+    const auto& program = vm.getProgram();
+    REQUIRE(program.staticCallTargets.size() == 3);
+    for(auto& [callIp, target] : program.staticCallTargets) {
+        REQUIRE(static_cast<samal::Instruction>(program.code.at(callIp)) == samal::Instruction::CALL);
+        REQUIRE(static_cast<samal::Instruction>(program.code.at(target)) == samal::Instruction::RUN_GC);
+    }
+    REQUIRE(vm.run("Main.test", std::vector<samal::ExternalVMValue>{}).dump() == "55i64");
+}
+
+TEST_CASE("Calls through known callees and lambdas return the same results", "[samal_whole_system]") {
+    // fib64 and the calls of fib64, apply and adder are linked statically, f is a lambda that captured a; the small
+    // heap makes the GC move the lambda while loop still calls it
+    const char* code = R"(
+fn fib64(n : i64) -> i64 {
+    if n < 2i64 {
+        n
+    } else {
+        fib64(n - 1i64) + fib64(n - 2i64)
+    }
+}
+fn apply(f : fn(i64) -> i64, n : i64) -> i64 {
+    f(n)
+}
+fn adder(a : i64) -> fn(i64) -> i64 {
+    fn(b : i64) -> i64 {
+        a + b
+    }
+}
+fn loop(n : i32, f : fn(i64) -> i64, acc : i64) -> i64 {
+    if n == 0 {
+        acc
+    } else {
+        @tail_call_self(n - 1, f, f(acc) + fib64(5i64))
+    }
+}
+fn test() -> (i64, i64, i64) {
+    (fib64(20i64), apply(adder(5i64), 10i64), loop(100, adder(3i64), 0i64))
+})";
+    for(bool registerAllocation : { false, true }) {
+        auto vm = compileSimple(code, samal::VMParameters{ .functionsCallsPerGCRun = 10, .initialHeapSize = 1024, .jitRegisterAllocation = registerAllocation });
+        REQUIRE_FALSE(vm.getProgram().staticCallTargets.empty());
+        REQUIRE(vm.run("Main.test", std::vector<samal::ExternalVMValue>{}).dump() == "(6765i64, 15i64, 800i64)");
+        REQUIRE(vm.getGCStatistics().minorCollections + vm.getGCStatistics().majorCollections > 0);
+#ifdef SAMAL_ENABLE_JIT
+        // every instruction is jittable, so the native code is only left by returning
+        for(auto& transitions : vm.getJitStatistics().transitionsPerFunction) {
+            REQUIRE(transitions.exits == 0);
+        }
+#endif
+    }
+}
+
+TEST_CASE("Heap allocations that don't fit into the active region", "[samal_whole_system]") {
+    // the heap is so small that allocations are served from the region at first and then overflow
+    const char* code = R"(
+fn range(n : i32, l : [i32]) -> [i32] {
+    if n == 0 {
+        l
+    } else {
+        range(n - 1, n + l)
+    }
+}
+fn sum(l : [i32]) -> i32 {
+    if l == [] {
+        0
+    } else {
+        l:head + sum(l:tail)
+    }
+}
+fn adder(a : i32) -> fn(i32) -> i32 {
+    fn(b : i32) -> i32 {
+        a + b
+    }
+}
+fn test() -> i32 {
+    sum(range(20, [100, 200])) + adder(5)(6)
+})";
+    auto vm = compileSimple(code, samal::VMParameters{ .functionsCallsPerGCRun = 1000, .initialHeapSize = 128 });
+    REQUIRE(vm.run("Main.test", std::vector<samal::ExternalVMValue>{}).dump() == "521");
+}
+
+TEST_CASE("Overflow chunks are chained and take allocations larger than a chunk", "[samal_whole_system]") {
+    // big is larger than the first overflow chunk (1 MiB). Both halves of pair are created without a function call in
+    // between, so they end up in separate chunks that all have to survive the collection at the call of check.
+    const char* code = R"(
+fn grow(b : bytes, n : i32) -> bytes {
+    if n == 0 {
+        b
+    } else {
+        @tail_call_self(Bytes.concat(b, b), n - 1)
+    }
+}
+fn check(pair : (bytes, bytes), big : bytes) -> (i32, i32, bool) {
+    tail = Bytes.slice(pair:1, Bytes.len(big) - 1, Bytes.len(pair:1))
+    (Bytes.len(pair:0), Bytes.len(pair:1), tail == Bytes.fromString("lsamal") && Bytes.startsWith(pair:0, big))
+}
+fn test() -> (i32, i32, bool) {
+    big = grow(Bytes.fromString("samal"), 18)
+    pair = (Bytes.concat(big, big), Bytes.concat(big, Bytes.slice(big, 0, 5)))
+    check(pair, big)
+})";
+    for(int32_t nurserySize : { 0, 4096 }) {
+        auto vm = compileWithBytes(code, samal::VMParameters{ .initialHeapSize = 1024, .nurserySize = nurserySize });
+        REQUIRE(vm.run("Main.test", std::vector<samal::ExternalVMValue>{}).dump() == "(2621440, 1310725, true)");
+        auto& stats = vm.getGCStatistics();
+        REQUIRE(stats.overflowChunks >= 3);
+        REQUIRE(stats.peakHeapSize >= 2621440 + 1310725);
+    }
+}
+
+TEST_CASE("Allocations between two function calls can fill the allocation area", "[samal_whole_system]") {
+    // build creates 8 lists of 40 elements (5 KiB) without calling anything, so the GC can't run in between and the
+    // allocation area runs full; in JIT builds this takes the slow path of the inline allocation
+    std::string code = R"(
+fn sum(l : [i64], acc : i64) -> i64 {
+    if l == [] {
+        acc
+    } else {
+        @tail_call_self(l:tail, acc + l:head)
+    }
+}
+fn sumAll(l : [[i64]], acc : i64) -> i64 {
+    if l == [] {
+        acc
+    } else {
+        @tail_call_self(l:tail, acc + sum(l:head, 0i64))
+    }
+}
+fn test(n : i64) -> i64 {
+    sumAll(build(n), 0i64)
+}
+fn build(n : i64) -> [[i64]] {
+    [)";
+    for(int list = 0; list < 8; ++list) {
+        code += list == 0 ? "[" : ", [";
+        for(int element = 0; element < 40; ++element) {
+            code += (element == 0 ? "n + " : ", n + ") + std::to_string(list * 40 + element) + "i64";
+        }
+        code += "]";
+    }
+    code += "]\n}";
+    for(int32_t nurserySize : { 0, 4096 }) {
+        auto vm = compileSimple(code.c_str(), samal::VMParameters{ .initialHeapSize = 1024, .nurserySize = nurserySize });
+        // the sum of 0..319 plus 320 * n
+        REQUIRE(vm.run("Main.test", { samal::ExternalVMValue::wrapInt64(vm, 0) }).dump() == "51040i64");
+        REQUIRE(vm.run("Main.test", { samal::ExternalVMValue::wrapInt64(vm, 1000) }).dump() == "371040i64");
+        REQUIRE(vm.getGCStatistics().overflowChunks > 0);
+#ifdef SAMAL_ENABLE_JIT
+        // every instruction is jittable, so the native code is only left by returning
+        for(auto& transitions : vm.getJitStatistics().transitionsPerFunction) {
+            REQUIRE(transitions.exits == 0);
+        }
+#endif
+    }
+}
+
+TEST_CASE("Generational GC keeps old and young objects alive", "[samal_whole_system]") {
+    // config is allocated once and survives many minor collections, while each call of step creates garbage
+    const char* code = R"(
+struct Config {
+    name : [char],
+    factors : [i32]
+}
+fn sum(l : [i32]) -> i32 {
+    if l == [:i32] {
+        0
+    } else {
+        l:head + sum(l:tail)
+    }
+}
+fn step(config : Config, n : i32) -> i32 {
+    garbage = [n, n, n, n]
+    sum(config:factors) * n + sum(garbage) - 4 * n
+}
+fn loop(config : Config, n : i32, acc : i32) -> i32 {
+    if n == 0 {
+        acc
+    } else {
+        loop(config, n - 1, acc + step(config, n))
+    }
+}
+fn test() -> ([char], i32) {
+    config = Config{name : "config", factors : [1, 2, 3]}
+    (config:name, loop(config, 50, 0))
+})";
+    for(int32_t nurserySize : { 0, 64, 512 }) {
+        auto vm = compileSimple(code, samal::VMParameters{ .functionsCallsPerGCRun = 0, .initialHeapSize = 256, .nurserySize = nurserySize });
+        REQUIRE(vm.run("Main.test", std::vector<samal::ExternalVMValue>{}).dump() == R"(("config", 7650))");
+    }
+}
+
+TEST_CASE("GC runs once enough memory has been allocated", "[samal_whole_system]") {
+    // the function call limit is never reached, so the heap has to be collected and grown because of the allocations
+    const char* code = R"(
+fn range(n : i32, l : [i32]) -> [i32] {
+    if n == 0 {
+        l
+    } else {
+        range(n - 1, n + l)
+    }
+}
+fn sum(l : [i32]) -> i32 {
+    if l == [:i32] {
+        0
+    } else {
+        l:head + sum(l:tail)
+    }
+}
+fn loop(n : i32, acc : i32) -> i32 {
+    if n == 0 {
+        acc
+    } else {
+        loop(n - 1, acc + sum(range(100, [:i32])))
+    }
+}
+fn test() -> i32 {
+    loop(50, 0)
+})";
+    for(int32_t nurserySize : { 0, 512 }) {
+        auto vm = compileSimple(code, samal::VMParameters{ .functionsCallsPerGCRun = 1'000'000'000, .initialHeapSize = 256, .nurserySize = nurserySize });
+        REQUIRE(vm.run("Main.test", std::vector<samal::ExternalVMValue>{}).dump() == "252500");
+    }
+}
+
+TEST_CASE("GC handles deeply nested data structures", "[samal_whole_system]") {
+    // scanning these recursively would overflow the native stack
+    const char* code = R"(
+enum Chain {
+    Link{$Chain, [i32]},
+    End{}
+}
+fn build(n : i32, chain : Chain) -> Chain {
+    if n == 0 {
+        chain
+    } else {
+        @tail_call_self(n - 1, Chain::Link{$chain, [n]})
+    }
+}
+fn length(chain : Chain, acc : i32) -> i32 {
+    match chain {
+        Link{next, l} -> {
+            @tail_call_self(@next, acc + l:head)
+        },
+        End{} -> acc
+    }
+}
+fn test(n : i32) -> i32 {
+    chain = build(n, Chain::End{})
+    length(chain, 0)
+})";
+    for(int32_t nurserySize : { 0, 4096 }) {
+        auto vm = compileSimple(code, samal::VMParameters{ .functionsCallsPerGCRun = 1'000'000, .initialHeapSize = 1024, .nurserySize = nurserySize });
+        REQUIRE(vm.run("Main.test", { samal::ExternalVMValue::wrapInt32(vm, 20000) }).dump() == "200010000");
+    }
+}
+
+TEST_CASE("Parallel GC copies shared objects once", "[samal_whole_system]") {
+    // all entries point to the same shared value, which the workers might find at the same time
+    const char* code = R"(
+struct Entry {
+    id : i32,
+    name : [char],
+    shared : $i32,
+    f : fn(i32) -> i32
+}
+fn build(n : i32, shared : $i32, acc : [Entry]) -> [Entry] {
+    if n == 0 {
+        acc
+    } else {
+        f = fn(x : i32) -> i32 {
+            x + n
+        }
+        @tail_call_self(n - 1, shared, Entry{id : n, name : "entry", shared : shared, f : f} + acc)
+    }
+}
+fn sum(l : [Entry], acc : i32) -> i32 {
+    if l == [] {
+        acc
+    } else {
+        e = l:head
+        f = e:f
+        shared = e:shared
+        nameMatches = if e:name == "entry" {
+            1
+        } else {
+            0
+        }
+        @tail_call_self(l:tail, acc + f(e:id) + @shared + nameMatches)
+    }
+}
+fn test(n : i32) -> i32 {
+    l = build(n, $7, [:Entry])
+    sum(l, 0)
+})";
+    for(int32_t gcThreads : { 1, 4 }) {
+        for(int32_t nurserySize : { 0, 4096 }) {
+            auto vm = compileSimple(code, samal::VMParameters{ .functionsCallsPerGCRun = 100, .initialHeapSize = 1024, .nurserySize = nurserySize, .gcThreads = gcThreads });
+            REQUIRE(vm.run("Main.test", { samal::ExternalVMValue::wrapInt32(vm, 5000) }).dump() == "25045000");
+        }
+    }
+}
+
+TEST_CASE("Incremental GC keeps values alive that are only reachable from old copies", "[samal_whole_system]") {
+    // The list of entries ends up in the heap, which is then collected incrementally while rewrap walks it. Once rewrap
+    // has passed an entry, its payload is only reachable from the new list, which points to the copy in the from-space
+    // unless the payload has already been copied by a step.
+    const char* code = R"(
+struct Entry {
+    id : i32,
+    payload : $[i32]
+}
+fn build(n : i32, acc : [Entry]) -> [Entry] {
+    if n == 0 {
+        acc
+    } else {
+        @tail_call_self(n - 1, Entry{id : n, payload : $[n, n]} + acc)
+    }
+}
+fn rewrap(l : [Entry], acc : [$[i32]]) -> [$[i32]] {
+    if l == [] {
+        acc
+    } else {
+        e = l:head
+        @tail_call_self(l:tail, e:payload + acc)
+    }
+}
+fn sumPayloads(l : [$[i32]], acc : i32) -> i32 {
+    if l == [] {
+        acc
+    } else {
+        payload = @l:head
+        @tail_call_self(l:tail, acc + payload:head)
+    }
+}
+fn test(n : i32) -> i32 {
+    payloads = rewrap(build(n, [:Entry]), [:$[i32]])
+    sumPayloads(payloads, 0)
+})";
+    for(auto budget : { std::chrono::microseconds{ 1 }, std::chrono::microseconds{ 1000 } }) {
+        auto vm = compileSimple(code, samal::VMParameters{ .functionsCallsPerGCRun = 100, .initialHeapSize = 1024, .nurserySize = 4096, .gcPauseBudget = budget });
+        REQUIRE(vm.run("Main.test", { samal::ExternalVMValue::wrapInt32(vm, 5000) }).dump() == "12502500");
+        auto& stats = vm.getGCStatistics();
+        REQUIRE(stats.completedIncrementalCollections + stats.abandonedIncrementalCollections > 0);
+        REQUIRE(stats.getPausePercentile(0.5) <= stats.getPausePercentile(0.99));
+    }
+}
+
+TEST_CASE("GC statistics and callback", "[samal_whole_system]") {
+    const char* code = R"(
+fn range(n : i32, l : [i32]) -> [i32] {
+    if n == 0 {
+        l
+    } else {
+        @tail_call_self(n - 1, n + l)
+    }
+}
+fn sum(l : [i32], acc : i32) -> i32 {
+    if l == [] {
+        acc
+    } else {
+        @tail_call_self(l:tail, acc + l:head)
+    }
+}
+fn test() -> i32 {
+    sum(range(10000, [:i32]), 0)
+})";
+    for(int32_t nurserySize : { 0, 4096 }) {
+        auto vm = compileSimple(code, samal::VMParameters{ .functionsCallsPerGCRun = 1'000'000, .initialHeapSize = 1024, .nurserySize = nurserySize });
+        size_t callbackCalls = 0;
+        size_t bytesAllocated = 0;
+        std::chrono::nanoseconds totalPauseDuration{ 0 };
+        vm.setGCCallback([&](const samal::GCStatistics::Collection& collection) {
+            ++callbackCalls;
+            bytesAllocated += collection.bytesAllocated;
+            totalPauseDuration += collection.pauseDuration;
+            REQUIRE(collection.bytesSurvived <= collection.heapSize);
+        });
+        REQUIRE(vm.run("Main.test", std::vector<samal::ExternalVMValue>{}).dump() == "50005000");
+        auto& stats = vm.getGCStatistics();
+        REQUIRE(callbackCalls > 0);
+        REQUIRE(stats.recentCollections.size() == std::min(callbackCalls, samal::GCStatistics::MAX_RECENT_COLLECTIONS));
+        REQUIRE(stats.totalPauseDuration == totalPauseDuration);
+        REQUIRE(stats.maxPauseDuration <= stats.totalPauseDuration);
+        REQUIRE(stats.minorCollections + stats.majorCollections == callbackCalls);
+        REQUIRE(stats.bytesAllocated == bytesAllocated);
+        // each list node takes at least 12 bytes and most of them are allocated before the last collection
+        REQUIRE(stats.bytesAllocated >= 5000 * 12);
+        REQUIRE(stats.peakHeapSize > 2 * 1024);
+        if(nurserySize > 0) {
+            REQUIRE(stats.minorCollections > 0);
+        } else {
+            REQUIRE(stats.minorCollections == 0);
+        }
+    }
+
+    // with a collection at every function call, only the most recent ones are kept
+    auto vm = compileSimple(R"(
+fn count(n : i32) -> i32 {
+    if n == 0 {
+        0
+    } else {
+        1 + count(n - 1)
+    }
+})", samal::VMParameters{ .functionsCallsPerGCRun = 0 });
+    REQUIRE(vm.run("Main.count", { samal::ExternalVMValue::wrapInt32(vm, 2000) }).dump() == "2000");
+    auto& stats = vm.getGCStatistics();
+    REQUIRE(stats.majorCollections > samal::GCStatistics::MAX_RECENT_COLLECTIONS);
+    REQUIRE(stats.recentCollections.size() == samal::GCStatistics::MAX_RECENT_COLLECTIONS);
+    REQUIRE(stats.getPausePercentile(1.0) <= stats.maxPauseDuration);
+}
+
+TEST_CASE("Literal lists are created once", "[samal_whole_system]") {
+    const char* code = R"(
+fn sum(l : [i32], acc : i32) -> i32 {
+    if l == [] {
+        acc
+    } else {
+        @tail_call_self(l:tail, acc + l:head)
+    }
+}
+fn sumLiterals(n : i32, acc : i32) -> i32 {
+    if n == 0 {
+        acc
+    } else {
+        @tail_call_self(n - 1, acc + sum([1, 2, 3], 0))
+    }
+}
+fn build(n : i32, acc : [[char]]) -> [[char]] {
+    if n == 0 {
+        acc
+    } else {
+        @tail_call_self(n - 1, ('x' + "abc") + acc)
+    }
+}
+fn count(l : [[char]], acc : i32) -> i32 {
+    if l == [] {
+        acc
+    } else {
+        matches = if l:head:tail == "abc" {
+            1
+        } else {
+            0
+        }
+        @tail_call_self(l:tail, acc + matches)
+    }
+}
+fn test(n : i32) -> i32 {
+    count(build(n, [:[char]]), 0)
+})";
+    samal::Parser parser;
+    auto ast = parser.parse("Main", code);
+    REQUIRE(ast.first);
+    std::vector<samal::up<samal::ModuleRootNode>> modules;
+    modules.emplace_back(std::move(ast.first));
+    samal::Compiler comp{ modules, {} };
+    auto program = comp.compile();
+    // the two "abc" are the same list
+    REQUIRE(program.constantLists.size() == 2);
+
+    auto vm = compileSimple(code, samal::VMParameters{ .functionsCallsPerGCRun = 100, .initialHeapSize = 1024 });
+    REQUIRE(vm.run("Main.sumLiterals", { samal::ExternalVMValue::wrapInt32(vm, 5000), samal::ExternalVMValue::wrapInt32(vm, 0) }).dump() == "30000");
+    REQUIRE(vm.getGCStatistics().minorCollections + vm.getGCStatistics().majorCollections > 0);
+    REQUIRE(vm.getGCStatistics().bytesAllocated == 0);
+
+    // the prepended nodes point into the constant area, which the collections need to skip
+    for(auto params : allGCConfigurations(100)) {
+        auto gcVM = compileSimple(code, params);
+        REQUIRE(gcVM.run("Main.test", { samal::ExternalVMValue::wrapInt32(gcVM, 5000) }).dump() == "5000");
+    }
+}
+
+TEST_CASE("Packed lists behave like regular lists", "[samal_whole_system]") {
+    const char* code = R"(
+fn len(l : [char], acc : i32) -> i32 {
+    if l == [] {
+        acc
+    } else {
+        @tail_call_self(l:tail, acc + 1)
+    }
+}
+fn reverse(l : [char], acc : [char]) -> [char] {
+    if l == [] {
+        acc
+    } else {
+        @tail_call_self(l:tail, l:head + acc)
+    }
+}
+fn drop(l : [char], n : i32) -> [char] {
+    if n == 0 {
+        l
+    } else {
+        @tail_call_self(l:tail, n - 1)
+    }
+}
+fn test(s : [char]) -> [char] {
+    copy = reverse(reverse(s, [:char]), [:char])
+    rest = drop(s, 130)
+    if copy == s && len(s, 0) == 300 && len(rest, 0) == 170 && drop(copy, 130) == rest {
+        'x' + rest
+    } else {
+        "failed"
+    }
+}
+fn bytes(b : [byte]) -> [byte] {
+    if [b:tail:head] == [2b] {
+        b:tail
+    } else {
+        [:byte]
+    }
+})";
+    std::string string;
+    for(int i = 0; i < 300; ++i) {
+        string += static_cast<char>('a' + i % 26);
+    }
+    string.replace(200, 1, "\xC3\xA4");
+    std::vector<uint8_t> bytes;
+    for(int i = 0; i < 1000; ++i) {
+        bytes.push_back(static_cast<uint8_t>(i + 1));
+    }
+    // the chunks and the nodes pointing to them have to survive all kinds of collections
+    for(auto params : allGCConfigurations(10)) {
+        auto vm = compileSimple(code, params);
+        auto ret = vm.run("Main.test", { samal::ExternalVMValue::wrapString(vm, string) });
+        REQUIRE(ret.toCPPString() == "x" + string.substr(130));
+
+        auto retBytes = vm.run("Main.bytes", { samal::ExternalVMValue::wrapByteArray(vm, bytes.data(), bytes.size()) }).toByteBuffer();
+        REQUIRE(retBytes == std::vector<uint8_t>(bytes.begin() + 1, bytes.end()));
+    }
+}
+
+TEST_CASE("Packed lists are compared a chunk at a time", "[samal_whole_system]") {
+    const char* code = R"(
+fn reverse(l : [char], acc : [char]) -> [char] {
+    if l == [] {
+        acc
+    } else {
+        @tail_call_self(l:tail, l:head + acc)
+    }
+}
+fn equals(a : [char], b : [char]) -> bool {
+    a == b
+}
+fn tailEquals(a : [char], b : [char]) -> bool {
+    a:tail == b
+}
+fn copyEquals(a : [char], b : [char]) -> bool {
+    reverse(reverse(a, [:char]), [:char]) == b
+}
+fn bytesEquals(a : [byte], b : [byte]) -> bool {
+    a == b
+})";
+    std::string string;
+    for(int i = 0; i < 300; ++i) {
+        string += static_cast<char>('a' + i % 26);
+    }
+    auto changed = [&](size_t index) {
+        auto ret = string;
+        ret[index] = '!';
+        return ret;
+    };
+    std::vector<uint8_t> bytes;
+    for(int i = 0; i < 1000; ++i) {
+        bytes.push_back(static_cast<uint8_t>(i + 1));
+    }
+    auto vm = compileSimple(code);
+    auto check = [&](const char* function, const std::string& lhs, const std::string& rhs) {
+        return vm.run(function, { samal::ExternalVMValue::wrapString(vm, lhs), samal::ExternalVMValue::wrapString(vm, rhs) }).dump();
+    };
+    // the chunks of both sides start at the same element
+    REQUIRE(check("Main.equals", string, string) == "true");
+    REQUIRE(check("Main.equals", string, changed(250)) == "false");
+    REQUIRE(check("Main.equals", string, changed(299)) == "false");
+    REQUIRE(check("Main.equals", string, string.substr(0, 299)) == "false");
+    // the chunk boundaries are one element apart
+    REQUIRE(check("Main.tailEquals", "x" + string, string) == "true");
+    REQUIRE(check("Main.tailEquals", "x" + string, changed(127)) == "false");
+    REQUIRE(check("Main.tailEquals", "x" + string, changed(128)) == "false");
+    // a regular list against a packed one
+    REQUIRE(check("Main.copyEquals", string, string) == "true");
+    REQUIRE(check("Main.copyEquals", string, changed(200)) == "false");
+
+    auto changedBytes = bytes;
+    changedBytes[700] = 0;
+    auto wrapBytes = [&](const std::vector<uint8_t>& b) {
+        return samal::ExternalVMValue::wrapByteArray(vm, b.data(), b.size());
+    };
+    REQUIRE(vm.run("Main.bytesEquals", { wrapBytes(bytes), wrapBytes(bytes) }).dump() == "true");
+    REQUIRE(vm.run("Main.bytesEquals", { wrapBytes(bytes), wrapBytes(changedBytes) }).dump() == "false");
+}
+
+TEST_CASE("Bytes are contiguous and share their buffer when sliced", "[samal_whole_system]") {
+    const char* code = R"(
+fn grow(b : bytes, prefix : bytes, n : i32) -> (bytes, bytes) {
+    if n == 0 {
+        (b, prefix)
+    } else {
+        grow(Bytes.concat(b, Bytes.slice(b, 0, 1)), prefix, n - 1)
+    }
+}
+fn test(s : [char]) -> [char] {
+    b = Bytes.fromString(s)
+    hello = Bytes.fromString("hello ")
+    joined = Bytes.concat(hello, b)
+    rest = Bytes.slice(joined, 6, Bytes.len(joined))
+    grown = grow(rest, Bytes.slice(rest, 0, 2), 50)
+    if rest == b && Bytes.find(joined, b) == 6 && Bytes.find(b, hello) == (0 - 1)
+            && Bytes.compare(hello, joined) == (0 - 1) && Bytes.compare(joined, hello) == 1 && Bytes.compare(rest, b) == 0
+            && [Bytes.get(joined, 1)] == [101b] && Bytes.toList(Bytes.slice(joined, 0, 2)) == [104b, 101b]
+            && Bytes.fromList([104b, 101b]) == Bytes.slice(joined, 0, 2) && Bytes.len(grown:0) == Bytes.len(b) + 50
+            && grown:1 == Bytes.slice(b, 0, 2) && Bytes.fromList([:byte]) == Bytes.slice(b, 1, 1)
+            && Bytes.startsWith(joined, hello) && !Bytes.startsWith(hello, joined) && Bytes.isEmpty(Bytes.slice(b, 1, 1)) {
+        Bytes.toString(joined)
+    } else {
+        "failed"
+    }
+}
+fn middle(b : bytes) -> bytes {
+    Bytes.slice(b, 1, Bytes.len(b) - 1)
+}
+fn outOfRange(b : bytes) -> byte {
+    Bytes.get(b, Bytes.len(b))
+})";
+    const std::string string = "w\xC3\xB6rld";
+    const std::vector<uint8_t> data{ 1, 2, 3, 4 };
+    // slices have to keep pointing into the copy of their buffer after each kind of collection
+    for(auto params : allGCConfigurations(10)) {
+        auto vm = compileWithBytes(code, params);
+        REQUIRE(vm.run("Main.test", { samal::ExternalVMValue::wrapString(vm, string) }).toCPPString() == "hello " + string);
+
+        auto ret = vm.run("Main.middle", { samal::ExternalVMValue::wrapBytes(vm, data.data(), data.size()) });
+        REQUIRE(ret.dump() == "bytes[2, 3]");
+        REQUIRE(ret.toByteBuffer() == std::vector<uint8_t>{ 2, 3 });
+        REQUIRE_THROWS(vm.run("Main.outOfRange", { samal::ExternalVMValue::wrapBytes(vm, data.data(), data.size()) }));
+    }
+}
+
+TEST_CASE("Pointer maps are flattened", "[samal_whole_system]") {
+    auto vm = compileSimple(R"(
+fn test(p : (i32, [i32], (i64, $i32))) -> i32 {
+    p:0
+})");
+    // nested tuples don't get their own entry, only the list and the pointer in them
+    bool found = false;
+    for(auto& map : vm.getProgram().pointerMaps) {
+        if(map.entries.size() == 2 && map.entries.at(0).type == samal::PointerMap::Entry::Type::List && map.entries.at(1).type == samal::PointerMap::Entry::Type::Pointer) {
+            REQUIRE(vm.getProgram().pointerMaps.at(map.entries.at(0).target).entries.empty());
+            REQUIRE(map.entries.at(0).offset > map.entries.at(1).offset);
+            found = true;
+        }
+    }
+    REQUIRE(found);
+}
+
+TEST_CASE("Stack maps only contain variables with pointers", "[samal_whole_system]") {
+    auto vm = compileSimple(R"(
+fn scalars(a : i32, b : i64) -> i64 {
+    b
+}
+fn pointers(a : i32, l : [i32], p : $i32) -> i64 {
+    scalars(a, 5i64)
+}
+fn run(a : i32) -> i64 {
+    pointers(a, [:i32], $a)
+})");
+    auto& program = vm.getProgram();
+    for(size_t i = 1; i < program.stackMaps.size(); ++i) {
+        REQUIRE(program.stackMaps.at(i - 1).ip < program.stackMaps.at(i).ip);
+    }
+    for(auto& function : program.functions) {
+        // every function starts with RUN_GC
+        auto* map = program.findStackMap(function.offset);
+        REQUIRE(map);
+        if(function.name == "Main.scalars") {
+            REQUIRE(map->rootCount == 0);
+        } else if(function.name == "Main.pointers") {
+            REQUIRE(map->rootCount == 2);
+        }
+    }
+    auto vmRet = vm.run("Main.run", { samal::ExternalVMValue::wrapInt32(vm, 1) });
+    REQUIRE(vmRet.dump() == "5i64");
+}
+
+TEST_CASE("Superinstructions", "[samal_whole_system]") {
+    const char* code = R"(
+fn arithmetic(a : i32, b : i64) -> (i32, i64) {
+    (((a + 3) * 5 - 2) / 2, ((b + 3i64) * 5i64 - 2i64) / 2i64)
+}
+fn lessThan(a : i32, b : i32) -> i32 {
+    if a < b {
+        1
+    } else {
+        0
+    }
+}
+fn moreEqualThan(a : i32, b : i32) -> i32 {
+    if a >= b {
+        10
+    } else {
+        0
+    }
+}
+fn equals(a : i64, b : i64) -> i32 {
+    if a == b {
+        100
+    } else {
+        0
+    }
+}
+fn notEquals(a : i64, b : i64) -> i32 {
+    if a != b {
+        1000
+    } else {
+        0
+    }
+}
+fn compare(a : i32, b : i64) -> i32 {
+    lessThan(a, 5) + moreEqualThan(a, 5) + equals(b, 7i64) + notEquals(b, 7i64)
+}
+fn sum(l : [i32]) -> i32 {
+    if l == [] {
+        0
+    } else {
+        l:head + sum(l:tail)
+    }
+}
+fn sumTest() -> i32 {
+    sum([1, 2, 3, 4])
+})";
+    for(auto mode : { samal::InterpreterMode::Switch, samal::InterpreterMode::Threaded }) {
+        auto vm = compileSimple(code, samal::VMParameters{ .interpreterMode = mode });
+        auto disassembly = vm.getProgram().disassemble();
+        REQUIRE(disassembly.find("MUL_I32_CONSTANT") != std::string::npos);
+        REQUIRE(disassembly.find("DIV_I64_CONSTANT") != std::string::npos);
+        REQUIRE(disassembly.find("COMPARE_LESS_THAN_I32_AND_JUMP_IF_FALSE") != std::string::npos);
+        REQUIRE(disassembly.find("IS_LIST_EMPTY_AND_JUMP_IF_FALSE") != std::string::npos);
+        REQUIRE(disassembly.find("REPUSH_AND_LOAD_FROM_PTR") != std::string::npos);
+        REQUIRE(vm.run("Main.arithmetic", { samal::ExternalVMValue::wrapInt32(vm, 7), samal::ExternalVMValue::wrapInt64(vm, 7) }).dump() == "(24, 24i64)");
+        REQUIRE(vm.run("Main.arithmetic", { samal::ExternalVMValue::wrapInt32(vm, -7), samal::ExternalVMValue::wrapInt64(vm, -7) }).dump() == "(-11, -11i64)");
+        REQUIRE(vm.run("Main.compare", { samal::ExternalVMValue::wrapInt32(vm, 3), samal::ExternalVMValue::wrapInt64(vm, 7) }).dump() == "101");
+        REQUIRE(vm.run("Main.compare", { samal::ExternalVMValue::wrapInt32(vm, 5), samal::ExternalVMValue::wrapInt64(vm, 8) }).dump() == "1010");
+        REQUIRE(vm.run("Main.sumTest", std::vector<samal::ExternalVMValue>{}).dump() == "10");
+    }
+}
+
+TEST_CASE("Native functions with raw callbacks", "[samal_whole_system]") {
+    const char* code = R"(
+native fn weightedSum(a : i32, b : i64, c : bool) -> i64
+fn test(n : i32) -> i64 {
+    weightedSum(n, 100i64, true) + weightedSum(0 - n, 7i64, false)
+})";
+    for(auto mode : { samal::InterpreterMode::Switch, samal::InterpreterMode::Threaded }) {
+        samal::Parser parser;
+        auto ast = parser.parse("Main", code);
+        REQUIRE(ast.first);
+        std::vector<samal::up<samal::ModuleRootNode>> modules;
+        modules.emplace_back(std::move(ast.first));
+        using samal::Datatype;
+        using samal::DatatypeCategory;
+        std::vector<samal::NativeFunction> natives;
+        natives.emplace_back(samal::NativeFunction{
+            "Main.weightedSum",
+            Datatype::createFunctionType(Datatype::createSimple(DatatypeCategory::i64), { Datatype::createSimple(DatatypeCategory::i32), Datatype::createSimple(DatatypeCategory::i64), Datatype::createSimple(DatatypeCategory::bool_) }),
+            {},
+            [](samal::VM&, int64_t a, int64_t b, int64_t c, int64_t, int64_t) -> int64_t {
+                // only the lower bytes of small values are meaningful
+                return static_cast<int32_t>(a) * b + ((c & 0xFF) ? 1 : 0);
+            } });
+        samal::Compiler comp{ modules, std::move(natives) };
+        auto program = comp.compile();
+        // both calls can be linked to the native function
+        REQUIRE(program.staticNativeCallTargets.size() == 2);
+        samal::VM vm{ std::move(program), testParameters(samal::VMParameters{ .interpreterMode = mode }) };
+        REQUIRE(vm.run("Main.test", { samal::ExternalVMValue::wrapInt32(vm, 3) }).dump() == "280i64");
+        REQUIRE(vm.run("Main.test", { samal::ExternalVMValue::wrapInt32(vm, -2) }).dump() == "-185i64");
+    }
+}
+
+// the JIT calls raw callbacks without leaving the native code, so the VM doesn't know the current ip and stack there
+#ifndef SAMAL_ENABLE_JIT
+TEST_CASE("Stack traces inside raw native callbacks include the caller's variables", "[samal_whole_system]") {
+    const char* code = R"(
+native fn traced(a : i32, b : i64) -> i64
+fn test(n : i32) -> i64 {
+    doubled = n * 2
+    traced(doubled, 5i64) + 1i64
+})";
+    // raw callbacks can't capture anything
+    static std::string stacktrace;
+    for(auto mode : { samal::InterpreterMode::Switch, samal::InterpreterMode::Threaded }) {
+        samal::Parser parser;
+        auto ast = parser.parse("Main", code);
+        REQUIRE(ast.first);
+        std::vector<samal::up<samal::ModuleRootNode>> modules;
+        modules.emplace_back(std::move(ast.first));
+        using samal::Datatype;
+        using samal::DatatypeCategory;
+        std::vector<samal::NativeFunction> natives;
+        natives.emplace_back(samal::NativeFunction{
+            "Main.traced",
+            Datatype::createFunctionType(Datatype::createSimple(DatatypeCategory::i64), { Datatype::createSimple(DatatypeCategory::i32), Datatype::createSimple(DatatypeCategory::i64) }),
+            {},
+            [](samal::VM& vm, int64_t a, int64_t b, int64_t, int64_t, int64_t) -> int64_t {
+                stacktrace = vm.dumpVariablesOnStack();
+                return static_cast<int32_t>(a) * b;
+            } });
+        samal::Compiler comp{ modules, std::move(natives) };
+        samal::VM vm{ comp.compile(), testParameters(samal::VMParameters{ .interpreterMode = mode }) };
+        stacktrace.clear();
+        REQUIRE(vm.run("Main.test", { samal::ExternalVMValue::wrapInt32(vm, 21) }).dump() == "211i64");
+        REQUIRE(stacktrace == "Main.test\n param$1: 5i64\n param$0: 42\n doubled: 42\n n: 21\n");
+    }
+}
+#endif
+
+TEST_CASE("Native functions with call frames", "[samal_whole_system]") {
+    const char* code = R"(
+native fn weightedSum(l : [i32], factor : i64) -> i64
+native fn twice(a : i32) -> i32
+fn test(n : i32) -> i64 {
+    weightedSum([1, 2, twice(n)], 10i64) + weightedSum([:i32], 5i64)
+})";
+    samal::Parser parser;
+    auto ast = parser.parse("Main", code);
+    REQUIRE(ast.first);
+    std::vector<samal::up<samal::ModuleRootNode>> modules;
+    modules.emplace_back(std::move(ast.first));
+    using samal::Datatype;
+    using samal::DatatypeCategory;
+    const auto i32Type = Datatype::createSimple(DatatypeCategory::i32);
+    const auto i64Type = Datatype::createSimple(DatatypeCategory::i64);
+    std::vector<samal::NativeFunction> natives;
+    natives.emplace_back(samal::NativeFunction{
+        "Main.weightedSum",
+        Datatype::createFunctionType(i64Type, { Datatype::createListType(i32Type), i64Type }),
+        {},
+        nullptr,
+        [](samal::NativeCallFrame& frame) {
+            int64_t sum = 0;
+            for(auto* element : frame.argList(0)) {
+                int32_t value;
+                memcpy(&value, element, 4);
+                sum += value;
+            }
+            frame.setReturn(sum * frame.arg<int64_t>(1));
+        } });
+    // callbacks taking ExternalVMValues still work
+    natives.emplace_back(samal::NativeFunction{
+        "Main.twice",
+        Datatype::createFunctionType(i32Type, { i32Type }),
+        [](samal::VM& vm, const std::vector<samal::ExternalVMValue>& params) -> samal::ExternalVMValue {
+            return samal::ExternalVMValue::wrapInt32(vm, params.at(0).as<int32_t>() * 2);
+        } });
+    samal::Compiler comp{ modules, std::move(natives) };
+    samal::VM vm{ comp.compile(), testParameters() };
+    REQUIRE(vm.run("Main.test", { samal::ExternalVMValue::wrapInt32(vm, 4) }).dump() == "110i64");
+    REQUIRE(vm.run("Main.test", { samal::ExternalVMValue::wrapInt32(vm, -5) }).dump() == "-70i64");
+}
+
 #ifdef SAMAL_LANG_BENCHMARKS
+TEST_CASE("Parallel GC benchmark", "[samal_whole_system]") {
+    // most of the time is spent copying the list of structs, which is alive during all collections
+    const char* code = R"(
+struct Entry {
+    id : i32,
+    name : [char],
+    position : $(i64, i64)
+}
+fn build(n : i32, acc : [Entry]) -> [Entry] {
+    if n == 0 {
+        acc
+    } else {
+        @tail_call_self(n - 1, Entry{id : n, name : "entry", position : $(1i64, 2i64)} + acc)
+    }
+}
+fn sum(l : [Entry], acc : i32) -> i32 {
+    if l == [] {
+        acc
+    } else {
+        @tail_call_self(l:tail, acc + l:head:id)
+    }
+}
+fn test(n : i32) -> i32 {
+    sum(build(n, [:Entry]), 0)
+})";
+    // timing whole runs would mostly measure the interpreter, so the pauses are taken from the GC statistics
+    const auto toMs = [](std::chrono::nanoseconds duration) {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    };
+    for(int32_t gcThreads : { 1, 2, 4 }) {
+        auto vm = compileSimple(code, samal::VMParameters{ .functionsCallsPerGCRun = 2000, .gcThreads = gcThreads });
+        for(int32_t i = 0; i < 10; ++i) {
+            REQUIRE(vm.run("Main.test", { samal::ExternalVMValue::wrapInt32(vm, 20000) }).dump() == "200010000");
+        }
+        const auto& stats = vm.getGCStatistics();
+        printf("list of 20000 structs, %d GC threads: %zu collections, total pause %.3f ms, max pause %.3f ms, p50 pause %.3f ms\n",
+            gcThreads, stats.minorCollections + stats.majorCollections, toMs(stats.totalPauseDuration), toMs(stats.maxPauseDuration), toMs(stats.getPausePercentile(0.5)));
+    }
+}
 TEST_CASE("fib(28) benchmark", "[samal_whole_system]") {
     auto vm = compileSimple(R"(
 fn fib(n : i32) -> i32 {
@@ -501,4 +1758,35 @@ fn fib(n : i32) -> i32 {
         REQUIRE(vmRet.dump() == "317811");
     };
 }
-#endif
\ No newline at end of file
+TEST_CASE("Interpreter dispatch benchmark", "[samal_whole_system]") {
+    const char* code = R"(
+fn fib32(n : i32) -> i32 {
+    if n < 2 {
+        n
+    } else {
+        fib32(n - 1) + fib32(n - 2)
+    }
+}
+fn fib64(n : i64) -> i64 {
+    if n < 2i64 {
+        n
+    } else {
+        fib64(n - 1i64) + fib64(n - 2i64)
+    }
+})";
+    auto switchVM = compileSimple(code, samal::VMParameters{ .interpreterMode = samal::InterpreterMode::Switch });
+    auto threadedVM = compileSimple(code, samal::VMParameters{ .interpreterMode = samal::InterpreterMode::Threaded });
+    BENCHMARK("fib32(25) switch") {
+        return switchVM.run("Main.fib32", { samal::ExternalVMValue::wrapInt32(switchVM, 25) });
+    };
+    BENCHMARK("fib32(25) threaded") {
+        return threadedVM.run("Main.fib32", { samal::ExternalVMValue::wrapInt32(threadedVM, 25) });
+    };
+    BENCHMARK("fib64(25) switch") {
+        return switchVM.run("Main.fib64", { samal::ExternalVMValue::wrapInt64(switchVM, 25) });
+    };
+    BENCHMARK("fib64(25) threaded") {
+        return threadedVM.run("Main.fib64", { samal::ExternalVMValue::wrapInt64(threadedVM, 25) });
+    };
+}
+#endif